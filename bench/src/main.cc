@@ -0,0 +1,526 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * ネイティブの処理の速度を計測する
+ *
+ *   ql_unmht_bench decode THREADS ROUNDS PATH...
+ *     PATH の MHT ファイルの全てのパートのボディを、
+ *     1 スレッドと THREADS スレッドでそれぞれ ROUNDS 回デコードし、
+ *     速度と速度の比を表示する
+ *     テキストのパートは ql_unmht.js と同様に charset から UTF-8 にも変換する
+ *     デコードした結果がスレッド数で異なれば失敗する
+ *
+ *   ql_unmht_bench utf8 ROUNDS PATH...
+ *     PATH の MHT ファイルのテキストのパートのボディをデコードし、
+ *     checkText で UTF-8 への変換が不要かを ROUNDS 回調べて速度を表示する
+ *     charset が無いパートは UTF-8 として調べる
+ *
+ *   ディレクトリは再帰的に辿り、拡張子が .mht, .mhtml, .eml のファイルを加える
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <decode.h>
+#include <hash.h>
+#include <scan.h>
+#include <spill.h>
+#include <unmht.h>
+#include <utf8.h>
+
+/**
+ * 展開するファイルの拡張子か
+ *
+ * @param   name
+ *          ファイル名
+ * @returns 拡張子が .mht, .mhtml, .eml か
+ */
+static bool
+hasArchiveExtension(const char *name) {
+  static const char *extensions[] = { ".mht", ".mhtml", ".eml", NULL };
+  size_t length = strlen(name);
+  for (int i = 0; extensions[i]; i ++) {
+    size_t extLength = strlen(extensions[i]);
+    if (length > extLength &&
+        strcasecmp(name + length - extLength, extensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * ディレクトリを再帰的に辿ってファイルを集める
+ *
+ * @param   path
+ *          ファイルかディレクトリのパス
+ * @param   explicitPath
+ *          コマンドラインで指定したパスか
+ *          指定したファイルは拡張子に関わらず加える
+ * @param   paths
+ *          (出力) ファイルのパス
+ */
+static void
+gatherPaths(const std::string &path, bool explicitPath,
+            std::vector<std::string> *paths) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) {
+    fprintf(stderr, "ql_unmht_bench: %s: not found\n", path.c_str());
+    return;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    if (explicitPath || hasArchiveExtension(path.c_str())) {
+      paths->push_back(path);
+    }
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return;
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    gatherPaths(path + "/" + entry->d_name, false, paths);
+  }
+  closedir(dir);
+}
+
+/**
+ * ファイルを全て読み込む
+ *
+ * @param   path
+ *          ファイルのパス
+ * @param   content
+ *          (出力) ファイルの内容
+ * @returns 成功したか
+ */
+static bool
+readFile(const char *path, std::string *content) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    content->append(buffer, n);
+  }
+  bool result = !ferror(f);
+  fclose(f);
+  return result;
+}
+
+/**
+ * コマンドラインのパスのファイルを全て読み込む
+ *
+ * @param   argc
+ *          パスの数
+ * @param   argv
+ *          パス
+ * @param   contents
+ *          (出力) ファイルの内容
+ * @returns 1 つ以上読み込めたか
+ */
+static bool
+readInputs(int argc, char **argv, std::vector<std::string> *contents) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < argc; i ++) {
+    gatherPaths(argv[i], true, &paths);
+  }
+  for (size_t i = 0; i < paths.size(); i ++) {
+    std::string content;
+    if (!readFile(paths[i].c_str(), &content)) {
+      fprintf(stderr, "ql_unmht_bench: %s: cannot read\n", paths[i].c_str());
+      continue;
+    }
+    contents->push_back(content);
+  }
+  if (contents->empty()) {
+    fprintf(stderr, "ql_unmht_bench: no files\n");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * 1 つのファイルのデコードするパート
+ */
+struct DecodeInput {
+  std::vector<decodejob> jobs;  /* デコードするパート */
+  size_t sourceSize;            /* エンコードされたボディの長さの合計 */
+};
+
+/**
+ * ファイルをスキャンしてデコードするパートを集める
+ * ql_unmht.js と同様に、テキストのパートは charset も指定する
+ *
+ * @param   content
+ *          MHT ファイルの内容
+ *          input より長く有効でなければならない
+ * @param   input
+ *          (出力) デコードするパート
+ * @returns スキャン結果
+ *          jobs の文字列はこれが所有する
+ */
+static sfileinfo *
+collectJobs(const std::string &content, DecodeInput *input) {
+  sfileinfo *scan = scan_parts(content.data(), content.size());
+  input->sourceSize = 0;
+  if (scan == NULL) {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < scan->partsCount; i ++) {
+    const scanpart *p = &scan->parts[i];
+    if (p->isMultipart) {
+      continue;
+    }
+
+    decodejob job;
+    job.source = content.data() + p->bodyOffset;
+    job.sourceSize = p->bodySize;
+    job.encoding = parseTransferEncoding(p->transferEncoding);
+    job.charset = NULL;
+    if (p->charset && p->charset[0] &&
+        (strncmp(p->mimetype, "text/", 5) == 0 ||
+         strcmp(p->mimetype, "application/xhtml+xml") == 0)) {
+      job.charset = p->charset;
+    }
+    job.spillSize = 0;
+    input->jobs.push_back(job);
+    input->sourceSize += p->bodySize;
+  }
+
+  return scan;
+}
+
+/**
+ * デコードした結果を開放する
+ *
+ * @param   results
+ *          デコードしたパート
+ */
+static void
+releaseResults(std::vector<decodedpart> *results) {
+  for (size_t i = 0; i < results->size(); i ++) {
+    decodedpart *r = &(*results)[i];
+    if (r->content == NULL) {
+      continue;
+    }
+    if (r->spilled) {
+      releaseSpill(r->content, r->contentSize + 1);
+    } else {
+      free(r->content);
+    }
+  }
+}
+
+/**
+ * デコードした結果のハッシュ値を計算する
+ *
+ * @param   results
+ *          デコードしたパート
+ * @param   seed
+ *          これまでのハッシュ値
+ * @returns ハッシュ値
+ */
+static uint64_t
+hashResults(const std::vector<decodedpart> &results, uint64_t seed) {
+  uint64_t h = seed;
+  for (size_t i = 0; i < results.size(); i ++) {
+    const decodedpart *r = &results[i];
+    if (r->sameAs >= 0) {
+      r = &results[r->sameAs];
+    }
+    if (!r->succeeded) {
+      h = hashBytes("failed", 6, h);
+      continue;
+    }
+    h = hashBytes(r->content, r->contentSize, h);
+  }
+  return h;
+}
+
+/**
+ * 全てのファイルのパートを繰り返しデコードする
+ *
+ * @param   inputs
+ *          ファイル毎のデコードするパート
+ * @param   threads
+ *          スレッド数
+ * @param   rounds
+ *          全てのファイルをデコードする回数
+ * @param   hash
+ *          (出力) 最後の回でデコードした結果のハッシュ値
+ * @returns 掛かった時間 (秒)
+ */
+static double
+runDecode(const std::vector<DecodeInput> &inputs, unsigned threads,
+          size_t rounds, uint64_t *hash) {
+  set_decode_thread_count(threads);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; round ++) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < inputs.size(); i ++) {
+      const std::vector<decodejob> &jobs = inputs[i].jobs;
+      std::vector<decodedpart> results(jobs.size());
+      decodeParts(jobs.data(), jobs.size(), results.data());
+      if (round == rounds - 1) {
+        h = hashResults(results, h);
+      }
+      releaseResults(&results);
+    }
+    *hash = h;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - start).count();
+}
+
+/**
+ * デコードの速度を計測する
+ *
+ * @param   argc
+ *          引数の数
+ * @param   argv
+ *          THREADS ROUNDS PATH...
+ * @returns 終了コード
+ */
+static int
+benchDecode(int argc, char **argv) {
+  int threads = atoi(argv[0]);
+  long rounds = atol(argv[1]);
+  if (threads < 1 || rounds < 1) {
+    return 2;
+  }
+
+  std::vector<std::string> contents;
+  if (!readInputs(argc - 2, argv + 2, &contents)) {
+    return 2;
+  }
+
+  std::vector<DecodeInput> inputs(contents.size());
+  std::vector<sfileinfo *> scans;
+  size_t parts = 0, bytes = 0;
+  for (size_t i = 0; i < contents.size(); i ++) {
+    sfileinfo *scan = collectJobs(contents[i], &inputs[i]);
+    if (scan) {
+      scans.push_back(scan);
+    }
+    parts += inputs[i].jobs.size();
+    bytes += inputs[i].sourceSize;
+  }
+  printf("files=%zu parts=%zu encoded_bytes=%zu\n",
+         contents.size(), parts, bytes);
+
+  const unsigned counts[] = { 1, static_cast<unsigned>(threads) };
+  double rates[2];
+  uint64_t hashes[2];
+  for (int k = 0; k < 2; k ++) {
+    double seconds = runDecode(inputs, counts[k], rounds, &hashes[k]);
+    rates[k] = seconds > 0 ? bytes * rounds / seconds / (1024 * 1024) : 0;
+    printf("threads=%u seconds=%.3f rate=%.1fMB/s\n",
+           counts[k], seconds, rates[k]);
+  }
+  printf("speedup=%.2f\n", rates[0] > 0 ? rates[1] / rates[0] : 0);
+
+  for (size_t i = 0; i < scans.size(); i ++) {
+    delete_sfileinfo(scans[i]);
+  }
+
+  if (hashes[0] != hashes[1]) {
+    fprintf(stderr, "ql_unmht_bench: results differ between thread counts\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * 調べるテキストのパート
+ */
+struct TextInput {
+  std::string content; /* デコードしたボディ */
+  std::string charset; /* charset */
+};
+
+/**
+ * ファイルのテキストのパートをデコードして集める
+ *
+ * @param   content
+ *          MHT ファイルの内容
+ * @param   texts
+ *          (出力) テキストのパート
+ */
+static void
+collectTexts(const std::string &content, std::vector<TextInput> *texts) {
+  sfileinfo *scan = scan_parts(content.data(), content.size());
+  if (scan == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < scan->partsCount; i ++) {
+    const scanpart *p = &scan->parts[i];
+    if (p->isMultipart ||
+        (strncmp(p->mimetype, "text/", 5) != 0 &&
+         strcmp(p->mimetype, "application/xhtml+xml") != 0)) {
+      continue;
+    }
+
+    decodejob job;
+    job.source = content.data() + p->bodyOffset;
+    job.sourceSize = p->bodySize;
+    job.encoding = parseTransferEncoding(p->transferEncoding);
+    job.charset = NULL;
+    job.spillSize = 0;
+    decodedpart result;
+    if (!decodePart(&job, &result)) {
+      continue;
+    }
+
+    TextInput text;
+    text.content.assign(result.content, result.contentSize);
+    text.charset = p->charset && p->charset[0] ? p->charset : "utf-8";
+    texts->push_back(text);
+    free(result.content);
+  }
+
+  delete_sfileinfo(scan);
+}
+
+/**
+ * UTF-8 の検証の速度を計測する
+ *
+ * @param   argc
+ *          引数の数
+ * @param   argv
+ *          ROUNDS PATH...
+ * @returns 終了コード
+ */
+static int
+benchUTF8(int argc, char **argv) {
+  long rounds = atol(argv[0]);
+  if (rounds < 1) {
+    return 2;
+  }
+
+  std::vector<std::string> contents;
+  if (!readInputs(argc - 1, argv + 1, &contents)) {
+    return 2;
+  }
+
+  std::vector<TextInput> texts;
+  for (size_t i = 0; i < contents.size(); i ++) {
+    collectTexts(contents[i], &texts);
+  }
+
+  size_t bytes = 0;
+  size_t kindBytes[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < texts.size(); i ++) {
+    const TextInput &t = texts[i];
+    textkind kind = checkText(t.content.data(), t.content.size(),
+                              t.charset.c_str());
+    bytes += t.content.size();
+    kindBytes[kind] += t.content.size();
+  }
+  printf("files=%zu texts=%zu bytes=%zu\n", contents.size(), texts.size(),
+         bytes);
+  printf("ascii_bytes=%zu utf8_bytes=%zu convert_bytes=%zu\n",
+         kindBytes[TEXT_KIND_ASCII], kindBytes[TEXT_KIND_UTF8],
+         kindBytes[TEXT_KIND_OTHER]);
+
+  /* 最適化で呼び出しが省かれないように結果を足し合わせる */
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long round = 0; round < rounds; round ++) {
+    for (size_t i = 0; i < texts.size(); i ++) {
+      const TextInput &t = texts[i];
+      sink += checkText(t.content.data(), t.content.size(), t.charset.c_str());
+    }
+  }
+  double seconds
+    = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                    - start).count();
+
+  double total = static_cast<double>(bytes) * rounds / (1024 * 1024);
+  printf("seconds=%.3f rate=%.1fMB/s\n", seconds,
+         seconds > 0 ? total / seconds : 0);
+  printf("sink=%zu\n", sink);
+
+  return 0;
+}
+
+/**
+ * 使い方を表示する
+ *
+ * @returns 終了コード
+ */
+static int
+usage(void) {
+  fprintf(stderr,
+          "usage: ql_unmht_bench decode THREADS ROUNDS PATH...\n"
+          "       ql_unmht_bench utf8 ROUNDS PATH...\n");
+  return 2;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc >= 5 && strcmp(argv[1], "decode") == 0) {
+    int status = benchDecode(argc - 2, argv + 2);
+    return status == 2 ? usage() : status;
+  }
+  if (argc >= 4 && strcmp(argv[1], "utf8") == 0) {
+    int status = benchUTF8(argc - 2, argv + 2);
+    return status == 2 ? usage() : status;
+  }
+
+  return usage();
+}
@@ -1,6 +1,237 @@
 "use strict";
 
-/* global atob, ConvertFromUnicode, ConvertToUnicode, cidMode, text */
+/* global atob, CheckText, ConvertFromUnicode, ConvertToUnicode, ConvertToUTF8,
+          DecodeParts, ProfileClock, cidMode, htmlMode, profileMode, pruneMode,
+          spliceMode, text */
+
+/* ==== ql_unmht mod: profiler: BEGIN ==== */
+/**
+ * 関数毎の実行時間の計測
+ * profileMode が true の場合のみ、凍結するオブジェクトのメソッドを
+ * 計測用の関数で包む
+ * 時間は ProfileClock が返す GC を除いたマイクロ秒
+ *
+ * @class
+ */
+let arProfiler = (function() {
+  let enabled = typeof profileMode != "undefined" && profileMode
+    && typeof ProfileClock == "function";
+  let freeze = Object.freeze;
+
+  /* メソッドを包んだオブジェクトとその所有者情報 */
+  let owners = new Map();
+
+  /* 呼び出し木の根と、実行中の呼び出しの列 */
+  let root = null;
+  let stack = null;
+
+  /**
+   * 呼び出し木の節を作成する
+   *
+   * @param   {Object} frame
+   *          関数の情報
+   * @returns {Object}
+   *          呼び出し木の節
+   */
+  function createNode(frame) {
+    return {
+      frame: frame,
+      children: new Map(),
+      calls: 0,
+      self: 0,
+      total: 0
+    };
+  }
+
+  /**
+   * 関数の開始を記録する
+   *
+   * @param   {Object} frame
+   *          関数の情報
+   */
+  function enter(frame) {
+    let parent = stack[stack.length - 1].node;
+    let node = parent.children.get(frame);
+    if (!node) {
+      node = createNode(frame);
+      parent.children.set(frame, node);
+    }
+    stack.push({ node: node, start: ProfileClock(), child: 0 });
+  }
+
+  /**
+   * 関数の終了を記録する
+   */
+  function leave() {
+    let entry = stack.pop();
+    let total = ProfileClock() - entry.start;
+    entry.node.calls++;
+    entry.node.self += total - entry.child;
+    entry.node.total += total;
+    if (stack.length > 0) {
+      stack[stack.length - 1].child += total;
+    }
+  }
+
+  /**
+   * 関数を計測用の関数で包む
+   *
+   * @param   {Object} frame
+   *          関数の情報
+   * @param   {Function} fn
+   *          対象の関数
+   * @returns {Function}
+   *          計測用の関数
+   */
+  function wrap(frame, fn) {
+    return function() {
+      if (!stack) {
+        return fn.apply(this, arguments);
+      }
+
+      enter(frame);
+      try {
+        return fn.apply(this, arguments);
+      } finally {
+        leave();
+      }
+    };
+  }
+
+  /**
+   * 関数の名前を返す
+   *
+   * @param   {Object} frame
+   *          関数の情報
+   * @returns {string}
+   *          関数の名前
+   */
+  function frameName(frame) {
+    return frame.key ? frame.owner.name + "." + frame.key : frame.owner.name;
+  }
+
+  if (enabled) {
+    Object.freeze = function(obj) {
+      let owner = { name: "?" };
+      for (let key of Object.keys(obj)) {
+        if (typeof obj[key] == "function") {
+          obj[key] = wrap({ owner: owner, key: key }, obj[key]);
+        }
+      }
+      owners.set(obj, owner);
+      return freeze(obj);
+    };
+  }
+
+  return freeze({
+    enabled: enabled,
+
+    /**
+     * 凍結したオブジェクトに名前を付ける
+     * 最後に Object.freeze を元に戻す
+     *
+     * @param   {Array} named
+     *          [名前, オブジェクト] の配列
+     */
+    name: function(named) {
+      if (!enabled) {
+        return;
+      }
+
+      for (let i = 0; i < named.length; i++) {
+        let owner = owners.get(named[i][1]);
+        if (owner) {
+          owner.name = named[i][0];
+        }
+      }
+      owners.clear();
+      Object.freeze = freeze;
+    },
+
+    /**
+     * 計測を開始する
+     */
+    start: function() {
+      if (!enabled) {
+        return;
+      }
+
+      root = createNode({ owner: { name: "extractMain" }, key: null });
+      stack = [{ node: root, start: ProfileClock(), child: 0 }];
+    },
+
+    /**
+     * 計測を終了する
+     */
+    stop: function() {
+      if (!enabled || !stack) {
+        return;
+      }
+
+      while (stack.length > 0) {
+        leave();
+      }
+      stack = null;
+    },
+
+    /**
+     * 計測結果を返して破棄する
+     *
+     * @returns {?Object}
+     *          stacks: flamegraph.pl に渡せる折り畳んだ呼び出し列
+     *                  "関数;関数;... マイクロ秒" の行
+     *          functions: 関数毎の "名前\t呼び出し回数\t自身の時間\t合計時間" の行
+     *          計測していなければ null
+     */
+    report: function() {
+      if (!root) {
+        return null;
+      }
+
+      let stacks = [];
+      let functions = new Map();
+      let active = new Map();
+      let visit = function(node, path) {
+        let name = frameName(node.frame);
+        path = path ? path + ";" + name : name;
+        if (node.self > 0) {
+          stacks.push(path + " " + Math.round(node.self));
+        }
+
+        let f = functions.get(name);
+        if (!f) {
+          f = { name: name, calls: 0, self: 0, total: 0 };
+          functions.set(name, f);
+        }
+        f.calls += node.calls;
+        f.self += node.self;
+
+        /* 再帰している場合は外側の呼び出しのみ合計時間に数える */
+        let depth = active.get(name) || 0;
+        if (depth == 0) {
+          f.total += node.total;
+        }
+        active.set(name, depth + 1);
+        node.children.forEach(child => visit(child, path));
+        active.set(name, depth);
+      };
+      visit(root, "");
+      root = null;
+
+      let lines = [];
+      functions.forEach(f => lines.push(f));
+      lines.sort((a, b) => b.self - a.self);
+
+      return {
+        stacks: stacks.join("\n") + "\n",
+        functions: lines.map(f => f.name + "\t" + f.calls + "\t"
+                             + Math.round(f.self) + "\t"
+                             + Math.round(f.total)).join("\n") + "\n"
+      };
+    }
+  });
+})();
+/* ==== ql_unmht mod: profiler: END ==== */
 
 let UnMHTExtractor = (function() {
 
@@ -141,13 +372,43 @@ let arUconv = Object.freeze({
   toUnicode: function(text, charset) {
     try {
       /* ==== ql_unmht mod: use native function: BEGIN ==== */
+      if (typeof CheckText == "function" &&
+          CheckText(text, charset) == "ascii") {
+        /* ASCII のみならば変換しても同じ */
+        return text;
+      }
       return ConvertToUnicode(text, charset);
       /* ==== ql_unmht mod: use native function: END ==== */
     } catch (e) {
     }
 
     return text;
+  },
+
+  /* ==== ql_unmht mod: use native function: BEGIN ==== */
+  /**
+   * UTF16 を経由せずに UTF-8 に変換する
+   *
+   * @param   {string} text
+   *          変換する文字列
+   * @param   {string} charset
+   *          変換元の文字コード
+   * @returns {string}
+   *          UTF-8 の文字列
+   */
+  toUTF8: function(text, charset) {
+    try {
+      if (typeof CheckText == "function" && CheckText(text, charset)) {
+        /* ASCII のみか正しい UTF-8 ならば変換しても同じ */
+        return text;
+      }
+      return ConvertToUTF8(text, charset);
+    } catch (e) {
+    }
+
+    return toUTF8(this.toUnicode(text, charset));
   }
+  /* ==== ql_unmht mod: use native function: END ==== */
 });
 
 /**
@@ -287,11 +548,19 @@ let arMIMEDecoder = Object.freeze({
    * @param   {string} text
    *          メッセージ
    *          改行コードは CR LF でなければならない
+   * @param   {boolean} deferBody
+   *          (オプショナル)
+   *          Content-Transfer-Encoding のデコードを後回しにするか
+   *          後回しにしたパートは decodePendingBodies でデコードする
+   * @param   {number} offset
+   *          (オプショナル)
+   *          元のファイル中のメッセージの位置
+   *          不明ならば -1
    * @returns {?arMIMEPart}
    *          トップレベルのパート
    *          データが不正ならば null
    */
-  decodeMessage: function(text) {
+  decodeMessage: function(text, deferBody=false, offset=-1) {
     let part = null;
 
     let context = new arMIMEParser(text);
@@ -305,17 +574,39 @@ let arMIMEDecoder = Object.freeze({
       return null;
     }
 
+    /* ==== ql_unmht mod: source range: BEGIN ==== */
+    if (offset >= 0) {
+      if (part.bodyOffset < 0) {
+        part.bodyOffset = text.length;
+      }
+      part.headerOffset = offset;
+      part.headerSize = part.bodyOffset;
+      part.bodyOffset += offset;
+      part.bodySize = part.body.length;
+    } else {
+      part.bodyOffset = -1;
+    }
+    /* ==== ql_unmht mod: source range: END ==== */
+
     this.decodeFields(part);
 
     if (part.isMultipart) {
       let isCorrupted = { value: false };
-      part.parts = this._decodeMultipart(part.body, part.boundary, isCorrupted);
+      part.parts = this._decodeMultipart(part.body, part.boundary, isCorrupted,
+                                         deferBody, part.bodyOffset);
       part.isCorrupted = isCorrupted.value;
     } else {
       if (part.format == "flowed") {
         part.body = this.decodeFlowed(part.body, part.delsp);
       }
 
+      /* ==== ql_unmht mod: native decode: BEGIN ==== */
+      if (deferBody &&
+          (part.contentTransferEncoding == "quoted-printable" ||
+           part.contentTransferEncoding == "base64")) {
+        part.isBodyPending = true;
+      } else
+      /* ==== ql_unmht mod: native decode: END ==== */
       if (part.contentTransferEncoding == "quoted-printable") {
         part.body = this.decodeQ(part.body);
       } else if (part.contentTransferEncoding == "base64") {
@@ -326,6 +617,92 @@ let arMIMEDecoder = Object.freeze({
     return part;
   },
 
+  /* ==== ql_unmht mod: native decode: BEGIN ==== */
+  /**
+   * decodeMessage で後回しにしたボディをまとめてデコードする
+   * ネイティブの DecodeParts があればスレッドプールでデコードする
+   *
+   * @param   {arMIMEPart} topPart
+   *          トップレベルのパート
+   */
+  decodePendingBodies: function(topPart) {
+    let pendings = [];
+    let gather = function(part) {
+      if (part.isMultipart) {
+        for (let p of part.parts) {
+          gather(p);
+        }
+      } else if (part.isBodyPending) {
+        pendings.push(part);
+      }
+    };
+    gather(topPart);
+
+    this.decodeBodies(pendings);
+  },
+
+  /**
+   * デコードを保留したパートのボディをまとめてデコードする
+   * ネイティブの DecodeParts ではテキストのパートを UTF-8 にも変換し、
+   * 変換したパートの charset を utf-8 にする
+   *
+   * @param   {Array.<arMIMEPart>} pendings
+   *          デコードを保留したパート
+   */
+  decodeBodies: function(pendings) {
+    if (!pendings.length) {
+      return;
+    }
+
+    if (typeof DecodeParts == "function") {
+      let charsets = pendings.map(function(part) {
+          if (part.charset &&
+              (part.contentType == "text" ||
+               part.mimetype == "application/xhtml+xml")) {
+            return part.charset;
+          }
+          return "";
+        });
+      let bodies
+        = DecodeParts(pendings.map(p => p.body),
+                      pendings.map(p => p.contentTransferEncoding),
+                      charsets);
+      pendings.forEach(function(part, i) {
+          if (bodies[i] === null) {
+            /* ネイティブで失敗したパートは変換せずにデコードし直す */
+            this._decodeBody(part);
+            return;
+          }
+          part.body = bodies[i];
+          if (charsets[i]) {
+            part.charset = "utf-8";
+          }
+          part.isBodyPending = false;
+        }, this);
+      return;
+    }
+
+    for (let part of pendings) {
+      this._decodeBody(part);
+    }
+  },
+
+  /**
+   * デコードを保留したパートのボディをデコードする
+   *
+   * @param   {arMIMEPart} part
+   *          デコードを保留したパート
+   */
+  _decodeBody: function(part) {
+    if (part.contentTransferEncoding == "quoted-printable") {
+      part.body = this.decodeQ(part.body);
+    } else if (part.contentTransferEncoding == "base64") {
+      part.body = this.decodeBase64(part.body);
+    }
+    part.isBodyPending = false;
+  },
+  /* ==== ql_unmht mod: native decode: END ==== */
+
   /**
    * フィールドをデコードする
    *
@@ -462,6 +839,12 @@ let arMIMEDecoder = Object.freeze({
           part.contentTransferEncoding = encoding;
         }
       }
+
+      /* ==== ql_unmht mod: native body: BEGIN ==== */
+      if (part.hasField("X-UnMHT-Native")) {
+        part.nativeBody = part.getField("X-UnMHT-Native").trim();
+      }
+      /* ==== ql_unmht mod: native body: END ==== */
     }
   },
 
@@ -527,21 +910,31 @@ let arMIMEDecoder = Object.freeze({
    *          {
    *            value: {boolean} 破損したかどうか
    *          }
+   * @param   {boolean} deferBody
+   *          (オプショナル)
+   *          Content-Transfer-Encoding のデコードを後回しにするか
+   * @param   {number} offset
+   *          (オプショナル)
+   *          元のファイル中のボディの位置
+   *          不明ならば -1
    * @returns {Array.<arMIMEPart>}
    *          パートの配列
    */
-  _decodeMultipart: function(body, boundary, currpted) {
+  _decodeMultipart: function(body, boundary, currpted, deferBody=false,
+                             offset=-1) {
     let ret = [];
+    let offsets = [];
 
     let context = new arMIMEParser(body);
     context._O(() => {
-      let tmp = context.multipart_body(boundary, currpted);
+      let tmp = context.multipart_body(boundary, currpted, offsets);
       context.__END();
       ret = tmp;
     });
 
     return ret
-      .map(data => this.decodeMessage(data))
+      .map((data, i) => this.decodeMessage(data, deferBody,
+                                           offset >= 0 ? offset + offsets[i] : -1))
       .filter(part => part);
   },
 
@@ -1377,9 +1770,12 @@ arMIMEParser.prototype = Object.freeze({
    *          {
    *            value: {boolean} 破損したかどうか
    *          }
+   * @param   {Array.<number>} offsets
+   *          (オプショナル)
+   *          (出力) 入力中の各 body-part の位置
    * @returns {Array.<string>}
    */
-  multipart_body: function(boundary, isCorrupted) {
+  multipart_body: function(boundary, isCorrupted, offsets) {
     let dash_boundary = "--" + boundary;
 
     this._SKIP_TO(dash_boundary, true);
@@ -1393,6 +1789,9 @@ arMIMEParser.prototype = Object.freeze({
     while (!closed) {
       let done = false;
       let s = "";
+      if (offsets) {
+        offsets.push(this._POS);
+      }
 
       while (!done) {
         let hasDelimiter = false;
@@ -3080,6 +3479,9 @@ arMIMEParser.prototype = Object.freeze({
     });
     this._O(() => {
       this.CRLF();
+      /* ==== ql_unmht mod: source range: BEGIN ==== */
+      part.bodyOffset = this._POS;
+      /* ==== ql_unmht mod: source range: END ==== */
       part.body = this._ALL_CHARS();
     });
 
@@ -3337,6 +3739,51 @@ function arMIMEPart() {
    */
   this.contentTransferEncoding = "";
 
+  /* ==== ql_unmht mod: native decode: BEGIN ==== */
+  /**
+   * body の Content-Transfer-Encoding のデコードを後回しにしているか
+   * @type {boolean}
+   */
+  this.isBodyPending = false;
+  /* ==== ql_unmht mod: native decode: END ==== */
+
+  /* ==== ql_unmht mod: source range: BEGIN ==== */
+  /**
+   * 元のファイル中のヘッダの位置
+   * 不明ならば -1
+   * @type {number}
+   */
+  this.headerOffset = -1;
+
+  /**
+   * ヘッダの長さ (空行を含む)
+   * @type {number}
+   */
+  this.headerSize = 0;
+
+  /**
+   * 元のファイル中のエンコードされたボディの位置
+   * 不明ならば -1
+   * @type {number}
+   */
+  this.bodyOffset = -1;
+
+  /**
+   * エンコードされたボディの長さ
+   * @type {number}
+   */
+  this.bodySize = 0;
+  /* ==== ql_unmht mod: source range: END ==== */
+
+  /* ==== ql_unmht mod: native body: BEGIN ==== */
+  /**
+   * ボディをネイティブ側で保持している場合の識別子
+   * 保持していなければ空文字列
+   * @type {string}
+   */
+  this.nativeBody = "";
+  /* ==== ql_unmht mod: native body: END ==== */
+
   /* ---- 他 ---- */
 
   /**
@@ -4382,6 +4829,12 @@ let UnMHTCache = Object.freeze({
       }
     }
 
+    /* ==== ql_unmht mod: prune: BEGIN ==== */
+    if (targetPart && eFileInfo.reachedParts) {
+      eFileInfo.reachedParts.push(targetPart);
+    }
+    /* ==== ql_unmht mod: prune: END ==== */
+
     return [targetPart, fragment];
   },
 
@@ -5029,6 +5482,14 @@ function UnMHTExtractParam() {
   this.isStartPart = false;
   /* ==== ql_unmht mod: isStartPart: END ==== */
 
+  /* ==== ql_unmht mod: prune: BEGIN ==== */
+  /**
+   * 開始パートから参照されないのでデコードも変換もしていないか
+   * @type {boolean}
+   */
+  this.isPruned = false;
+  /* ==== ql_unmht mod: prune: END ==== */
+
   Object.seal(this);
 }
 UnMHTExtractParam.prototype = Object.freeze({
@@ -5118,6 +5579,24 @@ function UnMHTExtractFileInfo() {
    */
   this.size = 0;
 
+  /* ==== ql_unmht mod: prune: BEGIN ==== */
+  /**
+   * 変換中に参照されたパート
+   * 参照を辿らない場合は null
+   * @type {?Array.<arMIMEPart>}
+   */
+  this.reachedParts = null;
+  /* ==== ql_unmht mod: prune: END ==== */
+
+  /* ==== ql_unmht mod: reference splice: BEGIN ==== */
+  /**
+   * baseURI が入力に含まれない仮の文字列で、
+   * 呼び出し元が参照の位置を記録して置き換えるか
+   * @type {boolean}
+   */
+  this.isSpliced = false;
+  /* ==== ql_unmht mod: reference splice: END ==== */
+
   Object.seal(this);
 }
 UnMHTExtractFileInfo.prototype = Object.freeze({
@@ -5155,10 +5634,19 @@ let UnMHTExtractor = Object.freeze({
    *          展開したファイル名の URI 表記
    * @param   {string} text
    *          mht ファイルの内容
+   * @param   {boolean} prune
+   *          開始パートから参照を辿れるパートのみデコードして変換するか
+   * @param   {boolean} html
+   *          ヘッダの無い HTML と判明しているか
+   *          true ならばメッセージとして解析せずに HTML のパートを作成する
+   * @param   {?string} baseURI
+   *          参照の起点となる URI
+   *          null ならば originalURISpec を使用する
    * @returns {UnMHTExtractFileInfo}
    *          展開情報
    */
-  extractMHT: function(originalURISpec, text) {
+  extractMHT: function(originalURISpec, text, prune=false, html=false,
+                       baseURI=null) {
     let eFileInfo = new UnMHTExtractFileInfo();
 
     /* とりあえず特殊な文字はエスケープしておく */
@@ -5173,17 +5661,40 @@ let UnMHTExtractor = Object.freeze({
     /* ==== ql_unmht mod: remove: unmht scheme: BEGIN ==== */
     eFileInfo.baseURI = eFileInfo.original;
     /* ==== ql_unmht mod: remove: unmht scheme: END ==== */
+    /* ==== ql_unmht mod: reference splice: BEGIN ==== */
+    if (baseURI) {
+      eFileInfo.baseURI = baseURI;
+    }
+    /* ==== ql_unmht mod: reference splice: END ==== */
 
     eFileInfo.source = text;
 
     /* ==== ql_unmht mod: remove unused: date ==== */
 
-    eFileInfo.topPart = arMIMEDecoder.decodeMessage(text);
+    /* ==== ql_unmht mod: sniff: BEGIN ==== */
+    if (html) {
+      /* メッセージとして解析しても失敗するので
+       * ダミーのメッセージを作成した場合と同じパートを直接作成する */
+      let part = new arMIMEPart();
+      part.addField("From", "<Created by UnMHT>");
+      part.addField("Content-Type", "text/html; charset=\"UTF-8\"");
+      part.body = text;
+      part.bodyOffset = -1;
+      arMIMEDecoder.decodeFields(part);
+      eFileInfo.topPart = part;
+    } else {
+    /* ==== ql_unmht mod: sniff: END ==== */
+    /* ==== ql_unmht mod: native decode: BEGIN ==== */
+    eFileInfo.topPart = arMIMEDecoder.decodeMessage(text, true, 0);
     if (!eFileInfo.topPart) {
       /* 改行が LF のみ、CR のみを想定してもう一度変換 */
       let crlfText = text.replace(/\r|\n/g, "\r\n");
-      eFileInfo.topPart = arMIMEDecoder.decodeMessage(crlfText);
+      eFileInfo.topPart = arMIMEDecoder.decodeMessage(crlfText, true);
+    }
+    /* ==== ql_unmht mod: native decode: END ==== */
+    /* ==== ql_unmht mod: sniff: BEGIN ==== */
     }
+    /* ==== ql_unmht mod: sniff: END ==== */
 
     if (!eFileInfo.topPart || !eFileInfo.topPart.findStartPart()) {
       /* 展開に失敗した場合 */
@@ -5212,6 +5723,13 @@ let UnMHTExtractor = Object.freeze({
       }
     }
 
+    /* ==== ql_unmht mod: native decode: BEGIN ==== */
+    if (!prune) {
+      /* prune の場合は参照を辿りながらデコードする */
+      arMIMEDecoder.decodePendingBodies(eFileInfo.topPart);
+    }
+    /* ==== ql_unmht mod: native decode: END ==== */
+
     eFileInfo.subject = eFileInfo.topPart.subject;
 
     eFileInfo.date = eFileInfo.topPart.date;
@@ -5227,9 +5745,15 @@ let UnMHTExtractor = Object.freeze({
 
     this._setRefName(eFileInfo);
 
-    for (let part of eFileInfo.parts) {
-      UnMHTContentModifier.modifyContents(eFileInfo, part);
+    /* ==== ql_unmht mod: prune: BEGIN ==== */
+    if (prune) {
+      this._modifyReachedContents(eFileInfo);
+    } else {
+      for (let part of eFileInfo.parts) {
+        UnMHTContentModifier.modifyContents(eFileInfo, part);
+      }
     }
+    /* ==== ql_unmht mod: prune: END ==== */
 
     /* ==== ql_unmht mod: remove: pref: BEGIN ==== */
     this._skipPPTWarning(eFileInfo);
@@ -5299,15 +5823,9 @@ let UnMHTExtractor = Object.freeze({
         eParam.isHTML = true;
       }
 
-      if (eParam.mimetype == "application/octet-stream" &&
-          part.body.slice(0, 32).contains("<")) {
-        /* CGI 生成のページ等が application/octet-stream として
-         * 保存されている場合がある */
-        if (part.body.search(/<html/i) != -1) {
-          eParam.mimetype = "text/html";
-          eParam.isHTML = true;
-        }
-      }
+      /* ==== ql_unmht mod: prune: BEGIN ==== */
+      this._sniffOctetStream(part, eParam);
+      /* ==== ql_unmht mod: prune: END ==== */
     }
 
     eParam.location = arPathUtils.resolve(arPathUtils.getBaseDir(parentLocation),
@@ -5330,6 +5848,83 @@ let UnMHTExtractor = Object.freeze({
     part.eParam.startPart = part.findStartPart();
   },
 
+  /* ==== ql_unmht mod: prune: BEGIN ==== */
+  /**
+   * application/octet-stream として保存された HTML を判別する
+   * CGI 生成のページ等が application/octet-stream として
+   * 保存されている場合がある
+   *
+   * @param   {arMIMEPart} part
+   *          対象のパート
+   * @param   {UnMHTExtractParam} eParam
+   *          パートの情報
+   */
+  _sniffOctetStream: function(part, eParam) {
+    if (eParam.mimetype == "application/octet-stream" &&
+        part.body.slice(0, 32).contains("<")) {
+      if (part.body.search(/<html/i) != -1) {
+        eParam.mimetype = "text/html";
+        eParam.isHTML = true;
+      }
+    }
+  },
+
+  /**
+   * 開始パートから参照を辿れるパートのみデコードして変換する
+   * HTML の属性と CSS の url(), @import の参照を UnMHTCache.findPart で
+   * 解決する時に記録して、次に処理するパートとする
+   * 辿れなかったパートはボディを空にして isPruned を設定する
+   *
+   * @param   {UnMHTExtractFileInfo} eFileInfo
+   *          展開情報
+   */
+  _modifyReachedContents: function(eFileInfo) {
+    let reached = new Set();
+    let queue = [eFileInfo.startPart];
+
+    eFileInfo.reachedParts = [];
+    while (queue.length) {
+      let parts = [];
+      for (let part of queue) {
+        if (part && !reached.has(part)) {
+          reached.add(part);
+          parts.push(part);
+        }
+      }
+
+      /* 同じ深さのパートはまとめてデコードする */
+      let pendings = parts.filter(part => part.isBodyPending);
+      arMIMEDecoder.decodeBodies(pendings);
+      for (let part of pendings) {
+        part.eParam.content = part.body;
+        this._sniffOctetStream(part, part.eParam);
+      }
+
+      for (let part of parts) {
+        UnMHTContentModifier.modifyContents(eFileInfo, part);
+
+        if (part.eParam.isMixed) {
+          /* multipart/mixed は各パートの開始パートを連結する */
+          for (let p of part.parts) {
+            eFileInfo.reachedParts.push(p.eParam.startPart);
+          }
+        }
+      }
+
+      queue = eFileInfo.reachedParts;
+      eFileInfo.reachedParts = [];
+    }
+    eFileInfo.reachedParts = null;
+
+    for (let part of eFileInfo.parts) {
+      if (!reached.has(part)) {
+        part.eParam.isPruned = true;
+        part.eParam.content = "";
+      }
+    }
+  },
+  /* ==== ql_unmht mod: prune: END ==== */
+
   /**
    * パスの情報を取得する
    *
@@ -5452,7 +6047,9 @@ let UnMHTExtractor = Object.freeze({
         }
 
         if (part.eParam.charset) {
-          return toUTF8(arUconv.toUnicode(content, part.eParam.charset));
+          /* ==== ql_unmht mod: use native function: BEGIN ==== */
+          return arUconv.toUTF8(content, part.eParam.charset);
+          /* ==== ql_unmht mod: use native function: END ==== */
         }
 
         return content;
@@ -5546,6 +6143,12 @@ let UnMHTExtractor = Object.freeze({
         continue;
       }
 
+      /* ==== ql_unmht mod: prune: BEGIN ==== */
+      if (part.eParam.isPruned) {
+        continue;
+      }
+      /* ==== ql_unmht mod: prune: END ==== */
+
       let charsets = new Set();
       let doctype = { value: "" };
       let htmlAttrs = new Map();
@@ -5586,6 +6189,10 @@ let UnMHTExtractor = Object.freeze({
       if (charsets.size == 1) {
         part.eParam.charset = [...charsets.keys()][0];
 
+        /* ==== ql_unmht mod: native decode: BEGIN ==== */
+        /* 各パートは UTF-8 にしてあるので、UTF-8 ならば変換しない */
+        if (part.eParam.charset.toLowerCase() != "utf-8")
+        /* ==== ql_unmht mod: native decode: END ==== */
         part.eParam.content
           = arUconv.fromUnicodeWithEntity(part.eParam.content,
                                           part.eParam.charset);
@@ -5618,6 +6225,25 @@ let UnMHTExtractor = Object.freeze({
   _doctypeRe: /<!([\?A-Za-z0-9_:\-]+)(?:\s(?:\"(?:\\\"|[^\"])*\"|\'(?:\\\'|[^\'])*\'|[^\"\'\\>])*)?>/ig
 });
 
+/* ==== ql_unmht mod: profiler: BEGIN ==== */
+arProfiler.name([
+  ["arArrayUtils", arArrayUtils],
+  ["arUconv", arUconv],
+  ["arDOMUtils", arDOMUtils],
+  ["arMIMEDecoder", arMIMEDecoder],
+  ["arMIMEParams", arMIMEParams.prototype],
+  ["arMIMEParser", arMIMEParser.prototype],
+  ["arMIMEPart", arMIMEPart.prototype],
+  ["arPathInfo", arPathInfo.prototype],
+  ["arPathUtils", arPathUtils],
+  ["arPseudoID", arPseudoID],
+  ["UnMHTCache", UnMHTCache],
+  ["UnMHTContentModifier", UnMHTContentModifier],
+  ["UnMHTExtractFileInfo", UnMHTExtractFileInfo.prototype],
+  ["UnMHTExtractor", UnMHTExtractor]
+]);
+/* ==== ql_unmht mod: profiler: END ==== */
+
 return UnMHTExtractor;
 
 })();
@@ -5627,16 +6253,70 @@ return UnMHTExtractor;
 /* global cidMod */
 /* global text */
 
-let eFileInfo = null;
-try {
-  eFileInfo = UnMHTExtractor.extractMHT(cidMode ? "cid:" : "http://ql_unmht/", text, true);
+/* ==== ql_unmht mod: reusable runtime: BEGIN ==== */
+/**
+ * mht ファイルを展開する
+ * 実行環境を使い回す場合は、2 回目以降はスクリプト全体を評価せずに
+ * この関数のみを呼び出す
+ *
+ * @param   {string} text
+ *          mht ファイルの内容
+ * @param   {boolean} cidMode
+ *          参照に cid を使用するか
+ * @param   {boolean} pruneMode
+ *          開始パートから参照を辿れるパートのみ展開するか
+ * @param   {boolean} htmlMode
+ *          入力がヘッダの無い HTML と判明しているか
+ * @param   {boolean} spliceMode
+ *          参照の起点となる URI を展開ごとにランダムな文字列にして
+ *          isSpliced を設定するか
+ *          呼び出し元がその位置を記録して cid: かダミーの URL に置き換える
+ *          パスは spliceMode に関わらず cidMode の形式を基準に解決する
+ * @returns {?UnMHTExtractFileInfo}
+ *          展開情報
+ *          失敗したら null
+ */
+function extractMain(text, cidMode, pruneMode=false, htmlMode=false,
+                     spliceMode=false) {
+  let eFileInfo = null;
+  arProfiler.start();
+  try {
+    /* ==== ql_unmht mod: reference splice: BEGIN ==== */
+    if (spliceMode) {
+      /* デコード後の内容にも含まれないように推測できない文字列にする */
+      let baseURI;
+      do {
+        let nonce = "";
+        for (let i = 0; i < 2; i ++) {
+          nonce += ("0000000" + Math.floor(Math.random() * 0xffffffff)
+                    .toString(16)).slice(-8);
+        }
+        baseURI = "x-ql-unmht-reference-" + nonce + ":";
+      } while (text.contains(baseURI));
+      let originalURISpec = cidMode ? "cid:" : "http://ql_unmht/";
+      eFileInfo = UnMHTExtractor.extractMHT(originalURISpec, text,
+                                            pruneMode, htmlMode, baseURI);
+      eFileInfo.isSpliced = true;
+    } else {
+    /* ==== ql_unmht mod: reference splice: END ==== */
+    eFileInfo = UnMHTExtractor.extractMHT(cidMode ? "cid:" : "http://ql_unmht/", text, pruneMode, htmlMode);
+    /* ==== ql_unmht mod: reference splice: BEGIN ==== */
+    }
+    /* ==== ql_unmht mod: reference splice: END ==== */
 
-  for (let p of eFileInfo.parts) {
-    if (p.eParam && p == eFileInfo.startPart) {
-      p.eParam.isStartPart = true;
+    for (let p of eFileInfo.parts) {
+      if (p.eParam && p == eFileInfo.startPart) {
+        p.eParam.isStartPart = true;
+      }
     }
+  } catch (e) {
   }
-} catch (e) {
+  arProfiler.stop();
+
+  return eFileInfo;
 }
 
-eFileInfo;
+extractMain(text, cidMode, typeof pruneMode != "undefined" && pruneMode,
+            typeof htmlMode != "undefined" && htmlMode,
+            typeof spliceMode != "undefined" && spliceMode);
+/* ==== ql_unmht mod: reusable runtime: END ==== */
@@ -0,0 +1,259 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "SourceText.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "decode.h"
+#include "hash.h"
+
+/**
+ * application/octet-stream の内容を調べる長さ
+ * ql_unmht.js の _createExtractParam と同じ
+ */
+#define SNIFF_SIZE 32
+
+SourceText::SourceText()
+  : data(NULL), size(0), copied(false), reducedSize(0), scan(NULL) {
+}
+
+SourceText::~SourceText() {
+  if (scan) {
+    delete_sfileinfo(scan);
+  }
+}
+
+bool
+SourceText::isNativeCandidate(const scanpart *part, size_t nativeSize) const {
+  /* トップレベルのパートはヘッダの前に From 行等がある場合がある */
+  if (part->parent < 0 || part->isMultipart || part->bodySize < nativeSize) {
+    return false;
+  }
+
+  /* HTML や CSS は参照の書き換えが必要で、テキストは multipart/mixed の
+   * 文書に埋め込むので JavaScript 側で処理する */
+  const char *mimetype = part->mimetype;
+  if (mimetype[0] == '\0' ||
+      strncmp(mimetype, "text/", 5) == 0 ||
+      strncmp(mimetype, "message/", 8) == 0 ||
+      strcmp(mimetype, "application/xhtml+xml") == 0) {
+    return false;
+  }
+
+  if (strcmp(mimetype, "application/octet-stream") == 0) {
+    /* HTML が application/octet-stream として保存されている場合がある
+     * 先頭をデコードして < を含んでいれば JavaScript 側で判定する */
+    decodejob job;
+    job.source = data + part->bodyOffset;
+    job.sourceSize = std::min(part->bodySize, static_cast<size_t>(SNIFF_SIZE * 4));
+    job.encoding = parseTransferEncoding(part->transferEncoding);
+    job.charset = NULL;
+    job.spillSize = 0;
+
+    decodedpart result;
+    if (!decodePart(&job, &result)) {
+      return false;
+    }
+    bool maybeHTML = memchr(result.content, '<',
+                            std::min(result.contentSize,
+                                     static_cast<size_t>(SNIFF_SIZE))) != NULL;
+    free(result.content);
+    if (maybeHTML) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void
+SourceText::append(uint64_t begin, uint64_t end) {
+  if (begin >= end) {
+    return;
+  }
+
+  Segment segment;
+  segment.textOffset = reducedSize;
+  segment.sourceOffset = begin;
+  segment.size = end - begin;
+  segment.inserted = false;
+  segment.insertedOffset = 0;
+  segments.push_back(segment);
+
+  reducedSize += segment.size;
+}
+
+bool
+SourceText::build(const char *data, size_t size, size_t nativeSize) {
+  this->data = data;
+  this->size = size;
+
+  if (nativeSize > 0) {
+    scan = scan_parts(data, size);
+  }
+  if (scan) {
+    for (size_t i = 0; i < scan->partsCount; i ++) {
+      if (isNativeCandidate(&scan->parts[i], nativeSize)) {
+        nativeParts.push_back(i);
+      }
+    }
+  }
+
+  if (nativeParts.empty()) {
+    /* 長さを指定して渡すので複写しない */
+    copied = false;
+    return true;
+  }
+
+  /* ファイル中に同じフィールドがあっても取り違えないように
+   * 展開毎に異なる値を付ける */
+  struct {
+    const void *self;
+    const void *data;
+    time_t now;
+    clock_t clock;
+    pid_t pid;
+  } seed;
+  memset(&seed, 0, sizeof(seed));
+  seed.self = this;
+  seed.data = data;
+  seed.now = time(NULL);
+  seed.clock = clock();
+  seed.pid = getpid();
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%016llx",
+           static_cast<unsigned long long>
+           (hashBytes(reinterpret_cast<const char *>(&seed), sizeof(seed),
+                      size)));
+  nonce = buf;
+
+  copied = true;
+  uint64_t pos = 0;
+  for (size_t i = 0; i < nativeParts.size(); i ++) {
+    const scanpart *part = &scan->parts[nativeParts[i]];
+
+    append(pos, part->headerOffset);
+
+    const char *eol = "\n";
+    if (part->bodyOffset >= 2 && data[part->bodyOffset - 2] == '\r') {
+      eol = "\r\n";
+    }
+    snprintf(buf, sizeof(buf), "X-UnMHT-Native: %s.%lu%s",
+             nonce.c_str(), static_cast<unsigned long>(i), eol);
+
+    Segment segment;
+    segment.textOffset = reducedSize;
+    segment.sourceOffset = part->headerOffset;
+    segment.size = strlen(buf);
+    segment.inserted = true;
+    segment.insertedOffset = insertedText.size();
+    segments.push_back(segment);
+    insertedText += buf;
+    reducedSize += segment.size;
+
+    append(part->headerOffset, part->bodyOffset);
+
+    pos = part->bodyOffset + part->bodySize;
+  }
+  append(pos, size);
+
+  return true;
+}
+
+const char *
+SourceText::chunk(size_t index, size_t *chunkSize) const {
+  if (!copied) {
+    *chunkSize = size;
+    return data;
+  }
+
+  const Segment &segment = segments[index];
+  *chunkSize = segment.size;
+  if (segment.inserted) {
+    return insertedText.data() + segment.insertedOffset;
+  }
+  return data + segment.sourceOffset;
+}
+
+int64_t
+SourceText::toSourceOffset(int64_t offset) const {
+  if (offset < 0) {
+    return -1;
+  }
+  if (copied && !segments.empty() &&
+      static_cast<size_t>(offset) >= reducedSize) {
+    return size;
+  }
+
+  auto it = std::upper_bound(segments.begin(), segments.end(),
+                             static_cast<size_t>(offset),
+                             [](size_t o, const Segment &s) {
+                               return o < s.textOffset;
+                             });
+  if (it == segments.begin()) {
+    return offset;
+  }
+  -- it;
+
+  if (it->inserted) {
+    return it->sourceOffset;
+  }
+  return it->sourceOffset + (offset - it->textOffset);
+}
+
+const scanpart *
+SourceText::nativePart(const char *id) const {
+  if (nonce.empty() ||
+      strncmp(id, nonce.c_str(), nonce.size()) != 0 ||
+      id[nonce.size()] != '.') {
+    return NULL;
+  }
+
+  const char *digits = id + nonce.size() + 1;
+  char *end;
+  unsigned long index = strtoul(digits, &end, 10);
+  if (end == digits || *end != '\0' || index >= nativeParts.size()) {
+    return NULL;
+  }
+
+  return &scan->parts[nativeParts[index]];
+}
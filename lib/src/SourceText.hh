@@ -0,0 +1,195 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __SourceText_hh_included__
+#define __SourceText_hh_included__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "scan.h"
+
+/**
+ * ql_unmht.js に渡す MHT ファイルの文字列
+ *
+ * 閾値以上の長さのボディは文字列から取り除き、代わりにパートのヘッダに
+ * X-UnMHT-Native フィールドを追加する
+ * 取り除いたボディは元のファイルから直接デコードするので、
+ * JavaScript の文字列の長さの制限を超えるファイルも展開できる
+ */
+class SourceText {
+ public:
+  SourceText();
+  ~SourceText();
+
+  /**
+   * 文字列を作成する
+   *
+   * @param   data
+   *          MHT ファイルの内容
+   *          このオブジェクトより長く有効でなければならない
+   * @param   size
+   *          MHT ファイルの長さ
+   * @param   nativeSize
+   *          取り除くボディの長さの閾値
+   *          0 ならば取り除かない
+   * @returns 成功したか
+   */
+  bool
+  build(const char *data, size_t size, size_t nativeSize);
+
+  /**
+   * ql_unmht.js に渡す文字列の区切りの数を返す
+   * 文字列は複写せずに、元のファイルの範囲と追加したフィールドを
+   * 順に並べた区切りとして持つ
+   *
+   * @returns 区切りの数
+   */
+  size_t
+  chunkCount() const {
+    return copied ? segments.size() : 1;
+  }
+
+  /**
+   * ql_unmht.js に渡す文字列の区切りを返す
+   * 取り除くボディが無ければ MHT ファイルの内容そのもの 1 つ
+   *
+   * @param   index
+   *          区切りのインデックス
+   * @param   chunkSize
+   *          (出力) 区切りの長さ
+   * @returns 区切りの先頭
+   *          NUL で終端しているとは限らない
+   */
+  const char *
+  chunk(size_t index, size_t *chunkSize) const;
+
+  /**
+   * ql_unmht.js に渡す文字列の長さを返す
+   *
+   * @returns 文字列の長さ
+   */
+  size_t
+  textSize() const {
+    return copied ? reducedSize : size;
+  }
+
+  /**
+   * 取り除いたボディの数を返す
+   *
+   * @returns 取り除いたボディの数
+   */
+  size_t
+  nativeCount() const {
+    return nativeParts.size();
+  }
+
+  /**
+   * ql_unmht.js に渡す文字列が MHT ファイルの内容そのものか
+   *
+   * @returns MHT ファイルの内容そのものか
+   */
+  bool
+  isSourceText() const {
+    return !copied;
+  }
+
+  /**
+   * 文字列中の位置を元のファイル中の位置に変換する
+   *
+   * @param   offset
+   *          文字列中の位置
+   * @returns 元のファイル中の位置
+   *          offset が負ならば -1
+   */
+  int64_t
+  toSourceOffset(int64_t offset) const;
+
+  /**
+   * X-UnMHT-Native フィールドの値から取り除いたパートを取得する
+   *
+   * @param   id
+   *          X-UnMHT-Native フィールドの値
+   * @returns スキャンしたパート
+   *          該当するパートが無ければ NULL
+   */
+  const scanpart *
+  nativePart(const char *id) const;
+
+  /**
+   * MHT ファイルの内容を返す
+   *
+   * @returns MHT ファイルの内容
+   */
+  const char *
+  source() const {
+    return data;
+  }
+
+ private:
+  /**
+   * 文字列の一部と元のファイルの対応
+   */
+  struct Segment {
+    size_t textOffset;     /* 文字列中の位置 */
+    uint64_t sourceOffset; /* 元のファイル中の位置 */
+    size_t size;           /* 長さ */
+    bool inserted;         /* 追加したフィールドか
+                            * そうならば内容は insertedText の
+                            * insertedOffset の位置にある */
+    size_t insertedOffset;
+  };
+
+  bool
+  isNativeCandidate(const scanpart *part, size_t nativeSize) const;
+
+  void
+  append(uint64_t begin, uint64_t end);
+
+  const char *data;
+  size_t size;
+  bool copied;
+  size_t reducedSize;
+  std::string insertedText;
+  std::string nonce;
+  std::vector<Segment> segments;
+  std::vector<size_t> nativeParts;
+  sfileinfo *scan;
+};
+
+#endif /* __SourceText_hh_included__ */
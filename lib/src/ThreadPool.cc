@@ -0,0 +1,212 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "ThreadPool.hh"
+
+/**
+ * 共有のプールのスレッド数
+ * 0 ならば CPU の数
+ */
+static uint32_t sharedThreadCount = 0;
+
+/**
+ * 共有のプール
+ */
+static std::shared_ptr<ThreadPool> sharedPool;
+
+/**
+ * sharedThreadCount と sharedPool を保護する
+ */
+static std::mutex sharedMutex;
+
+ThreadPool::ThreadPool(size_t threadCount)
+  : pending(0), nextQueue(0), stopping(false) {
+  for (size_t i = 0; i < threadCount; i ++) {
+    queues.push_back(std::unique_ptr<Queue>(new Queue()));
+  }
+  for (size_t i = 0; i < threadCount; i ++) {
+    threads.push_back(std::thread(&ThreadPool::workerMain, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  sleepCond.notify_all();
+
+  for (size_t i = 0; i < threads.size(); i ++) {
+    threads[i].join();
+  }
+}
+
+void
+ThreadPool::push(Task task) {
+  size_t index = nextQueue.fetch_add(1) % queues.size();
+  {
+    std::lock_guard<std::mutex> lock(queues[index]->mutex);
+    queues[index]->tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    pending ++;
+  }
+  sleepCond.notify_one();
+}
+
+bool
+ThreadPool::popOrSteal(size_t self, Task *task) {
+  size_t count = queues.size();
+
+  /* 自分のキューは末尾から */
+  if (self < count) {
+    Queue *q = queues[self].get();
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (!q->tasks.empty()) {
+      *task = std::move(q->tasks.back());
+      q->tasks.pop_back();
+      pending --;
+      return true;
+    }
+  }
+
+  /* 他のキューは先頭から */
+  for (size_t i = 1; i <= count; i ++) {
+    size_t index = (self + i) % count;
+    if (index == self) {
+      continue;
+    }
+    Queue *q = queues[index].get();
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (!q->tasks.empty()) {
+      *task = std::move(q->tasks.front());
+      q->tasks.pop_front();
+      pending --;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+ThreadPool::workerMain(size_t index) {
+  for (;;) {
+    Task task;
+    if (popOrSteal(index, &task)) {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleepCond.wait(lock, [this] { return stopping || pending > 0; });
+    if (stopping && pending == 0) {
+      return;
+    }
+  }
+}
+
+void
+ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &f) {
+  if (count == 0) {
+    return;
+  }
+  if (count == 1 || threads.empty()) {
+    for (size_t i = 0; i < count; i ++) {
+      f(i);
+    }
+    return;
+  }
+
+  struct Batch {
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable cond;
+  };
+  std::shared_ptr<Batch> batch(new Batch());
+  batch->remaining = count;
+
+  for (size_t i = 0; i < count; i ++) {
+    push([batch, &f, i] {
+      f(i);
+      /* 待つ側が条件を調べてから眠るまでの間に通知しないように
+       * 減らすのも mutex の中で行う */
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      if (-- batch->remaining == 0) {
+        batch->cond.notify_all();
+      }
+    });
+  }
+
+  /* 待つ間は呼び出し元もタスクを処理する
+   * キューが空ならば残りは全て他のスレッドが実行中なので、
+   * 最後のタスクが終わるまで眠る */
+  while (batch->remaining > 0) {
+    Task task;
+    if (popOrSteal(queues.size(), &task)) {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->cond.wait(lock, [&batch] { return batch->remaining == 0; });
+  }
+}
+
+std::shared_ptr<ThreadPool>
+ThreadPool::shared() {
+  std::lock_guard<std::mutex> lock(sharedMutex);
+
+  size_t count = sharedThreadCount;
+  if (count == 0) {
+    count = std::thread::hardware_concurrency();
+  }
+  if (count <= 1) {
+    return std::shared_ptr<ThreadPool>();
+  }
+
+  if (!sharedPool || sharedPool->size() != count) {
+    sharedPool = std::make_shared<ThreadPool>(count);
+  }
+
+  return sharedPool;
+}
+
+void
+ThreadPool::setSharedThreadCount(uint32_t count) {
+  std::lock_guard<std::mutex> lock(sharedMutex);
+  sharedThreadCount = count;
+}
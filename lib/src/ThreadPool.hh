@@ -0,0 +1,136 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __ThreadPool_hh_included__
+#define __ThreadPool_hh_included__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * ワークスティーリングを行うスレッドプール
+ *
+ * 各ワーカーは自身のキューの末尾から取り出し、
+ * 空ならば他のワーカーのキューの先頭から盗む
+ * parallelFor の呼び出し元も完了を待つ間にタスクを処理するので
+ * ワーカー内から parallelFor を呼び出してもデッドロックしない
+ */
+class ThreadPool {
+ public:
+  /**
+   * @param   threadCount
+   *          ワーカーの数
+   */
+  explicit ThreadPool(size_t threadCount);
+  ~ThreadPool();
+
+  /**
+   * ワーカーの数を返す
+   *
+   * @returns ワーカーの数
+   */
+  size_t
+  size() const {
+    return threads.size();
+  }
+
+  /**
+   * 0 から count - 1 までの各インデックスについて f を実行し、
+   * 全て完了するまで待つ
+   *
+   * @param   count
+   *          インデックスの数
+   * @param   f
+   *          実行する関数
+   */
+  void
+  parallelFor(size_t count, const std::function<void(size_t)> &f);
+
+  /**
+   * 共有のプールを返す
+   * スレッド数が 1 以下の場合は NULL を返す
+   *
+   * @returns 共有のプール
+   */
+  static std::shared_ptr<ThreadPool>
+  shared();
+
+  /**
+   * 共有のプールのスレッド数を設定する
+   *
+   * @param   count
+   *          スレッド数
+   *          0 ならば CPU の数
+   */
+  static void
+  setSharedThreadCount(uint32_t count);
+
+ private:
+  typedef std::function<void()> Task;
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void
+  push(Task task);
+
+  bool
+  popOrSteal(size_t self, Task *task);
+
+  void
+  workerMain(size_t index);
+
+  std::vector<std::unique_ptr<Queue> > queues;
+  std::vector<std::thread> threads;
+
+  std::atomic<size_t> pending;
+  std::atomic<size_t> nextQueue;
+  std::mutex sleepMutex;
+  std::condition_variable sleepCond;
+  bool stopping;
+};
+
+#endif /* __ThreadPool_hh_included__ */
@@ -36,6 +36,7 @@
 #define __conv_h_included__
 
 #include <stdint.h>
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -57,9 +58,9 @@ extern "C" {
  * @returns 成功したか
  */
 int32_t
-convertToUnicode(const char *text, uint32_t length,
+convertToUnicode(const char *text, size_t length,
                  const char *charset,
-                 unsigned short**result, uint32_t *resultLength);
+                 unsigned short**result, size_t *resultLength);
 
 /**
  * UTF16 の文字列を指定したエンコーディングに変換する
@@ -77,9 +78,31 @@ convertToUnicode(const char *text, uint32_t length,
  * @returns 成功したか
  */
 int32_t
-convertFromUnicode(const unsigned short *text, uint32_t length,
+convertFromUnicode(const unsigned short *text, size_t length,
                    const char *charset,
-                   char**result, uint32_t *resultLength);
+                   char**result, size_t *resultLength);
+
+/**
+ * 指定したエンコーディングの文字列を UTF-8 に変換する
+ * UTF16 を経由せずに 1 回で変換する
+ * ASCII 互換のエンコーディングで ASCII のみの場合は複製するだけ
+ *
+ * @param   text
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @param   charset
+ *          対象の文字列のエンコーディング
+ * @param   result
+ *          (出力) 変換した文字列
+ * @param   resultLength
+ *          (出力) 変換した文字列の長さ
+ * @returns 成功したか
+ */
+int32_t
+convertToUTF8(const char *text, size_t length,
+              const char *charset,
+              char**result, size_t *resultLength);
 
 #ifdef __cplusplus
 }
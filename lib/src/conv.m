@@ -35,11 +35,22 @@
 #include "conv.h"
 
 #import <Foundation/Foundation.h>
+#include <string.h>
+#include <strings.h>
 
-int32_t
-convertToUnicode(const char *text, uint32_t textLength,
-                 const char *charset,
-                 unsigned short**result, uint32_t *resultLength) {
+#include "utf8.h"
+
+/**
+ * charset 名からエンコーディングを取得する
+ *
+ * @param   charset
+ *          charset 名
+ * @param   encoding
+ *          (出力) エンコーディング
+ * @returns 成功したか
+ */
+static int32_t
+getEncoding(const char *charset, NSStringEncoding *encoding) {
   NSString *charsetString
     = [[NSString alloc] initWithCString: charset
                                encoding: NSASCIIStringEncoding];
@@ -47,10 +58,31 @@ convertToUnicode(const char *text, uint32_t textLength,
     return FALSE;
   }
 
-  NSStringEncoding encoding
-    = CFStringConvertEncodingToNSStringEncoding
-    (CFStringConvertIANACharSetNameToEncoding((CFStringRef)charsetString));
+  CFStringEncoding cfEncoding
+    = CFStringConvertIANACharSetNameToEncoding((CFStringRef)charsetString);
   [charsetString release];
+  if (cfEncoding == kCFStringEncodingInvalidId) {
+    return FALSE;
+  }
+
+  *encoding = CFStringConvertEncodingToNSStringEncoding(cfEncoding);
+
+  return TRUE;
+}
+
+int32_t
+convertToUnicode(const char *text, size_t textLength,
+                 const char *charset,
+                 unsigned short**result, size_t *resultLength) {
+  if (checkText(text, textLength, charset) != TEXT_KIND_OTHER) {
+    /* UTF-8 として読めるので Foundation を経由しない */
+    return decodeUTF8(text, textLength, result, resultLength);
+  }
+
+  NSStringEncoding encoding;
+  if (!getEncoding(charset, &encoding)) {
+    return FALSE;
+  }
 
   NSString *textString
     = [[NSString alloc] initWithBytes: text
@@ -60,7 +92,7 @@ convertToUnicode(const char *text, uint32_t textLength,
     return FALSE;
   }
 
-  uint32_t tmpLength
+  NSUInteger tmpLength
     = [textString
         lengthOfBytesUsingEncoding: NSUTF16LittleEndianStringEncoding];
 
@@ -77,20 +109,25 @@ convertToUnicode(const char *text, uint32_t textLength,
 }
 
 int32_t
-convertFromUnicode(const unsigned short *text, uint32_t textLength,
+convertFromUnicode(const unsigned short *text, size_t textLength,
                    const char *charset,
-                   char**result, uint32_t *resultLength) {
-  NSString *charsetString
-    = [[NSString alloc] initWithCString: charset
-                               encoding: NSASCIIStringEncoding];
-  if (charsetString == nil) {
-    return FALSE;
+                   char**result, size_t *resultLength) {
+  if (isASCIICompatibleCharset(charset) && isASCIIUTF16(text, textLength)) {
+    /* ASCII のみなので上位バイトを落とすだけ */
+    *result = (char *)malloc(sizeof(char) * textLength + 1);
+    for (size_t i = 0; i < textLength; i ++) {
+      (*result)[i] = (char)text[i];
+    }
+    (*result)[textLength] = '\0';
+    *resultLength = textLength;
+
+    return TRUE;
   }
 
-  NSStringEncoding encoding
-    = CFStringConvertEncodingToNSStringEncoding
-    (CFStringConvertIANACharSetNameToEncoding((CFStringRef)charsetString));
-  [charsetString release];
+  NSStringEncoding encoding;
+  if (!getEncoding(charset, &encoding)) {
+    return FALSE;
+  }
 
   NSString *textString
     = [[NSString alloc] initWithBytes: text
@@ -100,7 +137,7 @@ convertFromUnicode(const unsigned short *text, uint32_t textLength,
     return FALSE;
   }
 
-  uint32_t tmpLength
+  NSUInteger tmpLength
     = [textString
         lengthOfBytesUsingEncoding: encoding];
   *result = (char *)malloc(sizeof(char) * tmpLength + 1);
@@ -113,3 +150,50 @@ convertFromUnicode(const unsigned short *text, uint32_t textLength,
 
   return TRUE;
 }
+
+int32_t
+convertToUTF8(const char *text, size_t textLength,
+              const char *charset,
+              char**result, size_t *resultLength) {
+  if (isUTF8Charset(charset) ||
+      checkText(text, textLength, charset) != TEXT_KIND_OTHER) {
+    /* 変換不要 */
+    *result = (char *)malloc(sizeof(char) * textLength + 1);
+    memcpy(*result, text, textLength);
+    (*result)[textLength] = '\0';
+    *resultLength = textLength;
+
+    return TRUE;
+  }
+
+  NSStringEncoding encoding;
+  if (!getEncoding(charset, &encoding)) {
+    return FALSE;
+  }
+
+  NSString *textString
+    = [[NSString alloc] initWithBytes: text
+                               length: textLength
+                             encoding: encoding];
+  if (textString == nil) {
+    return FALSE;
+  }
+
+  NSUInteger maxLength
+    = [textString maximumLengthOfBytesUsingEncoding: NSUTF8StringEncoding];
+  NSUInteger usedLength = 0;
+  *result = (char *)malloc(sizeof(char) * maxLength + 1);
+  [textString getBytes: *result
+             maxLength: maxLength
+            usedLength: &usedLength
+              encoding: NSUTF8StringEncoding
+               options: 0
+                 range: NSMakeRange(0, [textString length])
+        remainingRange: NULL];
+  [textString release];
+
+  (*result)[usedLength] = '\0';
+  *resultLength = usedLength;
+
+  return TRUE;
+}
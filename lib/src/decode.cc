@@ -0,0 +1,746 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "decode.h"
+
+#include <stdlib.h>
+#include <strings.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "conv.h"
+#include "hash.h"
+#include "spill.h"
+#include "ThreadPool.hh"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/**
+ * BASE64 の文字
+ */
+static const char base64Chars[65]
+  = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * BASE64 の逆引きテーブル
+ * 0xff は BASE64 の文字ではない、0xfe はパディング
+ */
+static const uint8_t base64Table[256] = {
+#define X 0xff
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X, 62,  X,  X,  X, 63,
+  52, 53, 54, 55, 56, 57, 58, 59, 60, 61, X,  X,  X,  0xfe, X, X,
+  X,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+  15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, X,  X,  X,  X,  X,
+  X, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X
+#undef X
+};
+
+/**
+ * 3 バイト単位で BASE64 にエンコードする
+ * SSSE3 か NEON があればまとめてエンコードする
+ *
+ * @param   p
+ *          エンコードするバイト列
+ * @param   size
+ *          エンコードするバイト列の長さ
+ * @param   out
+ *          (出力) エンコードした文字列
+ * @returns エンコードしたバイト数 (3 の倍数)
+ */
+static size_t
+encodeBase64Blocks(const uint8_t *p, size_t size, char *out) {
+  size_t i = 0;
+  char *o = out;
+
+#if defined(__SSSE3__)
+  /* 12 バイトを 16 文字に変換する
+   * 16 バイト読むので末尾の 4 バイトは残す */
+  const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                        7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i shiftLUT = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '+' - 62,
+                                         '/' - 63, 'A', 0, 0);
+  for (; i + 16 <= size; i += 12) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    in = _mm_shuffle_epi8(in, shuffle);
+
+    /* 各 32 ビットの 24 ビットを 6 ビットずつ 4 バイトに分ける */
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t1, t3);
+
+    /* 値の範囲毎に文字までの差を足す */
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+    __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(shiftLUT, range), indices);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(o), chars);
+    o += 16;
+  }
+#elif defined(__aarch64__)
+  /* 48 バイトを 64 文字に変換する */
+  uint8x16x4_t table;
+  for (int k = 0; k < 4; k ++) {
+    table.val[k]
+      = vld1q_u8(reinterpret_cast<const uint8_t *>(base64Chars) + k * 16);
+  }
+  const uint8x16_t mask = vdupq_n_u8(0x3f);
+  for (; i + 48 <= size; i += 48) {
+    uint8x16x3_t in = vld3q_u8(p + i);
+    uint8x16x4_t indices;
+    indices.val[0] = vshrq_n_u8(in.val[0], 2);
+    indices.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4),
+                                       vshrq_n_u8(in.val[1], 4)), mask);
+    indices.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2),
+                                       vshrq_n_u8(in.val[2], 6)), mask);
+    indices.val[3] = vandq_u8(in.val[2], mask);
+
+    uint8x16x4_t chars;
+    for (int k = 0; k < 4; k ++) {
+      chars.val[k] = vqtbl4q_u8(table, indices.val[k]);
+    }
+    vst4q_u8(reinterpret_cast<uint8_t *>(o), chars);
+    o += 64;
+  }
+#endif
+
+  for (; i + 3 <= size; i += 3) {
+    uint32_t v = (p[i] << 16) | (p[i + 1] << 8) | p[i + 2];
+    o[0] = base64Chars[v >> 18];
+    o[1] = base64Chars[(v >> 12) & 0x3f];
+    o[2] = base64Chars[(v >> 6) & 0x3f];
+    o[3] = base64Chars[v & 0x3f];
+    o += 4;
+  }
+
+  return i;
+}
+
+/**
+ * 16 進数の文字の値を返す
+ *
+ * @param   c
+ *          文字
+ * @returns 値
+ *          16 進数の文字でなければ -1
+ */
+static inline int
+hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/**
+ * BASE64 を確保済みの領域にデコードする
+ * 改行や不正な文字は無視する
+ *
+ * @param   source
+ *          エンコードされた文字列
+ * @param   sourceSize
+ *          エンコードされた文字列の長さ
+ * @param   out
+ *          (出力) デコードした文字列
+ *          sourceSize / 4 * 3 + 4 バイトの領域が必要
+ *          NUL で終端する
+ * @returns デコードした文字列の長さ
+ */
+static size_t
+decodeBase64To(const char *source, size_t sourceSize, char *out) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(source);
+  const uint8_t *end = p + sourceSize;
+
+  size_t j = 0;
+  uint32_t bits = 0;
+  int n = 0;
+
+  /* 改行を含まない 4 文字単位の高速パス */
+  while (p < end) {
+    if (end - p >= 4) {
+      uint8_t a = base64Table[p[0]];
+      uint8_t b = base64Table[p[1]];
+      uint8_t c = base64Table[p[2]];
+      uint8_t d = base64Table[p[3]];
+      if (n == 0 && (a | b | c | d) < 64) {
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[j ++] = v >> 16;
+        out[j ++] = (v >> 8) & 0xff;
+        out[j ++] = v & 0xff;
+        p += 4;
+        continue;
+      }
+    }
+
+    uint8_t v = base64Table[*p];
+    p ++;
+    if (v == 0xfe) {
+      /* パディング以降は無視 */
+      break;
+    }
+    if (v == 0xff) {
+      /* 改行や不正な文字は無視 */
+      continue;
+    }
+
+    bits = (bits << 6) | v;
+    n ++;
+    if (n == 4) {
+      out[j ++] = bits >> 16;
+      out[j ++] = (bits >> 8) & 0xff;
+      out[j ++] = bits & 0xff;
+      bits = 0;
+      n = 0;
+    }
+  }
+
+  /* 端数 */
+  if (n == 2) {
+    out[j ++] = bits >> 4;
+  } else if (n == 3) {
+    out[j ++] = bits >> 10;
+    out[j ++] = (bits >> 2) & 0xff;
+  }
+  out[j] = '\0';
+
+  return j;
+}
+
+/**
+ * quoted-printable を確保済みの領域にデコードする
+ *
+ * @param   source
+ *          エンコードされた文字列
+ * @param   sourceSize
+ *          エンコードされた文字列の長さ
+ * @param   out
+ *          (出力) デコードした文字列
+ *          sourceSize + 1 バイトの領域が必要
+ *          NUL で終端する
+ * @returns デコードした文字列の長さ
+ */
+static size_t
+decodeQuotedPrintableTo(const char *source, size_t sourceSize, char *out) {
+  size_t i = 0, j = 0;
+  /* 行末の空白は削除するので、出力済みかどうかを保留する */
+  size_t paddingStart = 0;
+  size_t paddingSize = 0;
+
+  while (i < sourceSize) {
+    char c = source[i];
+    i ++;
+
+    if (c == ' ' || c == '\t') {
+      if (paddingSize == 0) {
+        paddingStart = i - 1;
+      }
+      paddingSize ++;
+      continue;
+    }
+
+    if (c == '=') {
+      if (paddingSize) {
+        memcpy(out + j, source + paddingStart, paddingSize);
+        j += paddingSize;
+        paddingSize = 0;
+      }
+
+      if (i + 1 < sourceSize) {
+        int h = hexValue(source[i]);
+        int l = hexValue(source[i + 1]);
+        if (h >= 0 && l >= 0) {
+          out[j ++] = (h << 4) | l;
+          i += 2;
+          continue;
+        }
+      }
+
+      /* soft line break */
+      size_t k = i;
+      while (k < sourceSize && (source[k] == ' ' || source[k] == '\t')) {
+        k ++;
+      }
+      if (k < sourceSize && source[k] == '\r') {
+        i = k + 1;
+        if (i < sourceSize && source[i] == '\n') {
+          i ++;
+        }
+        continue;
+      }
+      if (k < sourceSize && source[k] == '\n') {
+        i = k + 1;
+        continue;
+      }
+
+      out[j ++] = c;
+      continue;
+    }
+
+    if (c == '\r' || c == '\n') {
+      paddingSize = 0;
+      out[j ++] = c;
+      continue;
+    }
+
+    if (paddingSize) {
+      memcpy(out + j, source + paddingStart, paddingSize);
+      j += paddingSize;
+      paddingSize = 0;
+    }
+    out[j ++] = c;
+  }
+  out[j] = '\0';
+
+  return j;
+}
+
+/**
+ * デコードした長さの上限を返す
+ *
+ * @param   job
+ *          デコードするパート
+ * @returns デコードした長さの上限 (NUL を含む)
+ */
+static size_t
+decodedCapacity(const decodejob *job) {
+  return decodedCapacityOf(job->encoding, job->sourceSize);
+}
+
+/**
+ * 確保済みの領域にデコードする
+ *
+ * @param   job
+ *          デコードするパート
+ * @param   out
+ *          (出力) デコードした内容
+ *          decodedCapacity(job) バイトの領域が必要
+ *          NUL で終端する
+ * @returns デコードした長さ
+ */
+static size_t
+decodeTo(const decodejob *job, char *out) {
+  switch (job->encoding) {
+    case TRANSFER_ENCODING_BASE64:
+      return decodeBase64To(job->source, job->sourceSize, out);
+    case TRANSFER_ENCODING_QUOTED_PRINTABLE:
+      return decodeQuotedPrintableTo(job->source, job->sourceSize, out);
+    default:
+      memcpy(out, job->source, job->sourceSize);
+      out[job->sourceSize] = '\0';
+      return job->sourceSize;
+  }
+}
+
+/**
+ * BASE64 の区切りのうち、単独でデコードできる長さを返す
+ *
+ * @param   source
+ *          エンコードされたボディの区切り
+ * @param   sourceSize
+ *          エンコードされたボディの区切りの長さ
+ * @param   padded
+ *          (出力) パディングに達したか
+ * @returns 有効な文字が 4 の倍数になる位置までの長さ
+ *          パディングに達した場合は sourceSize
+ */
+static size_t
+base64ChunkSize(const char *source, size_t sourceSize, bool *padded) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(source);
+  size_t size = 0;
+  int n = 0;
+
+  *padded = false;
+  for (size_t i = 0; i < sourceSize; i ++) {
+    uint8_t v = base64Table[p[i]];
+    if (v == 0xfe) {
+      *padded = true;
+      return sourceSize;
+    }
+    if (v == 0xff) {
+      continue;
+    }
+    n = (n + 1) & 3;
+    if (n == 0) {
+      size = i + 1;
+    }
+  }
+
+  return size;
+}
+
+/**
+ * quoted-printable の区切りのうち、単独でデコードできる長さを返す
+ *
+ * @param   source
+ *          エンコードされたボディの区切り
+ * @param   sourceSize
+ *          エンコードされたボディの区切りの長さ
+ * @returns 最後の改行までの長さ
+ *          改行が無い場合は、末尾の空白と途中で切れたエスケープを除いた長さ
+ */
+static size_t
+quotedPrintableChunkSize(const char *source, size_t sourceSize) {
+  for (size_t i = sourceSize; i > 0; i --) {
+    if (source[i - 1] == '\n') {
+      return i;
+    }
+  }
+
+  /* 行末の空白かどうか、エスケープかどうかは次の区切りで決まる */
+  size_t size = sourceSize;
+  for (;;) {
+    while (size > 0 && (source[size - 1] == ' ' || source[size - 1] == '\t' ||
+                        source[size - 1] == '\r')) {
+      size --;
+    }
+    if (size >= 1 && source[size - 1] == '=') {
+      size -= 1;
+    } else if (size >= 2 && source[size - 2] == '=' &&
+               hexValue(source[size - 1]) >= 0) {
+      size -= 2;
+    } else {
+      return size;
+    }
+  }
+}
+
+extern "C" {
+
+size_t
+decodedCapacityOf(transferencoding encoding, size_t sourceSize) {
+  switch (encoding) {
+    case TRANSFER_ENCODING_BASE64:
+      return sourceSize / 4 * 3 + 4;
+    default:
+      return sourceSize + 1;
+  }
+}
+
+size_t
+decodeChunk(chunkdecoder *decoder, const char *source, size_t sourceSize,
+            int32_t last, char *out, size_t *consumed) {
+  size_t size = sourceSize;
+
+  switch (decoder->encoding) {
+    case TRANSFER_ENCODING_BASE64: {
+      if (decoder->finished) {
+        *consumed = sourceSize;
+        out[0] = '\0';
+        return 0;
+      }
+      bool padded;
+      size_t chunkSize = base64ChunkSize(source, sourceSize, &padded);
+      if (padded) {
+        decoder->finished = true;
+      } else if (!last && chunkSize > 0) {
+        size = chunkSize;
+      }
+      *consumed = size;
+      return decodeBase64To(source, size, out);
+    }
+    case TRANSFER_ENCODING_QUOTED_PRINTABLE: {
+      size_t chunkSize = quotedPrintableChunkSize(source, sourceSize);
+      if (!last && chunkSize > 0) {
+        size = chunkSize;
+      }
+      *consumed = size;
+      return decodeQuotedPrintableTo(source, size, out);
+    }
+    default:
+      memcpy(out, source, sourceSize);
+      out[sourceSize] = '\0';
+      *consumed = sourceSize;
+      return sourceSize;
+  }
+}
+
+transferencoding
+parseTransferEncoding(const char *name) {
+  if (name == NULL) {
+    return TRANSFER_ENCODING_NONE;
+  }
+  while (*name == ' ' || *name == '\t') {
+    name ++;
+  }
+  if (strncasecmp(name, "base64", 6) == 0) {
+    return TRANSFER_ENCODING_BASE64;
+  }
+  if (strncasecmp(name, "quoted-printable", 16) == 0) {
+    return TRANSFER_ENCODING_QUOTED_PRINTABLE;
+  }
+  return TRANSFER_ENCODING_NONE;
+}
+
+
+int32_t
+decodeBase64(const char *source, size_t sourceSize,
+             char **result, size_t *resultSize) {
+  char *out = reinterpret_cast<char *>(malloc(sourceSize / 4 * 3 + 4));
+  if (out == NULL) {
+    return false;
+  }
+
+  *result = out;
+  *resultSize = decodeBase64To(source, sourceSize, out);
+  return true;
+}
+
+size_t
+encodeBase64(const char *source, size_t sourceSize, char *result) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(source);
+  size_t i = encodeBase64Blocks(p, sourceSize, result);
+  char *o = result + i / 3 * 4;
+
+  /* 端数 */
+  if (sourceSize - i == 1) {
+    o[0] = base64Chars[p[i] >> 2];
+    o[1] = base64Chars[(p[i] & 0x03) << 4];
+    o[2] = '=';
+    o[3] = '=';
+    o += 4;
+  } else if (sourceSize - i == 2) {
+    o[0] = base64Chars[p[i] >> 2];
+    o[1] = base64Chars[((p[i] & 0x03) << 4) | (p[i + 1] >> 4)];
+    o[2] = base64Chars[(p[i + 1] & 0x0f) << 2];
+    o[3] = '=';
+    o += 4;
+  }
+
+  return o - result;
+}
+
+
+int32_t
+decodeQuotedPrintable(const char *source, size_t sourceSize,
+                      char **result, size_t *resultSize) {
+  char *out = reinterpret_cast<char *>(malloc(sourceSize + 1));
+  if (out == NULL) {
+    return false;
+  }
+
+  *result = out;
+  *resultSize = decodeQuotedPrintableTo(source, sourceSize, out);
+  return true;
+}
+
+int32_t
+decodePart(const decodejob *job, decodedpart *result) {
+  result->content = NULL;
+  result->contentSize = 0;
+  result->succeeded = false;
+  result->spilled = false;
+  result->sameAs = -1;
+
+  size_t capacity = decodedCapacity(job);
+  bool convert = job->charset && job->charset[0];
+
+  if (!convert && job->spillSize > 0 && capacity > job->spillSize) {
+    /* 長いボディは一時ファイルをマップした領域に直接デコードする
+     * 一時ファイルを作れなければメモリ上にデコードする */
+    int fd;
+    char *out = allocateSpill(capacity, &fd);
+    if (out) {
+      size_t size = decodeTo(job, out);
+      shrinkSpill(out, capacity, size + 1, fd);
+
+      result->content = out;
+      result->contentSize = size;
+      result->succeeded = true;
+      result->spilled = true;
+      return true;
+    }
+  }
+
+  char *content = reinterpret_cast<char *>(malloc(capacity));
+  if (content == NULL) {
+    return false;
+  }
+  size_t contentSize = decodeTo(job, content);
+
+  if (convert) {
+    char *utf8;
+    size_t utf8Length;
+    if (!convertToUTF8(content, contentSize, job->charset,
+                       &utf8, &utf8Length)) {
+      free(content);
+      return false;
+    }
+    free(content);
+
+    content = utf8;
+    contentSize = utf8Length;
+  }
+
+  result->content = content;
+  result->contentSize = contentSize;
+  result->succeeded = true;
+  return true;
+}
+
+int32_t
+decodeParts(const decodejob *jobs, size_t count, decodedpart *results) {
+  /* 同じ入力のパートを探す */
+  std::vector<size_t> uniques;
+  std::unordered_multimap<uint64_t, size_t> hashes;
+  for (size_t i = 0; i < count; i ++) {
+    const decodejob *job = &jobs[i];
+    uint64_t h = hashBytes(job->source, job->sourceSize, job->encoding);
+
+    int64_t sameAs = -1;
+    auto range = hashes.equal_range(h);
+    for (auto it = range.first; it != range.second; ++ it) {
+      const decodejob *other = &jobs[it->second];
+      const char *charset = job->charset ? job->charset : "";
+      const char *otherCharset = other->charset ? other->charset : "";
+      if (other->encoding == job->encoding &&
+          other->sourceSize == job->sourceSize &&
+          strcasecmp(otherCharset, charset) == 0 &&
+          memcmp(other->source, job->source, job->sourceSize) == 0) {
+        sameAs = it->second;
+        break;
+      }
+    }
+
+    results[i].content = NULL;
+    results[i].contentSize = 0;
+    results[i].succeeded = false;
+    results[i].spilled = false;
+    results[i].sameAs = sameAs;
+    if (sameAs == -1) {
+      hashes.insert(std::make_pair(h, i));
+      uniques.push_back(i);
+    }
+  }
+
+  /* デコードした結果のハッシュ値もデコードしたスレッドで計算する */
+  std::vector<uint64_t> decodedHashes(count, 0);
+  auto decodeUnique = [jobs, results, &uniques, &decodedHashes](size_t i) {
+    size_t index = uniques[i];
+    if (decodePart(&jobs[index], &results[index])) {
+      decodedHashes[index] = hashBytes(results[index].content,
+                                       results[index].contentSize, 0);
+    }
+  };
+  std::shared_ptr<ThreadPool> pool = ThreadPool::shared();
+  if (pool) {
+    pool->parallelFor(uniques.size(), decodeUnique);
+  } else {
+    for (size_t i = 0; i < uniques.size(); i ++) {
+      decodeUnique(i);
+    }
+  }
+
+  /* エンコードや改行の位置が異なっても、デコードした結果が同じならば
+   * 先行するパートの結果を共有して、後のパートの結果は開放する */
+  hashes.clear();
+  for (size_t i = 0; i < count; i ++) {
+    decodedpart *result = &results[i];
+    if (result->sameAs >= 0) {
+      /* 共有元が後から別のパートを共有した場合はその先を指す */
+      if (results[result->sameAs].sameAs >= 0) {
+        result->sameAs = results[result->sameAs].sameAs;
+      }
+      continue;
+    }
+    if (!result->succeeded) {
+      continue;
+    }
+
+    int64_t sameAs = -1;
+    auto range = hashes.equal_range(decodedHashes[i]);
+    for (auto it = range.first; it != range.second; ++ it) {
+      const decodedpart *other = &results[it->second];
+      if (other->contentSize == result->contentSize &&
+          memcmp(other->content, result->content, result->contentSize) == 0) {
+        sameAs = it->second;
+        break;
+      }
+    }
+    if (sameAs == -1) {
+      hashes.insert(std::make_pair(decodedHashes[i], i));
+      continue;
+    }
+
+    if (result->spilled) {
+      releaseSpill(result->content, result->contentSize + 1);
+    } else {
+      free(result->content);
+    }
+    result->content = NULL;
+    result->spilled = false;
+    result->sameAs = sameAs;
+  }
+
+  for (size_t i = 0; i < count; i ++) {
+    if (results[i].sameAs >= 0) {
+      const decodedpart *original = &results[results[i].sameAs];
+      results[i].contentSize = original->contentSize;
+      results[i].succeeded = original->succeeded;
+    }
+    if (!results[i].succeeded) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,245 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __decode_h_included__
+#define __decode_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Content-Transfer-Encoding の種類
+ */
+typedef enum {
+  TRANSFER_ENCODING_NONE = 0,         /* 7bit, 8bit, binary 等 */
+  TRANSFER_ENCODING_BASE64,           /* base64 */
+  TRANSFER_ENCODING_QUOTED_PRINTABLE  /* quoted-printable */
+} transferencoding;
+
+/**
+ * デコードするパート
+ */
+typedef struct {
+  const char *source;        /* エンコードされたボディ */
+  size_t sourceSize;         /* エンコードされたボディの長さ */
+  transferencoding encoding; /* Content-Transfer-Encoding */
+  const char *charset;       /* UTF-8 に変換する場合の元の charset
+                              * 変換しない場合は NULL */
+  size_t spillSize;          /* デコードした長さがこれを超え得る場合は
+                              * 一時ファイルをマップした領域にデコードする
+                              * 0 ならば常にメモリ上にデコードする
+                              * charset を指定した場合は使用しない */
+} decodejob;
+
+/**
+ * デコードしたパート
+ */
+typedef struct {
+  char *content;      /* デコードしたボディ
+                       * sameAs が 0 以上の場合は NULL */
+  size_t contentSize; /* デコードしたボディの長さ */
+  int32_t succeeded;  /* 成功したか */
+  int32_t spilled;    /* content が一時ファイルをマップした領域か
+                       * そうならば free ではなく
+                       * releaseSpill(content, contentSize + 1) で開放する */
+  int64_t sameAs;     /* 入力かデコードした結果が同じで、
+                       * 代わりに結果を持つ先行するパートのインデックス
+                       * 無ければ -1 */
+} decodedpart;
+
+/**
+ * 区切って読み込んだボディを順にデコードする状態
+ */
+typedef struct {
+  transferencoding encoding; /* Content-Transfer-Encoding */
+  int32_t finished;          /* BASE64 のパディングに達して、
+                              * 以降の入力を無視するか */
+} chunkdecoder;
+
+/**
+ * Content-Transfer-Encoding の名前から種類を取得する
+ *
+ * @param   name
+ *          Content-Transfer-Encoding の値
+ * @returns Content-Transfer-Encoding の種類
+ */
+transferencoding
+parseTransferEncoding(const char *name);
+
+/**
+ * BASE64 をデコードする
+ * 改行や不正な文字は無視する
+ *
+ * @param   source
+ *          エンコードされた文字列
+ * @param   sourceSize
+ *          エンコードされた文字列の長さ
+ * @param   result
+ *          (出力) デコードした文字列
+ * @param   resultSize
+ *          (出力) デコードした文字列の長さ
+ * @returns 成功したか
+ */
+int32_t
+decodeBase64(const char *source, size_t sourceSize,
+             char **result, size_t *resultSize);
+
+/**
+ * BASE64 にエンコードした長さを返す
+ *
+ * @param   sourceSize
+ *          エンコードするバイト列の長さ
+ * @returns エンコードした文字列の長さ (パディングを含む)
+ */
+#define BASE64_ENCODED_SIZE(sourceSize) (((sourceSize) + 2) / 3 * 4)
+
+/**
+ * BASE64 にエンコードする
+ * 改行は入れない
+ * sourceSize が 3 の倍数ならばパディングが付かないので、
+ * 3 の倍数ずつ区切って続けてエンコードできる
+ *
+ * @param   source
+ *          エンコードするバイト列
+ * @param   sourceSize
+ *          エンコードするバイト列の長さ
+ * @param   result
+ *          (出力) エンコードした文字列
+ *          BASE64_ENCODED_SIZE(sourceSize) バイトの領域が必要
+ *          NUL で終端しない
+ * @returns エンコードした文字列の長さ
+ */
+size_t
+encodeBase64(const char *source, size_t sourceSize, char *result);
+
+/**
+ * quoted-printable をデコードする
+ *
+ * @param   source
+ *          エンコードされた文字列
+ * @param   sourceSize
+ *          エンコードされた文字列の長さ
+ * @param   result
+ *          (出力) デコードした文字列
+ * @param   resultSize
+ *          (出力) デコードした文字列の長さ
+ * @returns 成功したか
+ */
+int32_t
+decodeQuotedPrintable(const char *source, size_t sourceSize,
+                      char **result, size_t *resultSize);
+
+/**
+ * デコードした長さの上限を返す
+ *
+ * @param   encoding
+ *          Content-Transfer-Encoding の種類
+ * @param   sourceSize
+ *          エンコードされたボディの長さ
+ * @returns デコードした長さの上限 (NUL を含む)
+ */
+size_t
+decodedCapacityOf(transferencoding encoding, size_t sourceSize);
+
+/**
+ * 区切って読み込んだボディの 1 区切りをデコードする
+ * BASE64 は有効な文字が 4 の倍数になる位置まで、
+ * quoted-printable は最後の改行までをデコードし、
+ * 残りは次の区切りの先頭に連結して渡す
+ * 改行や 4 文字目が見つからない場合は全てデコードする
+ *
+ * @param   decoder
+ *          デコードする状態
+ *          最初の区切りの前に encoding を設定し、finished を false にする
+ * @param   source
+ *          エンコードされたボディの区切り
+ * @param   sourceSize
+ *          エンコードされたボディの区切りの長さ
+ * @param   last
+ *          ボディの最後の区切りか
+ *          そうならば全てデコードする
+ * @param   out
+ *          (出力) デコードした内容
+ *          ボディ全体の decodedCapacityOf の領域の続きを渡す
+ *          NUL で終端する
+ * @param   consumed
+ *          (出力) デコードした source の長さ
+ * @returns デコードした長さ
+ */
+size_t
+decodeChunk(chunkdecoder *decoder, const char *source, size_t sourceSize,
+            int32_t last, char *out, size_t *consumed);
+
+/**
+ * 1 つのパートをデコードする
+ *
+ * @param   job
+ *          デコードするパート
+ * @param   result
+ *          (出力) デコードしたパート
+ * @returns 成功したか
+ */
+int32_t
+decodePart(const decodejob *job, decodedpart *result);
+
+/**
+ * 複数のパートをスレッドプールでデコードする
+ * 結果は jobs と同じ順序で results に格納する
+ * 入力が同じパートは 1 度だけデコードし、残りは sameAs で参照する
+ * エンコードや改行の位置が異なっても、デコードした結果が同じパートは
+ * 後のパートの結果を開放して sameAs で参照する
+ * 失敗したパートは succeeded が false になり、content は NULL になる
+ *
+ * @param   jobs
+ *          デコードするパート
+ * @param   count
+ *          パートの数
+ * @param   results
+ *          (出力) デコードしたパート
+ *          count 個の領域を呼び出し元が確保する
+ * @returns 全て成功したか
+ */
+int32_t
+decodeParts(const decodejob *jobs, size_t count, decodedpart *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __decode_h_included__ */
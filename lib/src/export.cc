@@ -0,0 +1,1014 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "export.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "decode.h"
+#include "gunzip.h"
+#include "partindex.h"
+#include "spill.h"
+#include "ThreadPool.hh"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) &&                         \
+  (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE 1
+#endif
+
+/**
+ * 書き出すファイル名の最大の長さ (拡張子を除く)
+ */
+#define MAX_NAME_LENGTH 100
+
+/**
+ * 1 つの HTML に書き出す際の出力のバッファの長さ
+ */
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/**
+ * 1 度に BASE64 にエンコードするバイト数 (3 の倍数)
+ */
+#define BASE64_CHUNK_SIZE (3 * 1024)
+
+/**
+ * 書き出し元の MHT ファイル
+ */
+struct ExportSource {
+  int fd;           /* ファイル記述子
+                     * 無ければ -1 */
+  const char *map;  /* マップした内容
+                     * 無ければ NULL */
+  size_t size;      /* ファイルの長さ */
+};
+
+/**
+ * 書き出すパート
+ */
+struct ExportPart {
+  const mimepart *part; /* パート */
+  std::string name;     /* ファイル名 */
+};
+
+/**
+ * 内容中の参照
+ */
+struct ReferenceRange {
+  size_t pos;       /* 参照の位置 */
+  size_t nameStart; /* 参照名の位置 */
+  size_t nameEnd;   /* 参照名の末尾 */
+};
+
+/**
+ * 書き出しの状態
+ */
+struct ExportContext {
+  int dirfd;                  /* 書き出すディレクトリ */
+  ExportSource source;        /* 書き出し元の MHT ファイル */
+  std::string baseURI;        /* 参照の起点となる URI */
+  bool rebasable;             /* 展開情報に参照の位置を記録しているか */
+  std::unordered_map<std::string, const std::string *> names;
+                              /* 参照名 (cid) からファイル名 */
+};
+
+/**
+ * 複数の領域を writev でまとめて全て書き込む
+ *
+ * @param   fd
+ *          ファイル記述子
+ * @param   iov
+ *          書き込む領域
+ *          書き込んだ分は書き換える
+ * @returns 成功したか
+ */
+static bool
+writeVectorFully(int fd, std::vector<struct iovec> *iov) {
+  size_t index = 0;
+  while (index < iov->size()) {
+    int count = static_cast<int>(iov->size() - index);
+    if (count > IOV_MAX) {
+      count = IOV_MAX;
+    }
+
+    ssize_t n = writev(fd, iov->data() + index, count);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+
+    /* 書き込めた分を進める */
+    size_t written = n;
+    while (index < iov->size() && written >= (*iov)[index].iov_len) {
+      written -= (*iov)[index].iov_len;
+      index ++;
+    }
+    if (written > 0) {
+      (*iov)[index].iov_base
+        = reinterpret_cast<char *>((*iov)[index].iov_base) + written;
+      (*iov)[index].iov_len -= written;
+    }
+  }
+  return true;
+}
+
+/**
+ * MHT ファイルの範囲をそのまま複写する
+ * 可能ならば copy_file_range でカーネル内で複写する
+ *
+ * @param   source
+ *          書き出し元の MHT ファイル
+ * @param   fd
+ *          書き出し先のファイル記述子
+ * @param   offset
+ *          複写する範囲の位置
+ * @param   size
+ *          複写する範囲の長さ
+ * @returns 成功したか
+ */
+static bool
+copyRange(const ExportSource &source, int fd, uint64_t offset, size_t size) {
+#ifdef HAVE_COPY_FILE_RANGE
+  loff_t off = offset;
+  while (size > 0) {
+    ssize_t n = copy_file_range(source.fd, &off, fd, NULL, size, 0);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      /* 対応していないファイルシステム等は残りを write で書き込む */
+      break;
+    }
+    size -= n;
+  }
+  offset = off;
+  if (size == 0) {
+    return true;
+  }
+#endif
+
+  if (source.map == NULL) {
+    return false;
+  }
+  return writeFully(fd, source.map + offset, size);
+}
+
+/**
+ * MIME-Type から拡張子を取得する
+ *
+ * @param   mimetype
+ *          MIME-Type
+ * @returns 拡張子 (. を含む)
+ *          不明ならば空文字列
+ */
+static const char *
+extensionForType(const char *mimetype) {
+  static const char *types[][2] = {
+    { "text/html", ".html" },
+    { "application/xhtml+xml", ".xhtml" },
+    { "text/css", ".css" },
+    { "text/plain", ".txt" },
+    { "text/javascript", ".js" },
+    { "application/javascript", ".js" },
+    { "application/x-javascript", ".js" },
+    { "image/png", ".png" },
+    { "image/jpeg", ".jpg" },
+    { "image/gif", ".gif" },
+    { "image/svg+xml", ".svg" },
+    { "image/webp", ".webp" },
+    { "image/x-icon", ".ico" },
+    { "image/vnd.microsoft.icon", ".ico" },
+    { "application/pdf", ".pdf" },
+    { "font/woff", ".woff" },
+    { "font/woff2", ".woff2" },
+    { NULL, NULL }
+  };
+  if (mimetype == NULL) {
+    return "";
+  }
+  for (int i = 0; types[i][0]; i ++) {
+    if (strcasecmp(mimetype, types[i][0]) == 0) {
+      return types[i][1];
+    }
+  }
+  return "";
+}
+
+/**
+ * 参照を書き換えるパートか
+ *
+ * @param   part
+ *          パート
+ * @returns HTML か CSS か
+ */
+static bool
+isRewritable(const mimepart *part) {
+  return part->mimetype &&
+    (strcasecmp(part->mimetype, "text/html") == 0 ||
+     strcasecmp(part->mimetype, "application/xhtml+xml") == 0 ||
+     strcasecmp(part->mimetype, "text/css") == 0);
+}
+
+/**
+ * Content-Location から安全なファイル名を作成する
+ * パスの末尾からクエリとフラグメントを除き、英数字と . _ - 以外を _ にする
+ * 先頭の . は取り除く
+ *
+ * @param   part
+ *          パート
+ * @returns ファイル名
+ */
+static std::string
+safeName(const mimepart *part) {
+  std::string location = part->location ? part->location : "";
+  size_t end = location.find_first_of("?#");
+  if (end != std::string::npos) {
+    location.erase(end);
+  }
+  size_t slash = location.find_last_of("/\\");
+  if (slash != std::string::npos) {
+    location.erase(0, slash + 1);
+  }
+
+  std::string name;
+  for (size_t i = 0; i < location.size(); i ++) {
+    char c = location[i];
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-') {
+      name += c;
+    } else {
+      name += '_';
+    }
+  }
+  size_t start = name.find_first_not_of('.');
+  name.erase(0, start == std::string::npos ? name.size() : start);
+
+  if (name.empty()) {
+    name = "part";
+  }
+  if (name.find('.') == std::string::npos) {
+    name += extensionForType(part->mimetype);
+  }
+  return name;
+}
+
+/**
+ * 重複しないファイル名を作成する
+ * 大文字と小文字を区別しないファイルシステムのために小文字で比較する
+ *
+ * @param   name
+ *          元のファイル名
+ * @param   used
+ *          (入出力) 使用済みのファイル名 (小文字)
+ * @returns 重複しないファイル名
+ */
+static std::string
+uniqueName(const std::string &name, std::set<std::string> *used) {
+  size_t dot = name.find_last_of('.');
+  if (dot == 0 || dot == std::string::npos) {
+    dot = name.size();
+  }
+  std::string stem = name.substr(0, dot);
+  std::string ext = name.substr(dot);
+  if (stem.size() > MAX_NAME_LENGTH) {
+    stem.erase(MAX_NAME_LENGTH);
+  }
+  if (ext.size() > 16) {
+    ext.clear();
+  }
+
+  std::string candidate = stem + ext;
+  for (int n = 2; ; n ++) {
+    std::string lower = candidate;
+    for (size_t i = 0; i < lower.size(); i ++) {
+      if (lower[i] >= 'A' && lower[i] <= 'Z') {
+        lower[i] += 'a' - 'A';
+      }
+    }
+    if (used->insert(lower).second) {
+      return candidate;
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "-%d", n);
+    candidate = stem + buf + ext;
+  }
+}
+
+/**
+ * 参照名の末尾を探す
+ * 参照名は引用符や括弧、フラグメントの手前まで
+ *
+ * @param   content
+ *          パートの内容
+ * @param   size
+ *          パートの内容の長さ
+ * @param   nameStart
+ *          参照名の位置
+ * @returns 参照名の末尾
+ */
+static size_t
+referenceNameEnd(const char *content, size_t size, size_t nameStart) {
+  size_t end = nameStart;
+  while (end < size && !strchr("\"'() \t\r\n<>#?\\&", content[end])) {
+    end ++;
+  }
+  return end;
+}
+
+/**
+ * 内容中の次の参照を探す
+ * 参照は baseURI に続く参照名で、
+ * 参照名は引用符や括弧、フラグメントの手前まで
+ *
+ * @param   base
+ *          参照の起点となる URI
+ * @param   content
+ *          パートの内容
+ * @param   size
+ *          パートの内容の長さ
+ * @param   pos
+ *          (入出力) 探し始める位置
+ *          見つかったら参照の位置
+ * @param   nameStart
+ *          (出力) 参照名の位置
+ * @param   nameEnd
+ *          (出力) 参照名の末尾
+ * @returns 見つかったか
+ */
+static bool
+nextReference(const std::string &base, const char *content, size_t size,
+              size_t *pos, size_t *nameStart, size_t *nameEnd) {
+  if (base.empty()) {
+    return false;
+  }
+
+  size_t p = *pos;
+  while (p < size) {
+    const void *found = memchr(content + p, base[0], size - p);
+    if (found == NULL) {
+      break;
+    }
+    p = reinterpret_cast<const char *>(found) - content;
+    if (size - p < base.size() ||
+        memcmp(content + p, base.data(), base.size()) != 0) {
+      p ++;
+      continue;
+    }
+
+    *pos = p;
+    *nameStart = p + base.size();
+    *nameEnd = referenceNameEnd(content, size, *nameStart);
+    return true;
+  }
+
+  *pos = size;
+  return false;
+}
+
+/**
+ * 内容中の参照を全て求める
+ * 展開時に記録した参照の位置があればそれを使い、
+ * 無ければ内容から参照の起点となる URI を探す
+ *
+ * @param   base
+ *          参照の起点となる URI
+ * @param   part
+ *          パート
+ * @param   recorded
+ *          part->references が content 中の位置か
+ * @param   content
+ *          パートの内容
+ * @param   size
+ *          パートの内容の長さ
+ * @param   ranges
+ *          (出力) 参照 (位置の順)
+ */
+static void
+findReferenceRanges(const std::string &base, const mimepart *part,
+                    bool recorded, const char *content, size_t size,
+                    std::vector<ReferenceRange> *ranges) {
+  if (base.empty()) {
+    return;
+  }
+
+  if (recorded) {
+    for (size_t i = 0; i < part->referencesCount; i ++) {
+      size_t pos = part->references[i];
+      /* 記録した位置が内容と食い違っていれば使わない */
+      if (pos > size || size - pos < base.size() ||
+          memcmp(content + pos, base.data(), base.size()) != 0) {
+        continue;
+      }
+      ReferenceRange range;
+      range.pos = pos;
+      range.nameStart = pos + base.size();
+      range.nameEnd = referenceNameEnd(content, size, range.nameStart);
+      ranges->push_back(range);
+    }
+    return;
+  }
+
+  ReferenceRange range;
+  size_t pos = 0;
+  while (nextReference(base, content, size,
+                       &pos, &range.nameStart, &range.nameEnd)) {
+    range.pos = pos;
+    ranges->push_back(range);
+    pos = range.nameStart;
+  }
+}
+
+/**
+ * 参照を書き換えた内容を領域の列として作成する
+ * 内容は複写せずに、書き換えない部分とファイル名を交互に並べる
+ *
+ * @param   context
+ *          書き出しの状態
+ * @param   part
+ *          パート
+ * @param   content
+ *          パートの内容
+ * @param   size
+ *          パートの内容の長さ
+ * @param   iov
+ *          (出力) 書き込む領域
+ */
+static void
+buildRewrite(const ExportContext &context, const mimepart *part,
+             const char *content, size_t size,
+             std::vector<struct iovec> *iov) {
+  std::vector<ReferenceRange> ranges;
+  findReferenceRanges(context.baseURI, part,
+                      context.rebasable && content == part->content,
+                      content, size, &ranges);
+
+  size_t copied = 0;
+  for (size_t i = 0; i < ranges.size(); i ++) {
+    const ReferenceRange &r = ranges[i];
+    if (r.pos < copied) {
+      continue;
+    }
+    auto it = context.names.find(std::string(content + r.nameStart,
+                                             r.nameEnd - r.nameStart));
+    if (it == context.names.end()) {
+      continue;
+    }
+
+    if (r.pos > copied) {
+      struct iovec v = { const_cast<char *>(content + copied),
+                         r.pos - copied };
+      iov->push_back(v);
+    }
+    struct iovec v = { const_cast<char *>(it->second->data()),
+                       it->second->size() };
+    iov->push_back(v);
+    copied = r.nameEnd;
+  }
+
+  if (size > copied) {
+    struct iovec v = { const_cast<char *>(content + copied), size - copied };
+    iov->push_back(v);
+  }
+}
+
+/**
+ * パートを 1 つ書き出す
+ *
+ * @param   context
+ *          書き出しの状態
+ * @param   target
+ *          書き出すパート
+ * @returns 成功したか
+ */
+static bool
+exportPart(const ExportContext &context, const ExportPart &target) {
+  const mimepart *p = target.part;
+  const ExportSource &source = context.source;
+
+  /* デコードが不要なボディは展開済みかに関わらず元のファイルから複写する
+   * テキストは format=flowed 等で変わる場合があるので除く */
+  bool copyable = !isRewritable(p) && source.fd != -1 &&
+    p->bodyOffset >= 0 &&
+    static_cast<uint64_t>(p->bodyOffset) + p->bodySize <= source.size &&
+    (p->content == NULL || p->bodySize == p->contentSize) &&
+    parseTransferEncoding(p->transferEncoding) == TRANSFER_ENCODING_NONE &&
+    (p->mimetype == NULL || strncasecmp(p->mimetype, "text/", 5) != 0);
+
+  const char *content = p->content;
+  size_t contentSize = p->contentSize;
+  char *decoded = NULL;
+  if (content == NULL && !copyable) {
+    /* 展開していないパートはファイルからデコードする */
+    if (!decode_range_fd(source.fd, p->bodyOffset, p->bodySize,
+                         p->transferEncoding, &decoded, &contentSize)) {
+      return false;
+    }
+    content = decoded;
+  }
+
+  /* ディレクトリ中のシンボリックリンクを辿って外に書き出さないように、
+   * 既存のファイルは削除してから新しく作成する */
+  if (unlinkat(context.dirfd, target.name.c_str(), 0) == -1 &&
+      errno != ENOENT) {
+    free(decoded);
+    return false;
+  }
+  int fd = openat(context.dirfd, target.name.c_str(),
+                  O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+  if (fd == -1) {
+    free(decoded);
+    return false;
+  }
+
+  bool result;
+  if (copyable) {
+    result = copyRange(source, fd, p->bodyOffset, p->bodySize);
+  } else if (isRewritable(p)) {
+    std::vector<struct iovec> iov;
+    buildRewrite(context, p, content, contentSize, &iov);
+    result = writeVectorFully(fd, &iov);
+  } else {
+    result = writeFully(fd, content, contentSize);
+  }
+
+  if (close(fd) == -1) {
+    result = false;
+  }
+  free(decoded);
+
+  return result;
+}
+
+/**
+ * 書き出し元の MHT ファイルを開く
+ *
+ * @param   path
+ *          MHT ファイルのパス
+ * @param   source
+ *          (出力) 書き出し元の MHT ファイル
+ * @returns 成功したか
+ */
+static bool
+openSource(const char *path, ExportSource *source) {
+  source->fd = open(path, O_RDONLY);
+  if (source->fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  /* パートの位置は元のファイル中のものなので、圧縮されたファイルからは
+   * 読まない */
+  if (fstat(source->fd, &st) == -1 || isCompressedFile(source->fd)) {
+    close(source->fd);
+    source->fd = -1;
+    return false;
+  }
+  source->size = st.st_size;
+
+  if (source->size > 0) {
+    void *map = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE,
+                     source->fd, 0);
+    if (map != MAP_FAILED) {
+      source->map = reinterpret_cast<const char *>(map);
+    }
+  }
+
+  return true;
+}
+
+/**
+ * 1 つの HTML に書き出す先
+ */
+class OutputSink {
+ public:
+  virtual ~OutputSink() {}
+
+  /**
+   * 続きを書き出す
+   *
+   * @param   data
+   *          書き出す内容
+   * @param   size
+   *          書き出す長さ
+   */
+  virtual void
+  write(const char *data, size_t size) = 0;
+};
+
+/**
+ * ファイル記述子にバッファを経由して書き出す
+ */
+class FileSink : public OutputSink {
+ public:
+  explicit FileSink(int fd) : fd(fd), used(0), failed(false) {
+    buffer.resize(OUTPUT_BUFFER_SIZE);
+  }
+
+  void
+  write(const char *data, size_t size) override {
+    if (used + size > buffer.size()) {
+      flush();
+      if (size >= buffer.size()) {
+        /* 長い内容はバッファを経由しない */
+        if (!failed && !writeFully(fd, data, size)) {
+          failed = true;
+        }
+        return;
+      }
+    }
+    memcpy(buffer.data() + used, data, size);
+    used += size;
+  }
+
+  /**
+   * バッファの内容を書き出す
+   *
+   * @returns 全て書き出せたか
+   */
+  bool
+  flush() {
+    if (used > 0 && !failed && !writeFully(fd, buffer.data(), used)) {
+      failed = true;
+    }
+    used = 0;
+    return !failed;
+  }
+
+ private:
+  int fd;
+  std::vector<char> buffer;
+  size_t used;
+  bool failed;
+};
+
+/**
+ * BASE64 にエンコードしながら書き出す
+ * 3 バイトに満たない端数は次の書き出しか finish まで保留する
+ */
+class Base64Sink : public OutputSink {
+ public:
+  explicit Base64Sink(OutputSink *out) : out(out), pendingSize(0) {
+  }
+
+  void
+  write(const char *data, size_t size) override {
+    char encoded[BASE64_ENCODED_SIZE(BASE64_CHUNK_SIZE)];
+
+    if (pendingSize > 0) {
+      while (pendingSize < 3 && size > 0) {
+        pending[pendingSize ++] = *data ++;
+        size --;
+      }
+      if (pendingSize < 3) {
+        return;
+      }
+      out->write(encoded, encodeBase64(pending, 3, encoded));
+      pendingSize = 0;
+    }
+
+    while (size >= 3) {
+      size_t n = std::min<size_t>(size / 3 * 3, BASE64_CHUNK_SIZE);
+      out->write(encoded, encodeBase64(data, n, encoded));
+      data += n;
+      size -= n;
+    }
+
+    memcpy(pending, data, size);
+    pendingSize = size;
+  }
+
+  /**
+   * 保留した端数をパディングを付けて書き出す
+   */
+  void
+  finish() {
+    char encoded[4];
+    if (pendingSize > 0) {
+      out->write(encoded, encodeBase64(pending, pendingSize, encoded));
+      pendingSize = 0;
+    }
+  }
+
+ private:
+  OutputSink *out;
+  char pending[3];
+  size_t pendingSize;
+};
+
+/**
+ * 1 つの HTML に書き出す状態
+ */
+struct InlineContext {
+  ExportSource source;       /* 書き出し元の MHT ファイル */
+  std::string baseURI;       /* 参照の起点となる URI */
+  bool rebasable;            /* 展開情報に参照の位置を記録しているか */
+  std::unordered_map<std::string, const mimepart *> parts;
+                             /* 参照名 (cid) からパート */
+  std::vector<const mimepart *> stack;
+                             /* 書き出し中のパート (循環参照を除く) */
+  bool failed;               /* 書き出せないパートがあったか */
+};
+
+/**
+ * data URI の MIME-Type の後に付ける charset を書き出す
+ * トークンとして安全な文字のみからなる場合のみ付ける
+ *
+ * @param   part
+ *          パート
+ * @param   sink
+ *          書き出す先
+ */
+static void
+writeCharsetParam(const mimepart *part, OutputSink *sink) {
+  const char *charset = part->charset;
+  if (charset == NULL || charset[0] == '\0') {
+    return;
+  }
+  for (const char *p = charset; *p; p ++) {
+    char c = *p;
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' ||
+          c == ':')) {
+      return;
+    }
+  }
+  sink->write(";charset=", 9);
+  sink->write(charset, strlen(charset));
+}
+
+/**
+ * パートの内容を参照を data URI に置き換えながら書き出す
+ * 参照先の HTML と CSS も同様に置き換えてから BASE64 にエンコードする
+ * 展開していないパートはファイルからデコードし、
+ * デコードできなければ context->failed を設定する
+ * 展開していない HTML と CSS は参照を書き換えていないので、
+ * 参照先を埋め込めないものとして context->failed を設定する
+ *
+ * @param   context
+ *          1 つの HTML に書き出す状態
+ * @param   part
+ *          書き出すパート
+ * @param   sink
+ *          書き出す先
+ */
+static void
+inlinePart(InlineContext *context, const mimepart *part, OutputSink *sink) {
+  const char *content = part->content;
+  size_t size = part->contentSize;
+  char *decoded = NULL;
+  if (content == NULL) {
+    /* 展開していないパートはファイルからデコードする
+     * HTML と CSS は元の参照のままなので、そのまま埋め込むと
+     * 参照先が欠けた HTML になる */
+    if (isRewritable(part) ||
+        context->source.fd == -1 || part->bodyOffset < 0 ||
+        !decode_range_fd(context->source.fd, part->bodyOffset,
+                         part->bodySize, part->transferEncoding,
+                         &decoded, &size)) {
+      context->failed = true;
+      return;
+    }
+    content = decoded;
+  }
+  if (!isRewritable(part)) {
+    sink->write(content, size);
+    free(decoded);
+    return;
+  }
+
+  context->stack.push_back(part);
+
+  std::vector<ReferenceRange> ranges;
+  findReferenceRanges(context->baseURI, part, context->rebasable,
+                      content, size, &ranges);
+
+  size_t copied = 0;
+  for (size_t i = 0; i < ranges.size(); i ++) {
+    size_t pos = ranges[i].pos, nameEnd = ranges[i].nameEnd;
+    if (pos < copied) {
+      continue;
+    }
+    auto it = context->parts.find(std::string(content + ranges[i].nameStart,
+                                              nameEnd - ranges[i].nameStart));
+    if (it == context->parts.end() ||
+        std::find(context->stack.begin(), context->stack.end(), it->second)
+        != context->stack.end()) {
+      continue;
+    }
+    const mimepart *target = it->second;
+
+    sink->write(content + copied, pos - copied);
+    const char *mimetype = target->mimetype && target->mimetype[0]
+      ? target->mimetype : "application/octet-stream";
+    sink->write("data:", 5);
+    sink->write(mimetype, strlen(mimetype));
+    writeCharsetParam(target, sink);
+    sink->write(";base64,", 8);
+
+    Base64Sink encoder(sink);
+    inlinePart(context, target, &encoder);
+    encoder.finish();
+
+    /* data URI の後のクエリは内容の一部になるので除く */
+    if (nameEnd < size && content[nameEnd] == '?') {
+      while (nameEnd < size &&
+             !strchr("\"'() \t\r\n<>#\\", content[nameEnd])) {
+        nameEnd ++;
+      }
+    }
+    copied = nameEnd;
+  }
+  sink->write(content + copied, size - copied);
+
+  context->stack.pop_back();
+  free(decoded);
+}
+
+extern "C" {
+
+int32_t
+export_directory(const efileinfo *info, const char *sourcePath,
+                 const char *dir) {
+  if (info == NULL || dir == NULL) {
+    return false;
+  }
+
+  if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+    return false;
+  }
+
+  ExportContext context;
+  context.source.fd = -1;
+  context.source.map = NULL;
+  context.source.size = 0;
+  context.baseURI = info->baseURI ? info->baseURI : "";
+  context.rebasable = info->rebasable != 0;
+
+  context.dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (context.dirfd == -1) {
+    return false;
+  }
+
+  if (sourcePath && !openSource(sourcePath, &context.source)) {
+    close(context.dirfd);
+    return false;
+  }
+
+  /* ファイル名を決める
+   * 開始パートを先に決めて index にする */
+  std::vector<ExportPart> targets;
+  std::set<std::string> used;
+  if (info->startPart && info->startPart->content) {
+    ExportPart target;
+    target.part = info->startPart;
+    target.name = uniqueName(std::string("index") +
+                             extensionForType(info->startPart->mimetype),
+                             &used);
+    targets.push_back(target);
+  }
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    const mimepart *p = info->parts[i];
+    if (p == info->startPart) {
+      continue;
+    }
+    if (p->mimetype && strncasecmp(p->mimetype, "multipart/", 10) == 0) {
+      continue;
+    }
+    if (p->content == NULL &&
+        (context.source.fd == -1 || p->bodyOffset < 0)) {
+      continue;
+    }
+
+    ExportPart target;
+    target.part = p;
+    target.name = uniqueName(safeName(p), &used);
+    targets.push_back(target);
+  }
+  for (size_t i = 0; i < targets.size(); i ++) {
+    if (targets[i].part->cid) {
+      context.names[targets[i].part->cid] = &targets[i].name;
+    }
+  }
+
+  std::atomic<bool> succeeded(true);
+  std::shared_ptr<ThreadPool> pool = ThreadPool::shared();
+  if (pool) {
+    pool->parallelFor(targets.size(), [&context, &targets, &succeeded](size_t i) {
+        if (!exportPart(context, targets[i])) {
+          succeeded = false;
+        }
+      });
+  } else {
+    for (size_t i = 0; i < targets.size(); i ++) {
+      if (!exportPart(context, targets[i])) {
+        succeeded = false;
+      }
+    }
+  }
+
+  if (context.source.map) {
+    munmap(const_cast<char *>(context.source.map), context.source.size);
+  }
+  if (context.source.fd != -1) {
+    close(context.source.fd);
+  }
+  close(context.dirfd);
+
+  return succeeded;
+}
+
+int32_t
+export_single_html(const efileinfo *info, const char *sourcePath, int fd) {
+  if (info == NULL || info->startPart == NULL) {
+    return false;
+  }
+
+  InlineContext context;
+  context.source.fd = -1;
+  context.source.map = NULL;
+  context.source.size = 0;
+  context.baseURI = info->baseURI ? info->baseURI : "";
+  context.rebasable = info->rebasable != 0;
+  context.failed = false;
+
+  if (sourcePath && !openSource(sourcePath, &context.source)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    const mimepart *p = info->parts[i];
+    if (p->cid) {
+      context.parts[p->cid] = p;
+    }
+  }
+
+  FileSink sink(fd);
+  inlinePart(&context, info->startPart, &sink);
+  bool succeeded = sink.flush() && !context.failed;
+
+  if (context.source.map) {
+    munmap(const_cast<char *>(context.source.map), context.source.size);
+  }
+  if (context.source.fd != -1) {
+    close(context.source.fd);
+  }
+
+  return succeeded;
+}
+
+}
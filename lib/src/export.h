@@ -0,0 +1,100 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __export_h_included__
+#define __export_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "unmht.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 展開した MHT ファイルをディレクトリに書き出す
+ * 開始パートを index.html (HTML 以外ならば index.<拡張子>) とし、
+ * 他のパートは Content-Location の末尾から作った安全な名前で書き出す
+ * HTML と CSS 中の参照は書き出したファイル名に書き換える
+ * 同名のファイルは削除してから作成し、シンボリックリンクは辿らない
+ * 各ファイルはスレッドプールで並列に書き出す
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ * @param   sourcePath
+ *          展開した MHT ファイルのパス
+ *          指定した場合、デコードが不要なパートはファイルから直接複写し、
+ *          CONTENT_STORAGE_PRUNED のパートもデコードして書き出す
+ *          NULL ならば展開情報の内容のみを書き出す
+ *          圧縮されたファイルならば失敗する
+ * @param   dir
+ *          書き出すディレクトリ
+ *          無ければ作成する
+ * @returns 成功したか
+ */
+int32_t
+export_directory(const efileinfo *info, const char *sourcePath,
+                 const char *dir);
+
+/**
+ * 展開した MHT ファイルを 1 つの HTML としてファイル記述子に書き出す
+ * 開始パート中の参照を参照先のパートの data URI に置き換える
+ * 参照先の HTML と CSS 中の参照も再帰的に置き換える
+ * 参照を置き換えながら順に書き出すので、全体をメモリ上に作成しない
+ * cidMode に関わらず使用できる
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ * @param   sourcePath
+ *          展開した MHT ファイルのパス
+ *          指定した場合、CONTENT_STORAGE_PRUNED のパートもデコードして埋め込む
+ *          ただし HTML と CSS は参照を書き換えられないので埋め込めない
+ *          NULL ならば展開情報の内容のみを使用する
+ *          圧縮されたファイルならば失敗する
+ *          埋め込めないパートへの参照があれば失敗する
+ * @param   fd
+ *          書き出す先のファイル記述子
+ * @returns 成功したか
+ */
+int32_t
+export_single_html(const efileinfo *info, const char *sourcePath, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __export_h_included__ */
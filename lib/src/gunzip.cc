@@ -0,0 +1,205 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "gunzip.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/**
+ * callback に 1 度に渡す長さ
+ */
+#define OUTPUT_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * 展開後の長さの圧縮された長さに対する比の上限
+ * RATIO_FREE_SIZE までは比に関わらず展開する
+ */
+#define MAX_RATIO 100
+
+/**
+ * 比に関わらず展開する長さ
+ * 短い HTML は比が大きくなりやすい
+ */
+#define RATIO_FREE_SIZE (16 * 1024 * 1024)
+
+/**
+ * 判別に必要な先頭の長さ
+ * gzip のヘッダとトレーラーの長さ
+ */
+#define HEADER_SIZE 18
+
+/**
+ * zlib に 1 度に渡す長さの上限
+ */
+#define MAX_CHUNK_SIZE (1024 * 1024 * 1024)
+
+/**
+ * gzip 形式か
+ *
+ * @param   data
+ *          対象のバイト列
+ * @param   size
+ *          対象のバイト列の長さ
+ * @returns gzip 形式か
+ */
+static bool
+isGzip(const unsigned char *data, size_t size) {
+  return size >= HEADER_SIZE && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8;
+}
+
+/**
+ * zlib 形式か
+ * 圧縮方式が deflate でヘッダのチェックサムが正しいものとする
+ *
+ * @param   data
+ *          対象のバイト列
+ * @param   size
+ *          対象のバイト列の長さ
+ * @returns zlib 形式か
+ */
+static bool
+isZlib(const unsigned char *data, size_t size) {
+  return size >= 6 && (data[0] & 0x0f) == 8 && (data[0] >> 4) <= 7 &&
+    ((data[0] << 8) | data[1]) % 31 == 0;
+}
+
+extern "C" {
+
+int32_t
+isCompressed(const char *data, size_t size) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+  return isGzip(p, size) || isZlib(p, size);
+}
+
+int32_t
+isCompressedFile(int fd) {
+  unsigned char header[HEADER_SIZE];
+  size_t size = 0;
+  while (size < sizeof(header)) {
+    ssize_t n = pread(fd, header + size, sizeof(header) - size, size);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    size += n;
+  }
+
+  return isGzip(header, size) || isZlib(header, size);
+}
+
+int32_t
+decompressData(const char *data, size_t size,
+               decompressedfunc callback, void *context) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+  bool gzip = isGzip(p, size);
+  if (!gzip && !isZlib(p, size)) {
+    return false;
+  }
+
+  /* 展開したバイト列はメモリ上に溜めないので、長さの上限は比のみで決める */
+  size_t limit = RATIO_FREE_SIZE;
+  if (size > limit / MAX_RATIO) {
+    limit = size > SIZE_MAX / MAX_RATIO ? SIZE_MAX : size * MAX_RATIO;
+  }
+
+  char *buffer = reinterpret_cast<char *>(malloc(OUTPUT_CHUNK_SIZE));
+  if (buffer == NULL) {
+    return false;
+  }
+
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  /* 15 + 32 で gzip と zlib のヘッダを自動判別する */
+  if (inflateInit2(&z, 15 + 32) != Z_OK) {
+    free(buffer);
+    return false;
+  }
+
+  size_t inPos = 0, outSize = 0;
+  bool ok = false;
+  for (;;) {
+    size_t inChunk = size - inPos;
+    if (inChunk > MAX_CHUNK_SIZE) {
+      inChunk = MAX_CHUNK_SIZE;
+    }
+    z.next_in = const_cast<Bytef *>(p + inPos);
+    z.avail_in = static_cast<uInt>(inChunk);
+    z.next_out = reinterpret_cast<Bytef *>(buffer);
+    z.avail_out = OUTPUT_CHUNK_SIZE;
+
+    int ret = inflate(&z, Z_NO_FLUSH);
+    inPos += inChunk - z.avail_in;
+    size_t produced = OUTPUT_CHUNK_SIZE - z.avail_out;
+
+    /* 展開した後で比べるので、上限ちょうどの長さは受け付ける */
+    outSize += produced;
+    if (outSize > limit) {
+      break;
+    }
+    if (produced > 0 && !callback(buffer, produced, context)) {
+      break;
+    }
+
+    if (ret == Z_STREAM_END) {
+      /* 連結された gzip の次のメンバー */
+      if (gzip && isGzip(p + inPos, size - inPos) &&
+          inflateReset(&z) == Z_OK) {
+        continue;
+      }
+      ok = true;
+      break;
+    }
+    /* 出力の領域は毎回空けているので、Z_BUF_ERROR は途中で切れている */
+    if (ret != Z_OK) {
+      break;
+    }
+  }
+  inflateEnd(&z);
+  free(buffer);
+
+  return ok;
+}
+
+}
@@ -0,0 +1,110 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __gunzip_h_included__
+#define __gunzip_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * gzip 形式か zlib 形式で圧縮されているかを調べる
+ *
+ * @param   data
+ *          対象のバイト列
+ * @param   size
+ *          対象のバイト列の長さ
+ * @returns 圧縮されているか
+ */
+int32_t
+isCompressed(const char *data, size_t size);
+
+/**
+ * 圧縮されたファイルかを調べる
+ * ファイルの先頭のみを読む
+ *
+ * @param   fd
+ *          ファイル記述子
+ * @returns gzip 形式か zlib 形式で圧縮されているか
+ */
+int32_t
+isCompressedFile(int fd);
+
+/**
+ * 展開したバイト列の続きを受け取る関数
+ *
+ * @param   data
+ *          展開したバイト列の続き
+ * @param   size
+ *          展開したバイト列の続きの長さ
+ * @param   context
+ *          decompressData に渡した値
+ * @returns 展開を続けるか
+ */
+typedef int32_t (*decompressedfunc)(const char *data, size_t size,
+                                    void *context);
+
+/**
+ * gzip 形式か zlib 形式で圧縮されたバイト列を展開する
+ * 展開したバイト列は全体をメモリ上に持たずに、1MB 以下ずつ callback に渡す
+ * 連結された gzip のメンバーは順に展開する
+ * 展開後が圧縮された長さの 100 倍と 16MB の大きい方を超える場合は
+ * 圧縮爆弾とみなして失敗する
+ *
+ * @param   data
+ *          圧縮されたバイト列
+ * @param   size
+ *          圧縮されたバイト列の長さ
+ * @param   callback
+ *          展開したバイト列の続きを受け取る関数
+ *          失敗しても途中までのバイト列は渡している
+ * @param   context
+ *          callback に渡す値
+ * @returns 成功したか
+ *          callback が false を返した場合も失敗する
+ */
+int32_t
+decompressData(const char *data, size_t size,
+               decompressedfunc callback, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __gunzip_h_included__ */
@@ -0,0 +1,512 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "htmltext.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+/**
+ * タグ名として保持する最大の長さ
+ */
+#define MAX_TAG_NAME 15
+
+/**
+ * 実体参照の名前として保持する最大の長さ
+ */
+#define MAX_ENTITY_NAME 6
+
+/**
+ * 解析の状態
+ */
+enum HtmlTextState {
+  HTML_TEXT,         /* テキスト */
+  HTML_TAG_OPEN,     /* < の直後 */
+  HTML_TAG_NAME,     /* タグ名 */
+  HTML_TAG_ATTRS,    /* 属性 */
+  HTML_TAG_DQ,       /* " で囲まれた属性値 */
+  HTML_TAG_SQ,       /* ' で囲まれた属性値 */
+  HTML_BANG,         /* <! の直後 */
+  HTML_COMMENT,      /* コメント */
+  HTML_DECL,         /* <!DOCTYPE> 等 */
+  HTML_ENTITY,       /* & の直後 */
+  HTML_RAW           /* script 要素か style 要素の内容 */
+};
+
+/**
+ * 分割して入力する HTML のテキスト抽出器
+ */
+struct htmltextstream {
+  HtmlTextState state;
+  bool pendingSpace;  /* 次の文字の前に空白を出力するか */
+  bool emitted;       /* 1 文字以上出力したか */
+  bool closing;       /* 終了タグか */
+  int dashes;         /* コメント中の連続する - の数 */
+  char name[MAX_TAG_NAME + 1];     /* タグ名 (小文字) */
+  size_t nameLength;
+  char entity[MAX_ENTITY_NAME + 1]; /* 実体参照の名前 */
+  size_t entityLength;
+  const char *rawEnd; /* RAW の終わりを示す文字列 */
+  size_t rawMatch;    /* rawEnd に一致した長さ */
+};
+
+/**
+ * 空白か
+ *
+ * @param   c
+ *          文字
+ * @returns 空白か
+ */
+static inline bool
+isSpace(unsigned char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/**
+ * 英字か
+ *
+ * @param   c
+ *          文字
+ * @returns 英字か
+ */
+static inline bool
+isAlpha(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/**
+ * 英数字か
+ *
+ * @param   c
+ *          文字
+ * @returns 英数字か
+ */
+static inline bool
+isAlnum(unsigned char c) {
+  return isAlpha(c) || (c >= '0' && c <= '9');
+}
+
+/**
+ * 小文字にする
+ *
+ * @param   c
+ *          文字
+ * @returns 小文字
+ */
+static inline char
+toLower(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+/**
+ * 前後で単語が切れる要素か
+ *
+ * @param   name
+ *          タグ名 (小文字)
+ * @returns 前後で単語が切れるか
+ */
+static bool
+isBlockTag(const char *name) {
+  static const char *blocks[] = {
+    "address", "article", "aside", "blockquote", "body", "br", "caption",
+    "dd", "div", "dl", "dt", "fieldset", "figcaption", "figure", "footer",
+    "form", "h1", "h2", "h3", "h4", "h5", "h6", "head", "header", "hr",
+    "html", "img", "input", "legend", "li", "main", "nav", "ol", "option",
+    "p", "pre", "section", "select", "table", "tbody", "td", "textarea",
+    "tfoot", "th", "thead", "title", "tr", "ul", NULL
+  };
+  for (int i = 0; blocks[i]; i ++) {
+    if (strcmp(name, blocks[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * 実体参照を展開する
+ * arDOMUtils.unescapeEntity と同じもののみ
+ *
+ * @param   name
+ *          実体参照の名前 (& と ; を除く)
+ * @returns 展開した UTF-8 の文字列
+ *          対象外ならば NULL
+ */
+static const char *
+lookupEntity(const char *name) {
+  static const char *entities[][2] = {
+    { "gt", ">" },
+    { "lt", "<" },
+    { "quot", "\"" },
+    { "#x27", "'" },
+    { "#xa0", "\xc2\xa0" },
+    { "nbsp", "\xc2\xa0" },
+    { "amp", "&" },
+    { NULL, NULL }
+  };
+  for (int i = 0; entities[i][0]; i ++) {
+    if (strcmp(name, entities[i][0]) == 0) {
+      return entities[i][1];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * 1 文字出力する
+ * 保留している空白があれば先に出力する
+ *
+ * @param   s
+ *          テキスト抽出器
+ * @param   out
+ *          出力先
+ * @param   o
+ *          (入出力) 出力した長さ
+ * @param   c
+ *          文字
+ */
+static inline void
+emit(htmltextstream *s, char *out, size_t *o, char c) {
+  if (s->pendingSpace) {
+    if (s->emitted) {
+      out[(*o) ++] = ' ';
+    }
+    s->pendingSpace = false;
+  }
+  out[(*o) ++] = c;
+  s->emitted = true;
+}
+
+/**
+ * 保留していた & と実体参照の名前をそのまま出力する
+ *
+ * @param   s
+ *          テキスト抽出器
+ * @param   out
+ *          出力先
+ * @param   o
+ *          (入出力) 出力した長さ
+ */
+static void
+flushEntity(htmltextstream *s, char *out, size_t *o) {
+  emit(s, out, o, '&');
+  for (size_t k = 0; k < s->entityLength; k ++) {
+    emit(s, out, o, s->entity[k]);
+  }
+  s->entityLength = 0;
+}
+
+/**
+ * タグの終わりを処理する
+ *
+ * @param   s
+ *          テキスト抽出器
+ */
+static void
+endTag(htmltextstream *s) {
+  s->name[s->nameLength] = '\0';
+  if (isBlockTag(s->name)) {
+    s->pendingSpace = true;
+  }
+
+  if (!s->closing && strcmp(s->name, "script") == 0) {
+    s->rawEnd = "</script";
+    s->rawMatch = 0;
+    s->state = HTML_RAW;
+  } else if (!s->closing && strcmp(s->name, "style") == 0) {
+    s->rawEnd = "</style";
+    s->rawMatch = 0;
+    s->state = HTML_RAW;
+  } else {
+    s->state = HTML_TEXT;
+  }
+}
+
+extern "C" {
+
+htmltextstream *
+create_htmltextstream(void) {
+  htmltextstream *s = new (std::nothrow) htmltextstream();
+  if (s == NULL) {
+    return NULL;
+  }
+
+  s->state = HTML_TEXT;
+  s->pendingSpace = false;
+  s->emitted = false;
+  s->closing = false;
+  s->dashes = 0;
+  s->nameLength = 0;
+  s->entityLength = 0;
+  s->rawEnd = NULL;
+  s->rawMatch = 0;
+
+  return s;
+}
+
+size_t
+feed_htmltextstream(htmltextstream *s, const char *html, size_t size,
+                    char *out) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(html);
+  size_t i = 0, o = 0;
+
+  while (i < size) {
+    unsigned char c = p[i];
+
+    switch (s->state) {
+      case HTML_TEXT: {
+        /* 特別な文字が無い間はまとめて複写する */
+        size_t start = i;
+        while (i < size && p[i] != '<' && p[i] != '&' && !isSpace(p[i])) {
+          i ++;
+        }
+        if (i > start) {
+          emit(s, out, &o, p[start]);
+          memcpy(out + o, p + start + 1, i - start - 1);
+          o += i - start - 1;
+          continue;
+        }
+
+        if (isSpace(c)) {
+          s->pendingSpace = true;
+        } else if (c == '<') {
+          s->state = HTML_TAG_OPEN;
+        } else {
+          s->entityLength = 0;
+          s->state = HTML_ENTITY;
+        }
+        i ++;
+        break;
+      }
+
+      case HTML_TAG_OPEN:
+        s->nameLength = 0;
+        s->closing = false;
+        if (c == '/') {
+          s->closing = true;
+          s->state = HTML_TAG_NAME;
+        } else if (c == '!') {
+          s->dashes = 0;
+          s->state = HTML_BANG;
+        } else if (c == '?') {
+          s->state = HTML_DECL;
+        } else if (isAlpha(c)) {
+          s->state = HTML_TAG_NAME;
+          continue;
+        } else {
+          /* タグではない */
+          emit(s, out, &o, '<');
+          s->state = HTML_TEXT;
+          continue;
+        }
+        i ++;
+        break;
+
+      case HTML_TAG_NAME:
+        if (isAlnum(c)) {
+          if (s->nameLength < MAX_TAG_NAME) {
+            s->name[s->nameLength ++] = toLower(c);
+          }
+          i ++;
+          break;
+        }
+        s->state = HTML_TAG_ATTRS;
+        continue;
+
+      case HTML_TAG_ATTRS:
+        if (c == '>') {
+          endTag(s);
+        } else if (c == '"') {
+          s->state = HTML_TAG_DQ;
+        } else if (c == '\'') {
+          s->state = HTML_TAG_SQ;
+        }
+        i ++;
+        break;
+
+      case HTML_TAG_DQ:
+      case HTML_TAG_SQ: {
+        const void *q = memchr(p + i, s->state == HTML_TAG_DQ ? '"' : '\'',
+                               size - i);
+        if (q == NULL) {
+          i = size;
+          break;
+        }
+        i = reinterpret_cast<const unsigned char *>(q) - p + 1;
+        s->state = HTML_TAG_ATTRS;
+        break;
+      }
+
+      case HTML_BANG:
+        if (c == '-') {
+          s->dashes ++;
+          if (s->dashes == 2) {
+            s->dashes = 0;
+            s->state = HTML_COMMENT;
+          }
+        } else if (c == '>') {
+          s->state = HTML_TEXT;
+        } else {
+          s->state = HTML_DECL;
+        }
+        i ++;
+        break;
+
+      case HTML_COMMENT:
+        if (c == '-') {
+          s->dashes ++;
+        } else if (c == '>' && s->dashes >= 2) {
+          s->state = HTML_TEXT;
+        } else {
+          s->dashes = 0;
+        }
+        i ++;
+        break;
+
+      case HTML_DECL: {
+        const void *q = memchr(p + i, '>', size - i);
+        if (q == NULL) {
+          i = size;
+          break;
+        }
+        i = reinterpret_cast<const unsigned char *>(q) - p + 1;
+        s->state = HTML_TEXT;
+        break;
+      }
+
+      case HTML_ENTITY:
+        if (c == ';') {
+          s->entity[s->entityLength] = '\0';
+          const char *value = lookupEntity(s->entity);
+          if (value) {
+            for (; *value; value ++) {
+              emit(s, out, &o, *value);
+            }
+            s->entityLength = 0;
+          } else {
+            flushEntity(s, out, &o);
+            emit(s, out, &o, ';');
+          }
+          s->state = HTML_TEXT;
+          i ++;
+        } else if ((isAlnum(c) || c == '#') &&
+                   s->entityLength < MAX_ENTITY_NAME) {
+          s->entity[s->entityLength ++] = c;
+          i ++;
+        } else {
+          flushEntity(s, out, &o);
+          s->state = HTML_TEXT;
+        }
+        break;
+
+      case HTML_RAW:
+        if (s->rawMatch == 0) {
+          const void *q = memchr(p + i, '<', size - i);
+          if (q == NULL) {
+            i = size;
+            break;
+          }
+          i = reinterpret_cast<const unsigned char *>(q) - p + 1;
+          s->rawMatch = 1;
+          break;
+        }
+        if (s->rawEnd[s->rawMatch] == '\0') {
+          if (isAlnum(c)) {
+            /* </scripts 等は終了タグではない */
+            s->rawMatch = 0;
+            break;
+          }
+          /* 終了タグの残りは通常のタグと同じ */
+          s->closing = true;
+          s->nameLength = 0;
+          s->state = HTML_TAG_ATTRS;
+        } else if (toLower(c) == s->rawEnd[s->rawMatch]) {
+          s->rawMatch ++;
+          i ++;
+        } else {
+          s->rawMatch = 0;
+        }
+        break;
+    }
+  }
+
+  return o;
+}
+
+size_t
+finish_htmltextstream(htmltextstream *s, char *out) {
+  size_t o = 0;
+
+  if (s->state == HTML_ENTITY) {
+    flushEntity(s, out, &o);
+  } else if (s->state == HTML_TAG_OPEN) {
+    emit(s, out, &o, '<');
+  }
+  s->state = HTML_TEXT;
+
+  return o;
+}
+
+void
+delete_htmltextstream(htmltextstream *s) {
+  delete s;
+}
+
+int32_t
+html_to_text(const char *html, size_t size, char **text, size_t *textSize) {
+  htmltextstream *s = create_htmltextstream();
+  if (s == NULL) {
+    return false;
+  }
+
+  char *out = reinterpret_cast<char *>(malloc(size + HTMLTEXT_MARGIN + 1));
+  if (out == NULL) {
+    delete_htmltextstream(s);
+    return false;
+  }
+
+  size_t o = feed_htmltextstream(s, html, size, out);
+  o += finish_htmltextstream(s, out + o);
+  out[o] = '\0';
+  delete_htmltextstream(s);
+
+  *text = out;
+  *textSize = o;
+
+  return true;
+}
+
+}
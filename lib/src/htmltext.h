@@ -0,0 +1,131 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __htmltext_h_included__
+#define __htmltext_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * feed_htmltextstream の出力に必要な、入力の長さに加える余裕
+ * 前回の入力の末尾で保留した実体参照等を出力するため
+ */
+#define HTMLTEXT_MARGIN 16
+
+/**
+ * 分割して入力する HTML のテキスト抽出器
+ */
+typedef struct htmltextstream htmltextstream;
+
+/**
+ * HTML からテキストを抽出する
+ * タグ、コメント、script 要素と style 要素の内容を取り除き、
+ * arDOMUtils.unescapeEntity と同じ実体参照を展開し、
+ * 連続する空白を 1 つの空白にまとめる
+ * ブロック要素の境界は空白にする
+ *
+ * @param   html
+ *          UTF-8 の HTML
+ * @param   size
+ *          HTML の長さ
+ * @param   text
+ *          (出力) 抽出した UTF-8 のテキスト
+ *          不要になったら free で開放する
+ * @param   textSize
+ *          (出力) 抽出したテキストの長さ
+ * @returns 成功したか
+ */
+int32_t
+html_to_text(const char *html, size_t size, char **text, size_t *textSize);
+
+/**
+ * 分割して入力する HTML のテキスト抽出器を作成する
+ *
+ * @returns テキスト抽出器
+ *          失敗したら NULL
+ */
+htmltextstream *
+create_htmltextstream(void);
+
+/**
+ * HTML の続きを入力する
+ *
+ * @param   stream
+ *          テキスト抽出器
+ * @param   html
+ *          HTML の続き
+ * @param   size
+ *          HTML の続きの長さ
+ * @param   text
+ *          (出力) 抽出したテキストを書き込む領域
+ *          size + HTMLTEXT_MARGIN バイト以上が必要
+ * @returns 書き込んだ長さ
+ */
+size_t
+feed_htmltextstream(htmltextstream *stream, const char *html, size_t size,
+                    char *text);
+
+/**
+ * 入力の終わりを通知する
+ *
+ * @param   stream
+ *          テキスト抽出器
+ * @param   text
+ *          (出力) 保留していたテキストを書き込む領域
+ *          HTMLTEXT_MARGIN バイト以上が必要
+ * @returns 書き込んだ長さ
+ */
+size_t
+finish_htmltextstream(htmltextstream *stream, char *text);
+
+/**
+ * テキスト抽出器を開放する
+ *
+ * @param   stream
+ *          テキスト抽出器
+ */
+void
+delete_htmltextstream(htmltextstream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __htmltext_h_included__ */
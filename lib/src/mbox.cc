@@ -0,0 +1,409 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "mbox.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.hh"
+#include "gunzip.h"
+
+/**
+ * 反復子が 1 スレッドあたり先に展開しておくメッセージの数
+ */
+#define LOOKAHEAD_PER_THREAD 2
+
+/**
+ * mbox ファイルの 1 つのメッセージ
+ */
+struct mboxmessage {
+  size_t offset; /* ファイル中の位置 */
+  size_t size;   /* 長さ */
+};
+
+struct mboxindex {
+  const char *map;                   /* マップした内容 */
+  size_t size;                       /* ファイルの長さ */
+  std::vector<mboxmessage> messages; /* メッセージ */
+};
+
+struct mboxiterator {
+  mboxindex *index;          /* mbox ファイルのメッセージの一覧 */
+  std::string script;        /* ql_unmht.js の内容 */
+  int32_t mode;              /* 展開の指定 */
+
+  std::vector<std::thread> threads; /* 展開するスレッド */
+  size_t lookahead;          /* 先に展開しておくメッセージの数 */
+
+  std::mutex mutex;          /* 以下を保護する */
+  std::condition_variable cond;
+  size_t next;               /* 次に展開を始めるメッセージ */
+  size_t current;            /* 次に返すメッセージ */
+  std::vector<efileinfo *> results; /* 展開したメッセージ */
+  std::vector<bool> done;    /* 展開が終わったか */
+  bool stopping;             /* 開放中か */
+};
+
+/**
+ * 行頭が空行の直後か
+ *
+ * @param   data
+ *          ファイルの先頭
+ * @param   p
+ *          行頭
+ * @returns 直前の行が空行か
+ */
+static bool
+followsBlankLine(const char *data, const char *p) {
+  if (p - data >= 2 && p[-1] == '\n' && p[-2] == '\n') {
+    return true;
+  }
+  if (p - data >= 3 && p[-1] == '\n' && p[-2] == '\r' && p[-3] == '\n') {
+    return true;
+  }
+  return false;
+}
+
+/**
+ * メッセージの区切りを探す
+ * 改行の検索は memchr に任せる
+ *
+ * @param   data
+ *          ファイルの内容
+ * @param   size
+ *          ファイルの長さ
+ * @param   starts
+ *          (出力) 区切りの行の位置
+ */
+static void
+scanSeparators(const char *data, size_t size, std::vector<size_t> *starts) {
+  const char *end = data + size;
+
+  if (size >= 5 && memcmp(data, "From ", 5) == 0) {
+    starts->push_back(0);
+  }
+
+  const char *p = data;
+  while (p < end) {
+    const char *lf
+      = reinterpret_cast<const char *>(memchr(p, '\n', end - p));
+    if (lf == NULL) {
+      break;
+    }
+    p = lf + 1;
+    if (end - p >= 5 && memcmp(p, "From ", 5) == 0 &&
+        followsBlankLine(data, p)) {
+      starts->push_back(p - data);
+    }
+  }
+}
+
+/**
+ * パートの元のファイル中の位置をずらす
+ *
+ * @param   info
+ *          メッセージの展開情報
+ * @param   offset
+ *          ファイル中のメッセージの位置
+ */
+static void
+shiftSourceRanges(efileinfo *info, size_t offset) {
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    mimepart *p = info->parts[i];
+    if (p->headerOffset >= 0) {
+      p->headerOffset += offset;
+    }
+    if (p->bodyOffset >= 0) {
+      p->bodyOffset += offset;
+    }
+  }
+}
+
+/**
+ * メッセージを展開する
+ *
+ * @param   index
+ *          mbox ファイルのメッセージの一覧
+ * @param   i
+ *          メッセージの番号
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @returns メッセージの展開情報
+ *          失敗したら NULL
+ */
+static efileinfo *
+extractMessage(const mboxindex *index, size_t i,
+               const char *script, int32_t mode) {
+  const mboxmessage &message = index->messages[i];
+  efileinfo *info = extract_buffer(index->map + message.offset, message.size,
+                                   script, mode);
+  if (info) {
+    shiftSourceRanges(info, message.offset);
+  }
+  return info;
+}
+
+/**
+ * 反復子のスレッドの処理
+ * 返し終えたメッセージから lookahead 個先までを順に展開する
+ *
+ * @param   iterator
+ *          メッセージを順に展開する反復子
+ */
+static void
+iteratorMain(mboxiterator *iterator) {
+  size_t count = iterator->index->messages.size();
+
+  std::unique_lock<std::mutex> lock(iterator->mutex);
+  for (;;) {
+    iterator->cond.wait(lock, [iterator, count] {
+        return iterator->stopping || iterator->next >= count ||
+          iterator->next < iterator->current + iterator->lookahead;
+      });
+    if (iterator->stopping || iterator->next >= count) {
+      return;
+    }
+
+    size_t i = iterator->next ++;
+    lock.unlock();
+    efileinfo *info = extractMessage(iterator->index, i,
+                                     iterator->script.c_str(),
+                                     iterator->mode);
+    lock.lock();
+
+    iterator->results[i] = info;
+    iterator->done[i] = true;
+    iterator->cond.notify_all();
+  }
+}
+
+extern "C" {
+
+mboxindex *
+open_mboxindex(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  mboxindex *index = new mboxindex();
+  index->map = NULL;
+  index->size = st.st_size;
+
+  if (index->size > 0) {
+    void *map = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      delete index;
+      return NULL;
+    }
+    index->map = reinterpret_cast<const char *>(map);
+  }
+  close(fd);
+
+  /* メッセージはファイル中の位置で切り出すので、圧縮されたファイルは
+   * 扱わない */
+  if (isCompressed(index->map, index->size)) {
+    if (index->map) {
+      munmap(const_cast<char *>(index->map), index->size);
+    }
+    delete index;
+    return NULL;
+  }
+
+  madvise(const_cast<char *>(index->map), index->size, MADV_SEQUENTIAL);
+  std::vector<size_t> starts;
+  scanSeparators(index->map, index->size, &starts);
+  madvise(const_cast<char *>(index->map), index->size, MADV_NORMAL);
+
+  if (starts.empty() || starts[0] != 0) {
+    /* 先頭に区切りが無い場合は区切りまでを 1 つのメッセージとする */
+    starts.insert(starts.begin(), 0);
+  }
+
+  for (size_t i = 0; i < starts.size(); i ++) {
+    mboxmessage message;
+    message.offset = starts[i];
+    size_t end = i + 1 < starts.size() ? starts[i + 1] : index->size;
+
+    /* 区切りの前の空行はメッセージに含めない */
+    if (i + 1 < starts.size()) {
+      end --;
+      if (end > message.offset && index->map[end - 1] == '\r') {
+        end --;
+      }
+    }
+
+    message.size = end - message.offset;
+    if (message.size > 0) {
+      index->messages.push_back(message);
+    }
+  }
+
+  return index;
+}
+
+size_t
+count_mboxindex(const mboxindex *index) {
+  return index->messages.size();
+}
+
+int32_t
+locate_mboxindex(const mboxindex *index, size_t i,
+                 uint64_t *offset, size_t *size) {
+  if (i >= index->messages.size()) {
+    return false;
+  }
+
+  *offset = index->messages[i].offset;
+  *size = index->messages[i].size;
+
+  return true;
+}
+
+efileinfo *
+extract_mboxindex(mboxindex *index, size_t i,
+                  const char *script, int32_t mode) {
+  if (i >= index->messages.size()) {
+    return NULL;
+  }
+
+  return extractMessage(index, i, script, mode);
+}
+
+void
+delete_mboxindex(mboxindex *index) {
+  if (index->map) {
+    munmap(const_cast<char *>(index->map), index->size);
+  }
+  delete index;
+}
+
+mboxiterator *
+create_mboxiterator(mboxindex *index, const char *script, int32_t mode) {
+  size_t count = index->messages.size();
+
+  /* 各スレッドは自身の JavaScript の実行環境を持つので
+   * 共有のプールのワーカーではなく専用のスレッドで展開する */
+  size_t threadCount = 1;
+  std::shared_ptr<ThreadPool> pool = ThreadPool::shared();
+  if (pool) {
+    threadCount = pool->size();
+  }
+  if (threadCount > count) {
+    threadCount = count;
+  }
+
+  mboxiterator *iterator = new mboxiterator();
+  iterator->index = index;
+  iterator->script = script;
+  iterator->mode = mode;
+  iterator->lookahead = threadCount * LOOKAHEAD_PER_THREAD;
+  iterator->next = 0;
+  iterator->current = 0;
+  iterator->results.resize(count, NULL);
+  iterator->done.resize(count, false);
+  iterator->stopping = false;
+
+  for (size_t i = 0; i < threadCount; i ++) {
+    iterator->threads.push_back(std::thread(iteratorMain, iterator));
+  }
+
+  return iterator;
+}
+
+int32_t
+next_mboxiterator(mboxiterator *iterator, efileinfo **info) {
+  std::unique_lock<std::mutex> lock(iterator->mutex);
+
+  size_t i = iterator->current;
+  if (i >= iterator->results.size()) {
+    *info = NULL;
+    return false;
+  }
+
+  iterator->cond.wait(lock, [iterator, i] {
+      return static_cast<bool>(iterator->done[i]);
+    });
+
+  *info = iterator->results[i];
+  iterator->results[i] = NULL;
+  iterator->current ++;
+  iterator->cond.notify_all();
+
+  return true;
+}
+
+void
+delete_mboxiterator(mboxiterator *iterator) {
+  {
+    std::lock_guard<std::mutex> lock(iterator->mutex);
+    iterator->stopping = true;
+  }
+  iterator->cond.notify_all();
+
+  for (size_t i = 0; i < iterator->threads.size(); i ++) {
+    iterator->threads[i].join();
+  }
+
+  /* 返していないメッセージを開放する */
+  for (size_t i = iterator->current; i < iterator->results.size(); i ++) {
+    if (iterator->results[i]) {
+      delete_efileinfo(iterator->results[i]);
+    }
+  }
+
+  delete iterator;
+}
+
+}
@@ -0,0 +1,176 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __mbox_h_included__
+#define __mbox_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "unmht.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * mbox ファイルのメッセージの一覧
+ */
+typedef struct mboxindex mboxindex;
+
+/**
+ * mbox ファイルをマップしてメッセージの区切りを探す
+ * 空行の次の "From " で始まる行をメッセージの区切りとする
+ * 区切りが無ければファイル全体を 1 つのメッセージとする
+ * メッセージはファイル中の位置で切り出すので、圧縮されたファイルは扱わない
+ *
+ * @param   path
+ *          mbox ファイルのパス
+ * @returns mbox ファイルのメッセージの一覧
+ *          失敗したか圧縮されたファイルならば NULL
+ */
+mboxindex *
+open_mboxindex(const char *path);
+
+/**
+ * メッセージの数を取得する
+ *
+ * @param   index
+ *          mbox ファイルのメッセージの一覧
+ * @returns メッセージの数
+ */
+size_t
+count_mboxindex(const mboxindex *index);
+
+/**
+ * メッセージの位置を取得する
+ *
+ * @param   index
+ *          mbox ファイルのメッセージの一覧
+ * @param   i
+ *          メッセージの番号
+ * @param   offset
+ *          (出力) ファイル中のメッセージ ("From " 行を含む) の位置
+ * @param   size
+ *          (出力) メッセージの長さ
+ * @returns 成功したか
+ */
+int32_t
+locate_mboxindex(const mboxindex *index, size_t i,
+                 uint64_t *offset, size_t *size);
+
+/**
+ * メッセージを 1 つだけ展開する
+ * 他のメッセージは読まない
+ * パートの元のファイル中の位置は mbox ファイル中の位置になる
+ *
+ * @param   index
+ *          mbox ファイルのメッセージの一覧
+ * @param   i
+ *          メッセージの番号
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @returns メッセージの展開情報
+ *          失敗したら NULL
+ */
+efileinfo *
+extract_mboxindex(mboxindex *index, size_t i,
+                  const char *script, int32_t mode);
+
+/**
+ * mbox ファイルのメッセージの一覧を開放する
+ * 先に全ての mboxiterator を開放する必要がある
+ *
+ * @param   index
+ *          mbox ファイルのメッセージの一覧
+ */
+void
+delete_mboxindex(mboxindex *index);
+
+/**
+ * メッセージを順に展開する反復子
+ */
+typedef struct mboxiterator mboxiterator;
+
+/**
+ * メッセージを順に展開する反復子を作成する
+ * 複数のスレッドで先のメッセージを並列に展開しておく
+ * スレッド数はデコードのスレッド数 (set_decode_thread_count) に従う
+ *
+ * @param   index
+ *          mbox ファイルのメッセージの一覧
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @returns メッセージを順に展開する反復子
+ *          失敗したら NULL
+ */
+mboxiterator *
+create_mboxiterator(mboxindex *index, const char *script, int32_t mode);
+
+/**
+ * 次のメッセージの展開情報を取得する
+ * 展開が終わっていなければ待つ
+ *
+ * @param   iterator
+ *          メッセージを順に展開する反復子
+ * @param   info
+ *          (出力) メッセージの展開情報
+ *          展開に失敗したメッセージは NULL
+ *          delete_efileinfo で開放する
+ * @returns メッセージがあったか
+ *          全てのメッセージを取得し終えたら false
+ */
+int32_t
+next_mboxiterator(mboxiterator *iterator, efileinfo **info);
+
+/**
+ * メッセージを順に展開する反復子を開放する
+ * 展開中のメッセージは展開が終わるまで待つ
+ *
+ * @param   iterator
+ *          メッセージを順に展開する反復子
+ */
+void
+delete_mboxiterator(mboxiterator *iterator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __mbox_h_included__ */
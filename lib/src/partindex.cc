@@ -0,0 +1,452 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "partindex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "decode.h"
+#include "gunzip.h"
+#include "spill.h"
+
+/**
+ * ファイルから読み込みながらデコードする際に 1 度に読み込む長さ
+ */
+#define DECODE_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * インデックスファイルの先頭のマジックナンバー
+ */
+#define INDEX_MAGIC "UMHTIDX\1"
+
+/**
+ * インデックスファイルの形式のバージョン
+ */
+#define INDEX_VERSION 2
+
+/**
+ * インデックスファイルに書き込むデータ
+ * 数値は全てリトルエンディアンで書き込む
+ */
+struct IndexWriter {
+  std::string data;
+
+  void
+  putUint(uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i ++) {
+      data += static_cast<char>((value >> (i * 8)) & 0xff);
+    }
+  }
+
+  void
+  putString(const char *s) {
+    size_t length = s ? strlen(s) : 0;
+    putUint(length, 4);
+    data.append(s ? s : "", length);
+  }
+};
+
+/**
+ * インデックスファイルから読み込むデータ
+ * 範囲外を読もうとした場合や領域を確保できなかった場合は ok を false にする
+ */
+struct IndexReader {
+  const char *data;
+  size_t size;
+  size_t pos;
+  bool ok;
+
+  uint64_t
+  getUint(int bytes) {
+    if (!ok || size - pos < static_cast<size_t>(bytes)) {
+      ok = false;
+      return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i ++) {
+      value |= static_cast<uint64_t>(static_cast<unsigned char>(data[pos + i]))
+        << (i * 8);
+    }
+    pos += bytes;
+    return value;
+  }
+
+  char *
+  getString(void) {
+    size_t length = getUint(4);
+    if (!ok || size - pos < length) {
+      ok = false;
+      return NULL;
+    }
+    char *s = reinterpret_cast<char *>(malloc(length + 1));
+    if (s == NULL) {
+      ok = false;
+      return NULL;
+    }
+    memcpy(s, data + pos, length);
+    s[length] = '\0';
+    pos += length;
+    return s;
+  }
+};
+
+/**
+ * ファイル記述子から指定した範囲を全て読み込む
+ *
+ * @param   fd
+ *          ファイル記述子
+ * @param   buffer
+ *          読み込む領域
+ * @param   size
+ *          読み込む長さ
+ * @param   offset
+ *          読み込む位置
+ * @returns 成功したか
+ */
+static bool
+readFully(int fd, char *buffer, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t n = pread(fd, buffer, size, offset);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (n == 0) {
+      return false;
+    }
+    buffer += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/**
+ * エンコードされたボディをデコードする
+ *
+ * @param   source
+ *          エンコードされたボディ
+ * @param   sourceSize
+ *          エンコードされたボディの長さ
+ * @param   transferEncoding
+ *          Content-Transfer-Encoding の値
+ * @param   content
+ *          (出力) デコードしたボディ
+ * @param   contentSize
+ *          (出力) デコードしたボディの長さ
+ * @returns 成功したか
+ */
+static int32_t
+decodeSource(const char *source, size_t sourceSize,
+             const char *transferEncoding,
+             char **content, size_t *contentSize) {
+  decodejob job;
+  job.source = source;
+  job.sourceSize = sourceSize;
+  job.encoding = parseTransferEncoding(transferEncoding ? transferEncoding : "");
+  job.charset = NULL;
+  job.spillSize = 0;
+
+  decodedpart result;
+  if (!decodePart(&job, &result)) {
+    return false;
+  }
+
+  *content = result.content;
+  *contentSize = result.contentSize;
+  return true;
+}
+
+extern "C" {
+
+int32_t
+decode_range_fd(int fd, uint64_t bodyOffset, size_t bodySize,
+                const char *transferEncoding,
+                char **content, size_t *contentSize) {
+  transferencoding encoding = parseTransferEncoding(transferEncoding);
+  char *out = reinterpret_cast<char *>(malloc(decodedCapacityOf(encoding,
+                                                                bodySize)));
+  if (out == NULL) {
+    return false;
+  }
+
+  /* エンコードされていなければ、そのまま読み込む */
+  if (encoding == TRANSFER_ENCODING_NONE) {
+    if (!readFully(fd, out, bodySize, bodyOffset)) {
+      free(out);
+      return false;
+    }
+    out[bodySize] = '\0';
+    *content = out;
+    *contentSize = bodySize;
+    return true;
+  }
+
+  /* ボディ全体とデコードした内容を同時に持たないように、
+   * DECODE_CHUNK_SIZE ずつ読み込みながらデコードする */
+  char *buffer = reinterpret_cast<char *>(malloc(DECODE_CHUNK_SIZE));
+  if (buffer == NULL) {
+    free(out);
+    return false;
+  }
+
+  chunkdecoder decoder;
+  decoder.encoding = encoding;
+  decoder.finished = false;
+
+  size_t readSize = 0;
+  size_t carrySize = 0;
+  size_t outSize = 0;
+  out[0] = '\0';
+  while (readSize < bodySize && !decoder.finished) {
+    size_t n = DECODE_CHUNK_SIZE - carrySize;
+    if (n > bodySize - readSize) {
+      n = bodySize - readSize;
+    }
+    if (!readFully(fd, buffer + carrySize, n, bodyOffset + readSize)) {
+      free(buffer);
+      free(out);
+      return false;
+    }
+    readSize += n;
+
+    size_t consumed;
+    outSize += decodeChunk(&decoder, buffer, carrySize + n,
+                           readSize == bodySize, out + outSize, &consumed);
+    carrySize = carrySize + n - consumed;
+    memmove(buffer, buffer + consumed, carrySize);
+  }
+  free(buffer);
+
+  /* BASE64 は上限まで確保しているので詰める */
+  char *shrunk = reinterpret_cast<char *>(realloc(out, outSize + 1));
+  *content = shrunk ? shrunk : out;
+  *contentSize = outSize;
+  return true;
+}
+
+int32_t
+decode_part_fd(int fd, const scanpart *part,
+               char **content, size_t *contentSize) {
+  /* パートの位置は元のファイル中のものなので、圧縮されたファイルからは
+   * 読まない */
+  if (isCompressedFile(fd)) {
+    return false;
+  }
+
+  return decode_range_fd(fd, part->bodyOffset, part->bodySize,
+                         part->transferEncoding, content, contentSize);
+}
+
+int32_t
+decode_part_mem(const char *data, size_t size, const scanpart *part,
+                char **content, size_t *contentSize) {
+  if (part->bodyOffset > size || size - part->bodyOffset < part->bodySize) {
+    return false;
+  }
+
+  return decodeSource(data + part->bodyOffset, part->bodySize,
+                      part->transferEncoding, content, contentSize);
+}
+
+int32_t
+save_part_index(const sfileinfo *info, const char *path,
+                int64_t sourceMtime) {
+  IndexWriter w;
+  w.data.append(INDEX_MAGIC, 8);
+  w.putUint(INDEX_VERSION, 4);
+  w.putUint(0, 4);
+  w.putUint(info->sourceSize, 8);
+  w.putUint(static_cast<uint64_t>(sourceMtime), 8);
+  w.putUint(static_cast<uint64_t>(info->startPart), 8);
+  w.putUint(info->partsCount, 8);
+  w.putString(info->subject);
+  w.putString(info->date);
+
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    const scanpart *p = &info->parts[i];
+    w.putUint(p->headerOffset, 8);
+    w.putUint(p->headerSize, 8);
+    w.putUint(p->bodyOffset, 8);
+    w.putUint(p->bodySize, 8);
+    w.putUint(static_cast<uint64_t>(p->parent), 8);
+    w.putUint(p->isMultipart ? 1 : 0, 4);
+    w.putString(p->mimetype);
+    w.putString(p->charset);
+    w.putString(p->cid);
+    w.putString(p->location);
+    w.putString(p->transferEncoding);
+  }
+
+  /* 書き込み途中のファイルを読まないように、一時ファイルに書いてから
+   * 置き換える
+   * 同時に保存しても互いの一時ファイルを上書きしないように名前を変える */
+  std::string tmpPath = std::string(path) + ".XXXXXX";
+  std::vector<char> tmpl(tmpPath.begin(), tmpPath.end());
+  tmpl.push_back('\0');
+  int fd = mkstemp(tmpl.data());
+  if (fd == -1) {
+    return false;
+  }
+
+  bool succeeded = fchmod(fd, 0644) == 0
+    && writeFully(fd, w.data.data(), w.data.size());
+  if (close(fd) == -1) {
+    succeeded = false;
+  }
+
+  if (!succeeded || rename(tmpl.data(), path) == -1) {
+    unlink(tmpl.data());
+    return false;
+  }
+
+  return true;
+}
+
+sfileinfo *
+load_part_index(const char *path, uint64_t sourceSize, int64_t sourceMtime) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = st.st_size;
+  char *data = reinterpret_cast<char *>(malloc(size + 1));
+  if (data == NULL || !readFully(fd, data, size, 0)) {
+    free(data);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  IndexReader r;
+  r.data = data;
+  r.size = size;
+  r.pos = 0;
+  r.ok = true;
+
+  if (size < 8 || memcmp(data, INDEX_MAGIC, 8) != 0) {
+    free(data);
+    return NULL;
+  }
+  r.pos = 8;
+
+  uint64_t version = r.getUint(4);
+  r.getUint(4);
+  uint64_t savedSourceSize = r.getUint(8);
+  int64_t savedSourceMtime = static_cast<int64_t>(r.getUint(8));
+  int64_t startPart = static_cast<int64_t>(r.getUint(8));
+  uint64_t partsCount = r.getUint(8);
+  if (!r.ok || version != INDEX_VERSION ||
+      savedSourceSize != sourceSize || savedSourceMtime != sourceMtime ||
+      startPart < -1) {
+    free(data);
+    return NULL;
+  }
+
+  /* 壊れたファイルで巨大な領域を確保しないように、パートの数を
+   * 残りの長さで制限する
+   * 1 つのパートは少なくとも 64 バイト */
+  if (partsCount > (size - r.pos) / 64) {
+    free(data);
+    return NULL;
+  }
+
+  sfileinfo *info = reinterpret_cast<sfileinfo *>(malloc(sizeof(sfileinfo)));
+  if (info == NULL) {
+    free(data);
+    return NULL;
+  }
+  info->subject = r.getString();
+  info->date = r.getString();
+  info->startPart = startPart;
+  info->sourceSize = savedSourceSize;
+  info->partsCount = 0;
+  info->parts = reinterpret_cast<scanpart *>
+    (malloc(sizeof(scanpart) * (partsCount + 1)));
+  if (info->parts == NULL) {
+    r.ok = false;
+  }
+
+  for (size_t i = 0; r.ok && i < partsCount; i ++) {
+    scanpart *p = &info->parts[i];
+    p->headerOffset = r.getUint(8);
+    p->headerSize = r.getUint(8);
+    p->bodyOffset = r.getUint(8);
+    p->bodySize = r.getUint(8);
+    p->parent = static_cast<int64_t>(r.getUint(8));
+    p->isMultipart = r.getUint(4) != 0;
+    p->mimetype = r.getString();
+    p->charset = r.getString();
+    p->cid = r.getString();
+    p->location = r.getString();
+    p->transferEncoding = r.getString();
+    info->partsCount ++;
+
+    if (p->bodyOffset > sourceSize ||
+        sourceSize - p->bodyOffset < p->bodySize ||
+        p->parent < -1 || p->parent >= static_cast<int64_t>(i)) {
+      r.ok = false;
+    }
+  }
+
+  free(data);
+
+  if (!r.ok || startPart >= static_cast<int64_t>(partsCount)) {
+    delete_sfileinfo(info);
+    return NULL;
+  }
+
+  return info;
+}
+
+}
@@ -0,0 +1,151 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __partindex_h_included__
+#define __partindex_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "scan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ファイル中の範囲を読み込んでデコードする
+ * ファイル全体は読み込まずに、必要な範囲のみを pread で読み込む
+ *
+ * @param   fd
+ *          MHT ファイルのファイル記述子
+ * @param   bodyOffset
+ *          エンコードされたボディの位置
+ * @param   bodySize
+ *          エンコードされたボディの長さ
+ * @param   transferEncoding
+ *          Content-Transfer-Encoding の値
+ * @param   content
+ *          (出力) デコードしたボディ
+ *          不要になったら free で開放する
+ * @param   contentSize
+ *          (出力) デコードしたボディの長さ
+ * @returns 成功したか
+ */
+int32_t
+decode_range_fd(int fd, uint64_t bodyOffset, size_t bodySize,
+                const char *transferEncoding,
+                char **content, size_t *contentSize);
+
+/**
+ * スキャンしたパートの 1 つをファイルから読み込んでデコードする
+ * 圧縮されたファイルならば失敗する
+ *
+ * @param   fd
+ *          MHT ファイルのファイル記述子
+ * @param   part
+ *          スキャンしたパート
+ * @param   content
+ *          (出力) デコードしたボディ
+ *          不要になったら free で開放する
+ * @param   contentSize
+ *          (出力) デコードしたボディの長さ
+ * @returns 成功したか
+ */
+int32_t
+decode_part_fd(int fd, const scanpart *part,
+               char **content, size_t *contentSize);
+
+/**
+ * スキャンしたパートの 1 つをメモリ上の MHT ファイルからデコードする
+ *
+ * @param   data
+ *          MHT ファイルの内容
+ * @param   size
+ *          MHT ファイルの長さ
+ * @param   part
+ *          スキャンしたパート
+ * @param   content
+ *          (出力) デコードしたボディ
+ *          不要になったら free で開放する
+ * @param   contentSize
+ *          (出力) デコードしたボディの長さ
+ * @returns 成功したか
+ */
+int32_t
+decode_part_mem(const char *data, size_t size, const scanpart *part,
+                char **content, size_t *contentSize);
+
+/**
+ * スキャン結果をインデックスファイルに保存する
+ * 次回はスキャンせずに load_part_index で読み込める
+ *
+ * @param   info
+ *          MHT ファイルのスキャン結果
+ * @param   path
+ *          インデックスファイルのパス
+ * @param   sourceMtime
+ *          MHT ファイルの最終更新時刻
+ *          load_part_index に渡す値と同じ単位で渡す
+ * @returns 成功したか
+ */
+int32_t
+save_part_index(const sfileinfo *info, const char *path,
+                int64_t sourceMtime);
+
+/**
+ * インデックスファイルからスキャン結果を読み込む
+ *
+ * @param   path
+ *          インデックスファイルのパス
+ * @param   sourceSize
+ *          現在の MHT ファイルの長さ
+ *          保存時の長さと異なる場合は読み込まない
+ * @param   sourceMtime
+ *          現在の MHT ファイルの最終更新時刻
+ *          保存時の時刻と異なる場合は読み込まない
+ *          長さが変わらない編集を検出できるように、ナノ秒単位を勧める
+ * @returns MHT ファイルのスキャン結果
+ *          delete_sfileinfo で開放する
+ *          失敗したら NULL
+ */
+sfileinfo *
+load_part_index(const char *path, uint64_t sourceSize, int64_t sourceMtime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __partindex_h_included__ */
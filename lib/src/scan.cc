@@ -0,0 +1,698 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "scan.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "conv.h"
+#include "decode.h"
+#include "gunzip.h"
+
+/**
+ * multipart の入れ子の最大数
+ */
+#define MAX_DEPTH 32
+
+/**
+ * スキャンに必要なフィールド
+ */
+struct ScanFields {
+  std::string contentType;
+  std::string transferEncoding;
+  std::string contentID;
+  std::string contentLocation;
+  std::string subject;
+  std::string date;
+};
+
+/**
+ * 前後の空白を削除する
+ *
+ * @param   s
+ *          対象の文字列
+ * @returns 空白を削除した文字列
+ */
+static std::string
+trim(const std::string &s) {
+  size_t b = 0, e = s.size();
+  while (b < e && (s[b] == ' ' || s[b] == '\t')) {
+    b ++;
+  }
+  while (e > b && (s[e - 1] == ' ' || s[e - 1] == '\t')) {
+    e --;
+  }
+  return s.substr(b, e - b);
+}
+
+/**
+ * 小文字にする
+ *
+ * @param   s
+ *          対象の文字列
+ * @returns 小文字にした文字列
+ */
+static std::string
+toLower(const std::string &s) {
+  std::string ret(s);
+  for (size_t i = 0; i < ret.size(); i ++) {
+    ret[i] = tolower(static_cast<unsigned char>(ret[i]));
+  }
+  return ret;
+}
+
+/**
+ * malloc で文字列を複製する
+ *
+ * @param   s
+ *          対象の文字列
+ * @returns 複製した文字列
+ */
+static char *
+duplicate(const std::string &s) {
+  char *ret = reinterpret_cast<char *>(malloc(s.size() + 1));
+  memcpy(ret, s.c_str(), s.size() + 1);
+  return ret;
+}
+
+/**
+ * ヘッダを解析する
+ * 折り返しは解除する
+ *
+ * @param   data
+ *          ファイルの内容
+ * @param   begin
+ *          ヘッダの先頭
+ * @param   end
+ *          パートの末尾
+ * @param   fields
+ *          (出力) フィールド
+ * @returns ボディの先頭
+ */
+static size_t
+parseFields(const char *data, size_t begin, size_t end, ScanFields *fields) {
+  size_t pos = begin;
+
+  /* mbox 形式の区切り */
+  if (end - pos >= 5 && memcmp(data + pos, "From ", 5) == 0) {
+    const char *nl = reinterpret_cast<const char *>
+      (memchr(data + pos, '\n', end - pos));
+    pos = nl ? (nl - data) + 1 : end;
+  }
+
+  std::string *current = NULL;
+  while (pos < end) {
+    const char *nl = reinterpret_cast<const char *>
+      (memchr(data + pos, '\n', end - pos));
+    size_t lineEnd = nl ? (nl - data) : end;
+    size_t next = nl ? lineEnd + 1 : end;
+    size_t contentEnd = lineEnd;
+    if (contentEnd > pos && data[contentEnd - 1] == '\r') {
+      contentEnd --;
+    }
+
+    if (contentEnd == pos) {
+      /* 空行 */
+      return next;
+    }
+
+    if (data[pos] == ' ' || data[pos] == '\t') {
+      /* 折り返し */
+      if (current) {
+        current->append(data + pos, contentEnd - pos);
+      }
+      pos = next;
+      continue;
+    }
+
+    const char *colon = reinterpret_cast<const char *>
+      (memchr(data + pos, ':', contentEnd - pos));
+    if (colon == NULL) {
+      /* フィールドではない行からはボディとみなす */
+      return pos;
+    }
+
+    size_t nameLength = colon - (data + pos);
+    while (nameLength && (data[pos + nameLength - 1] == ' ' ||
+                          data[pos + nameLength - 1] == '\t')) {
+      nameLength --;
+    }
+    std::string name = toLower(std::string(data + pos, nameLength));
+    std::string value(colon + 1, (data + contentEnd) - (colon + 1));
+
+    current = NULL;
+    if (name == "content-type") {
+      current = &fields->contentType;
+    } else if (name == "content-transfer-encoding") {
+      current = &fields->transferEncoding;
+    } else if (name == "content-id") {
+      current = &fields->contentID;
+    } else if (name == "content-location") {
+      current = &fields->contentLocation;
+    } else if (name == "subject") {
+      current = &fields->subject;
+    } else if (name == "date") {
+      current = &fields->date;
+    }
+    if (current) {
+      *current = value;
+    }
+
+    pos = next;
+  }
+
+  return end;
+}
+
+/**
+ * Content-Type 等のパラメータを取得する
+ *
+ * @param   value
+ *          フィールドの値
+ * @param   name
+ *          取得するパラメータの名前 (小文字)
+ * @returns パラメータの値
+ *          無ければ空文字列
+ */
+static std::string
+getParam(const std::string &value, const char *name) {
+  size_t nameLength = strlen(name);
+  size_t pos = value.find(';');
+  while (pos != std::string::npos) {
+    pos ++;
+    while (pos < value.size() && isspace(static_cast<unsigned char>(value[pos]))) {
+      pos ++;
+    }
+    size_t eq = value.find('=', pos);
+    if (eq == std::string::npos) {
+      break;
+    }
+    std::string key = toLower(trim(value.substr(pos, eq - pos)));
+
+    size_t vpos = eq + 1;
+    while (vpos < value.size() && isspace(static_cast<unsigned char>(value[vpos]))) {
+      vpos ++;
+    }
+    std::string v;
+    size_t next;
+    if (vpos < value.size() && value[vpos] == '"') {
+      vpos ++;
+      while (vpos < value.size() && value[vpos] != '"') {
+        if (value[vpos] == '\\' && vpos + 1 < value.size()) {
+          vpos ++;
+        }
+        v += value[vpos];
+        vpos ++;
+      }
+      next = value.find(';', vpos);
+    } else {
+      next = value.find(';', vpos);
+      v = trim(value.substr(vpos, next == std::string::npos
+                            ? std::string::npos : next - vpos));
+    }
+
+    if (key.size() == nameLength && key == name) {
+      return v;
+    }
+    pos = next;
+  }
+
+  return "";
+}
+
+/**
+ * Content-Type の MIME-Type を取得する
+ *
+ * @param   value
+ *          Content-Type の値
+ * @returns 小文字の MIME-Type
+ */
+static std::string
+getMimetype(const std::string &value) {
+  size_t end = value.find(';');
+  return toLower(trim(value.substr(0, end)));
+}
+
+/**
+ * msg-id の <> と空白を削除する
+ *
+ * @param   value
+ *          Content-ID の値
+ * @returns 削除した値
+ */
+static std::string
+stripAngle(const std::string &value) {
+  std::string v = trim(value);
+  if (v.size() >= 2 && v[0] == '<' && v[v.size() - 1] == '>') {
+    v = v.substr(1, v.size() - 2);
+  }
+  return trim(v);
+}
+
+/**
+ * encoded-word[RFC2047] を含む文字列を UTF-8 にデコードする
+ *
+ * @param   value
+ *          対象の文字列
+ * @returns デコードした文字列
+ */
+static std::string
+decodeWords(const std::string &value) {
+  std::string ret;
+  size_t pos = 0;
+  bool lastDecoded = false;
+  std::string pendingSpace;
+
+  while (pos < value.size()) {
+    size_t start = value.find("=?", pos);
+    if (start == std::string::npos) {
+      ret += pendingSpace;
+      ret += value.substr(pos);
+      break;
+    }
+
+    std::string between = value.substr(pos, start - pos);
+    bool isSpace = between.find_first_not_of(" \t") == std::string::npos;
+
+    size_t q1 = value.find('?', start + 2);
+    size_t q2 = q1 == std::string::npos
+      ? std::string::npos : value.find('?', q1 + 1);
+    size_t close = q2 == std::string::npos
+      ? std::string::npos : value.find("?=", q2 + 1);
+    if (close == std::string::npos || q2 != q1 + 2) {
+      ret += between;
+      ret += "=?";
+      pos = start + 2;
+      lastDecoded = false;
+      continue;
+    }
+
+    std::string charset = value.substr(start + 2, q1 - start - 2);
+    size_t star = charset.find('*');
+    if (star != std::string::npos) {
+      /* RFC2231 の言語指定 */
+      charset = charset.substr(0, star);
+    }
+    char encoding = toupper(static_cast<unsigned char>(value[q1 + 1]));
+    std::string text = value.substr(q2 + 1, close - q2 - 1);
+
+    char *bytes = NULL;
+    size_t bytesSize = 0;
+    if (encoding == 'B') {
+      decodeBase64(text.data(), text.size(), &bytes, &bytesSize);
+    } else if (encoding == 'Q') {
+      for (size_t i = 0; i < text.size(); i ++) {
+        if (text[i] == '_') {
+          text[i] = ' ';
+        }
+      }
+      decodeQuotedPrintable(text.data(), text.size(), &bytes, &bytesSize);
+    }
+
+    char *utf8 = NULL;
+    size_t utf8Length = 0;
+    if (bytes && convertToUTF8(bytes, bytesSize, charset.c_str(),
+                               &utf8, &utf8Length)) {
+      /* encoded-word の間の空白は無視する */
+      if (!(lastDecoded && isSpace)) {
+        ret += between;
+      }
+      ret.append(utf8, utf8Length);
+      free(utf8);
+      lastDecoded = true;
+    } else {
+      ret += between;
+      ret += value.substr(start, close + 2 - start);
+      lastDecoded = false;
+    }
+    free(bytes);
+
+    pos = close + 2;
+  }
+
+  return ret;
+}
+
+/**
+ * バウンダリの区切りを探す
+ * 行頭にあり、直後が -- か、空白に続く改行かファイルの末尾であるものを
+ * 区切りとする
+ * 本文中の行がバウンダリで始まるだけの場合は区切りとしない
+ *
+ * @param   data
+ *          ファイルの内容
+ * @param   begin
+ *          探す範囲の先頭
+ * @param   end
+ *          探す範囲の末尾
+ * @param   dashBoundary
+ *          -- を付けたバウンダリ文字列
+ * @returns 見付かった位置
+ *          見付からなければ end
+ */
+static size_t
+findDelimiter(const char *data, size_t begin, size_t end,
+              const std::string &dashBoundary) {
+  size_t pos = begin;
+  while (pos + dashBoundary.size() <= end) {
+    const char *found = reinterpret_cast<const char *>
+      (memmem(data + pos, end - pos, dashBoundary.data(), dashBoundary.size()));
+    if (found == NULL) {
+      return end;
+    }
+    size_t at = found - data;
+    pos = at + 1;
+    if (at != begin && data[at - 1] != '\n') {
+      continue;
+    }
+
+    size_t after = at + dashBoundary.size();
+    if (after + 2 <= end && data[after] == '-' && data[after + 1] == '-') {
+      return at;
+    }
+    while (after < end && (data[after] == ' ' || data[after] == '\t')) {
+      after ++;
+    }
+    if (after < end && data[after] == '\r') {
+      after ++;
+    }
+    if (after == end || data[after] == '\n') {
+      return at;
+    }
+  }
+  return end;
+}
+
+/**
+ * スキャンの状態
+ */
+struct Scanner {
+  const char *data;
+  std::vector<scanpart> parts;
+  std::vector<std::string> startParams;
+  std::vector<std::string> typeParams;
+  std::string subject;
+  std::string date;
+};
+
+static void
+scanPart(Scanner *s, size_t begin, size_t end, int64_t parent, int depth);
+
+/**
+ * multipart のボディを各パートに分割してスキャンする
+ *
+ * @param   s
+ *          スキャンの状態
+ * @param   begin
+ *          ボディの先頭
+ * @param   end
+ *          ボディの末尾
+ * @param   boundary
+ *          バウンダリ文字列
+ * @param   parent
+ *          multipart のパートのインデックス
+ * @param   depth
+ *          入れ子の深さ
+ */
+static void
+scanMultipart(Scanner *s, size_t begin, size_t end,
+              const std::string &boundary, int64_t parent, int depth) {
+  const char *data = s->data;
+  std::string dashBoundary = "--" + boundary;
+
+  size_t pos = findDelimiter(data, begin, end, dashBoundary);
+  while (pos < end) {
+    /* バウンダリの行の残りを飛ばす */
+    size_t after = pos + dashBoundary.size();
+    if (after + 2 <= end && data[after] == '-' && data[after + 1] == '-') {
+      /* close-delimiter */
+      return;
+    }
+    const char *nl = reinterpret_cast<const char *>
+      (memchr(data + after, '\n', end - after));
+    if (nl == NULL) {
+      return;
+    }
+    size_t partBegin = (nl - data) + 1;
+
+    size_t next = findDelimiter(data, partBegin, end, dashBoundary);
+    size_t partEnd = next;
+    if (next < end) {
+      /* 区切りの直前の改行はバウンダリに含まれる */
+      if (partEnd > partBegin && data[partEnd - 1] == '\n') {
+        partEnd --;
+      }
+      if (partEnd > partBegin && data[partEnd - 1] == '\r') {
+        partEnd --;
+      }
+    }
+
+    scanPart(s, partBegin, partEnd, parent, depth + 1);
+
+    pos = next;
+  }
+}
+
+/**
+ * パートをスキャンする
+ *
+ * @param   s
+ *          スキャンの状態
+ * @param   begin
+ *          パートの先頭
+ * @param   end
+ *          パートの末尾
+ * @param   parent
+ *          親パートのインデックス
+ * @param   depth
+ *          入れ子の深さ
+ */
+static void
+scanPart(Scanner *s, size_t begin, size_t end, int64_t parent, int depth) {
+  ScanFields fields;
+  size_t bodyOffset = parseFields(s->data, begin, end, &fields);
+
+  scanpart part;
+  std::string mimetype = getMimetype(fields.contentType);
+  part.mimetype = duplicate(mimetype);
+  part.charset = duplicate(getParam(fields.contentType, "charset"));
+  part.cid = duplicate(stripAngle(fields.contentID));
+  part.location = duplicate(trim(fields.contentLocation));
+  part.transferEncoding = duplicate(toLower(trim(fields.transferEncoding)));
+  part.isMultipart = mimetype.compare(0, 10, "multipart/") == 0;
+  part.parent = parent;
+  part.headerOffset = begin;
+  part.headerSize = bodyOffset - begin;
+  part.bodyOffset = bodyOffset;
+  part.bodySize = end - bodyOffset;
+
+  int64_t index = s->parts.size();
+  s->parts.push_back(part);
+  s->startParams.push_back(stripAngle(getParam(fields.contentType, "start")));
+  s->typeParams.push_back(toLower(getParam(fields.contentType, "type")));
+
+  if (parent == -1) {
+    s->subject = fields.subject;
+    s->date = fields.date;
+  }
+
+  if (part.isMultipart && depth < MAX_DEPTH) {
+    std::string boundary = getParam(fields.contentType, "boundary");
+    if (!boundary.empty()) {
+      scanMultipart(s, bodyOffset, end, boundary, index, depth);
+    }
+  }
+}
+
+/**
+ * 開始パートを探す
+ * arMIMEPart.findStartPart と同じ規則
+ *
+ * @param   s
+ *          スキャンの状態
+ * @param   index
+ *          対象のパートのインデックス
+ * @returns 開始パートのインデックス
+ *          見付からなければ -1
+ */
+static int64_t
+findStartPart(const Scanner *s, int64_t index) {
+  const scanpart *part = &s->parts[index];
+  if (!part->isMultipart) {
+    return index;
+  }
+
+  std::string subtype = part->mimetype + 10;
+  if (subtype != "related" && subtype != "alternative") {
+    /* mixed 相当 */
+    return index;
+  }
+
+  std::vector<int64_t> children;
+  for (size_t i = index + 1; i < s->parts.size(); i ++) {
+    if (s->parts[i].parent == index) {
+      children.push_back(i);
+    }
+  }
+
+  const std::string &start = s->startParams[index];
+  if (!start.empty()) {
+    for (size_t i = 0; i < children.size(); i ++) {
+      if (start == s->parts[children[i]].cid) {
+        return findStartPart(s, children[i]);
+      }
+    }
+  }
+
+  if (subtype == "related") {
+    const std::string &type = s->typeParams[index];
+    for (size_t i = 0; i < children.size(); i ++) {
+      if (type == s->parts[children[i]].mimetype) {
+        return findStartPart(s, children[i]);
+      }
+    }
+  }
+
+  if (subtype == "alternative") {
+    static const char *types[] = { "text/html", "text/plain", NULL };
+    for (int t = 0; types[t]; t ++) {
+      for (size_t i = children.size(); i > 0; i --) {
+        int64_t start = findStartPart(s, children[i - 1]);
+        if (start != -1 && strcmp(s->parts[start].mimetype, types[t]) == 0) {
+          return start;
+        }
+      }
+    }
+  }
+
+  if (!children.empty()) {
+    return findStartPart(s, children[0]);
+  }
+
+  return -1;
+}
+
+extern "C" {
+
+sfileinfo *
+scan_parts(const char *data, size_t size) {
+  if (data == NULL) {
+    return NULL;
+  }
+
+  Scanner s;
+  s.data = data;
+
+  scanPart(&s, 0, size, -1, 0);
+
+  sfileinfo *info = reinterpret_cast<sfileinfo *>(malloc(sizeof(sfileinfo)));
+  info->subject = duplicate(decodeWords(trim(s.subject)));
+  info->date = duplicate(trim(s.date));
+  info->startPart = findStartPart(&s, 0);
+  info->partsCount = s.parts.size();
+  info->sourceSize = size;
+  info->parts = reinterpret_cast<scanpart *>
+    (malloc(sizeof(scanpart) * (info->partsCount + 1)));
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    info->parts[i] = s.parts[i];
+  }
+
+  return info;
+}
+
+sfileinfo *
+scan_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return scan_parts("", 0);
+  }
+
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  /* 位置は元のファイル中のものを返すので、圧縮されたファイルは扱わない */
+  if (isCompressed(reinterpret_cast<const char *>(map), size)) {
+    munmap(map, size);
+    return NULL;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  sfileinfo *info = scan_parts(reinterpret_cast<const char *>(map), size);
+
+  munmap(map, size);
+
+  return info;
+}
+
+void
+delete_sfileinfo(sfileinfo *info) {
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    scanpart *p = &info->parts[i];
+    free(p->mimetype);
+    free(p->charset);
+    free(p->cid);
+    free(p->location);
+    free(p->transferEncoding);
+  }
+  free(info->parts);
+  free(info->subject);
+  free(info->date);
+  free(info);
+}
+
+}
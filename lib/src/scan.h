@@ -0,0 +1,124 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __scan_h_included__
+#define __scan_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * スキャンしたパート
+ * ボディはデコードしない
+ */
+typedef struct {
+  char *mimetype;          /* Content-Type フィールドの MIME-Type (小文字)
+                            * フィールドが無ければ空文字列 */
+  char *charset;           /* Content-Type フィールドの charset */
+  char *cid;               /* Content-ID フィールド (<> を除く) */
+  char *location;          /* Content-Location フィールド */
+  char *transferEncoding;  /* Content-Transfer-Encoding フィールド (小文字) */
+
+  int32_t isMultipart;     /* multipart か */
+  int64_t parent;          /* 親パートのインデックス
+                            * トップレベルのパートは -1 */
+
+  uint64_t headerOffset;   /* ファイル中のヘッダの位置 */
+  size_t headerSize;       /* ヘッダの長さ (空行を含む) */
+  uint64_t bodyOffset;     /* ファイル中のエンコードされたボディの位置 */
+  size_t bodySize;         /* エンコードされたボディの長さ */
+} scanpart;
+
+/**
+ * MHT ファイルのスキャン結果
+ */
+typedef struct {
+  char *subject;       /* Subject フィールド (UTF-8 にデコード済み) */
+  char *date;          /* Date フィールド */
+
+  int64_t startPart;   /* 開始パートのインデックス
+                        * 見付からなければ -1 */
+
+  scanpart *parts;     /* パート
+                        * 親パートが子パートより先に並ぶ */
+  size_t partsCount;   /* パートの数 */
+
+  uint64_t sourceSize; /* スキャンしたファイルの長さ */
+} sfileinfo;
+
+/**
+ * MHT ファイルのヘッダとバウンダリのみを解析する
+ * ボディのデコードや参照の書き換えは行わない
+ *
+ * @param   data
+ *          MHT ファイルの内容
+ * @param   size
+ *          MHT ファイルの長さ
+ * @returns MHT ファイルのスキャン結果
+ *          失敗したら NULL
+ */
+sfileinfo *
+scan_parts(const char *data, size_t size);
+
+/**
+ * MHT ファイルをマップしてヘッダとバウンダリのみを解析する
+ * パートの位置をファイル中の位置とするので、圧縮されたファイルは扱わない
+ *
+ * @param   path
+ *          MHT ファイルのパス
+ * @returns MHT ファイルのスキャン結果
+ *          失敗したか圧縮されたファイルならば NULL
+ */
+sfileinfo *
+scan_file(const char *path);
+
+/**
+ * MHT ファイルのスキャン結果を開放する
+ *
+ * @param   info
+ *          MHT ファイルのスキャン結果
+ */
+void
+delete_sfileinfo(sfileinfo *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __scan_h_included__ */
@@ -0,0 +1,879 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "searchindex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "conv.h"
+#include "htmltext.h"
+#include "spill.h"
+#include "ThreadPool.hh"
+#include "unmht.h"
+
+/**
+ * 索引のファイルの識別子
+ */
+#define INDEX_MAGIC "UNMHTIDX"
+
+/**
+ * 索引のファイルの形式の版
+ */
+#define INDEX_VERSION 1
+
+/**
+ * 語の最大の長さ (バイト)
+ * 長い語は切り詰める
+ */
+#define MAX_TERM_SIZE 64
+
+/**
+ * 索引のファイルのヘッダ
+ * 数値はマシンのバイト順で書き出す
+ */
+struct IndexHeader {
+  char magic[8];           /* INDEX_MAGIC */
+  uint32_t version;        /* INDEX_VERSION */
+  uint32_t docCount;       /* 文書の数 */
+  uint64_t termCount;      /* 語の数 */
+  uint64_t docsOffset;     /* 文書の一覧の位置 */
+  uint64_t termsOffset;    /* 語の辞書の位置 */
+  uint64_t stringsOffset;  /* パスと語の文字列の位置 */
+  uint64_t stringsSize;    /* パスと語の文字列の長さ */
+  uint64_t postingsOffset; /* 出現リストの位置 */
+  uint64_t postingsSize;   /* 出現リストの長さ */
+};
+
+/**
+ * 索引のファイルの文書
+ */
+struct IndexDoc {
+  uint64_t path;     /* パスの文字列の位置 (NUL で終端する) */
+  uint64_t pathSize; /* パスの長さ */
+  int64_t mtime;     /* ファイルの更新日時 */
+  uint64_t size;     /* ファイルの長さ */
+};
+
+/**
+ * 索引のファイルの語
+ * 語の文字列の順にソートする
+ */
+struct IndexTerm {
+  uint64_t term;         /* 語の文字列の位置 (NUL で終端する) */
+  uint32_t termSize;     /* 語の長さ */
+  uint32_t docCount;     /* 語を含む文書の数 */
+  uint64_t postings;     /* 出現リストの位置 */
+  uint64_t postingsSize; /* 出現リストの長さ */
+};
+
+struct searchindex {
+  const char *map;          /* マップした内容 */
+  size_t size;              /* ファイルの長さ */
+  const IndexHeader *header;
+  const IndexDoc *docs;
+  const IndexTerm *terms;
+  const char *strings;
+  const unsigned char *postings;
+};
+
+/**
+ * 索引に加える文書
+ */
+struct DocEntry {
+  std::string path;               /* ファイルのパス */
+  int64_t mtime;                  /* ファイルの更新日時 */
+  uint64_t size;                  /* ファイルの長さ */
+  int64_t oldId;                  /* 元の索引での番号
+                                   * 展開し直す場合は -1 */
+  std::vector<std::string> terms; /* 含む語 (展開した場合のみ) */
+};
+
+/**
+ * 文字の種類
+ */
+enum CharKind {
+  CHAR_SEPARATOR, /* 区切り */
+  CHAR_WORD,      /* 英数字等、並びを 1 つの語とする文字 */
+  CHAR_CJK        /* CJK 等、2 文字ずつの組を語とする文字 */
+};
+
+/**
+ * 文字の種類を調べる
+ *
+ * @param   c
+ *          文字のコードポイント
+ * @returns 文字の種類
+ */
+static CharKind
+classifyChar(uint32_t c) {
+  if (c < 0x80) {
+    if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+        (c >= 'A' && c <= 'Z')) {
+      return CHAR_WORD;
+    }
+    return CHAR_SEPARATOR;
+  }
+  if (c < 0xc0 ||                       /* Latin-1 の記号 */
+      (c >= 0x2000 && c <= 0x206f) ||   /* 一般句読点 */
+      (c >= 0x3000 && c <= 0x303f) ||   /* CJK の記号と句読点 */
+      (c >= 0xff00 && c <= 0xff0f) ||   /* 全角の記号 */
+      (c >= 0xff1a && c <= 0xff20) ||
+      (c >= 0xff3b && c <= 0xff40) ||
+      (c >= 0xff5b && c <= 0xff65) ||
+      c == 0xfeff) {
+    return CHAR_SEPARATOR;
+  }
+  if (c >= 0x2e80) {
+    return CHAR_CJK;
+  }
+  return CHAR_WORD;
+}
+
+/**
+ * UTF-8 の文字を 1 つ読む
+ *
+ * @param   p
+ *          文字の先頭
+ * @param   end
+ *          文字列の末尾
+ * @param   length
+ *          (出力) 文字のバイト数
+ * @returns 文字のコードポイント
+ *          不正ならば区切りとして扱う 0
+ */
+static uint32_t
+readChar(const unsigned char *p, const unsigned char *end, size_t *length) {
+  unsigned char c = *p;
+  size_t n;
+  uint32_t code;
+  if (c < 0x80) {
+    *length = 1;
+    return c;
+  } else if ((c & 0xe0) == 0xc0) {
+    n = 2;
+    code = c & 0x1f;
+  } else if ((c & 0xf0) == 0xe0) {
+    n = 3;
+    code = c & 0x0f;
+  } else if ((c & 0xf8) == 0xf0) {
+    n = 4;
+    code = c & 0x07;
+  } else {
+    *length = 1;
+    return 0;
+  }
+
+  if (static_cast<size_t>(end - p) < n) {
+    *length = 1;
+    return 0;
+  }
+  for (size_t i = 1; i < n; i ++) {
+    if ((p[i] & 0xc0) != 0x80) {
+      *length = 1;
+      return 0;
+    }
+    code = (code << 6) | (p[i] & 0x3f);
+  }
+
+  *length = n;
+  return code;
+}
+
+/**
+ * 文字列を語に分ける
+ * CJK 等の文字の並びは、文書では 1 文字ずつと 2 文字ずつの組の両方を、
+ * 検索では 2 文字ずつの組のみ (1 文字ならば 1 文字) を語とする
+ *
+ * @param   text
+ *          文字列 (UTF-8)
+ * @param   size
+ *          文字列の長さ
+ * @param   query
+ *          検索する文字列か
+ * @param   terms
+ *          (出力) 語 (重複を含む)
+ */
+static void
+tokenize(const char *text, size_t size, bool query,
+         std::vector<std::string> *terms) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(text);
+  const unsigned char *end = p + size;
+
+  std::string word;
+  const unsigned char *prev = NULL; /* CJK の並びの直前の文字 */
+  size_t prevLength = 0;
+  size_t runLength = 0;             /* CJK の並びの文字数 */
+
+  while (p <= end) {
+    size_t length = 0;
+    CharKind kind = CHAR_SEPARATOR;
+    if (p < end) {
+      kind = classifyChar(readChar(p, end, &length));
+    }
+
+    if (kind != CHAR_WORD && !word.empty()) {
+      terms->push_back(word);
+      word.clear();
+    }
+    if (kind != CHAR_CJK && runLength > 0) {
+      if (query && runLength == 1) {
+        terms->push_back(std::string(reinterpret_cast<const char *>(prev),
+                                     prevLength));
+      }
+      runLength = 0;
+      prev = NULL;
+    }
+
+    if (p == end) {
+      break;
+    }
+
+    if (kind == CHAR_WORD) {
+      if (word.size() + length <= MAX_TERM_SIZE) {
+        for (size_t i = 0; i < length; i ++) {
+          char c = p[i];
+          if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+          }
+          word += c;
+        }
+      }
+    } else if (kind == CHAR_CJK) {
+      if (!query) {
+        terms->push_back(std::string(reinterpret_cast<const char *>(p),
+                                     length));
+      }
+      if (prev) {
+        terms->push_back(std::string(reinterpret_cast<const char *>(prev),
+                                     prevLength + length));
+      }
+      prev = p;
+      prevLength = length;
+      runLength ++;
+    }
+
+    p += length;
+  }
+}
+
+/**
+ * 語の重複を除いてソートする
+ *
+ * @param   terms
+ *          (入出力) 語
+ */
+static void
+uniqueTerms(std::vector<std::string> *terms) {
+  std::sort(terms->begin(), terms->end());
+  terms->erase(std::unique(terms->begin(), terms->end()), terms->end());
+}
+
+/**
+ * 索引に加えるパートか
+ *
+ * @param   part
+ *          パート
+ * @param   html
+ *          (出力) HTML か
+ * @returns テキストか HTML か
+ */
+static bool
+isTextPart(const mimepart *part, bool *html) {
+  if (part->mimetype == NULL || part->content == NULL ||
+      (part->contentStorage != CONTENT_STORAGE_OWNED &&
+       part->contentStorage != CONTENT_STORAGE_MAPPED)) {
+    return false;
+  }
+  *html = strcasecmp(part->mimetype, "text/html") == 0 ||
+    strcasecmp(part->mimetype, "application/xhtml+xml") == 0;
+  return *html || strncasecmp(part->mimetype, "text/", 5) == 0;
+}
+
+/**
+ * MHT ファイルの展開情報から語を集める
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ * @param   terms
+ *          (出力) 語 (重複を除いてソートする)
+ */
+static void
+gatherTerms(const efileinfo *info, std::vector<std::string> *terms) {
+  if (info->subject) {
+    tokenize(info->subject, strlen(info->subject), false, terms);
+  }
+
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    const mimepart *part = info->parts[i];
+    bool html;
+    if (!isTextPart(part, &html)) {
+      continue;
+    }
+
+    char *utf8 = NULL;
+    size_t utf8Size = 0;
+    if (!convertToUTF8(part->content, part->contentSize, part->charset,
+                       &utf8, &utf8Size)) {
+      continue;
+    }
+
+    if (html) {
+      char *text = NULL;
+      size_t textSize = 0;
+      if (html_to_text(utf8, utf8Size, &text, &textSize)) {
+        tokenize(text, textSize, false, terms);
+        free(text);
+      }
+    } else {
+      tokenize(utf8, utf8Size, false, terms);
+    }
+    free(utf8);
+  }
+
+  uniqueTerms(terms);
+}
+
+/**
+ * 可変長整数 (下位 7 ビットずつ) を追加する
+ *
+ * @param   value
+ *          値
+ * @param   out
+ *          (出力) 追加する先
+ */
+static void
+appendVarint(uint64_t value, std::string *out) {
+  while (value >= 0x80) {
+    *out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  *out += static_cast<char>(value);
+}
+
+/**
+ * 出現リストを読む
+ *
+ * @param   index
+ *          全文検索の索引
+ * @param   term
+ *          語
+ * @param   docs
+ *          (出力) 文書の番号 (昇順)
+ * @returns 成功したか
+ */
+static bool
+readPostings(const searchindex *index, const IndexTerm &term,
+             std::vector<uint32_t> *docs) {
+  const unsigned char *p = index->postings + term.postings;
+  const unsigned char *end = p + term.postingsSize;
+
+  docs->clear();
+  docs->reserve(term.docCount);
+  uint64_t doc = 0;
+  while (p < end) {
+    uint64_t delta = 0;
+    int shift = 0;
+    for (;;) {
+      if (p == end || shift > 63) {
+        return false;
+      }
+      unsigned char c = *p ++;
+      delta |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if (!(c & 0x80)) {
+        break;
+      }
+      shift += 7;
+    }
+    doc += delta;
+    if (doc >= index->header->docCount) {
+      return false;
+    }
+    docs->push_back(static_cast<uint32_t>(doc));
+  }
+
+  return true;
+}
+
+/**
+ * 語を辞書から探す
+ *
+ * @param   index
+ *          全文検索の索引
+ * @param   term
+ *          語
+ * @returns 辞書の語
+ *          無ければ NULL
+ */
+static const IndexTerm *
+findTerm(const searchindex *index, const std::string &term) {
+  size_t low = 0, high = index->header->termCount;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const IndexTerm &t = index->terms[mid];
+    int c = memcmp(index->strings + t.term, term.data(),
+                   std::min<size_t>(t.termSize, term.size()));
+    if (c == 0) {
+      c = t.termSize < term.size() ? -1 : t.termSize > term.size() ? 1 : 0;
+    }
+    if (c == 0) {
+      return &t;
+    }
+    if (c < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * 索引を一時ファイルに書き出してから置き換える
+ *
+ * @param   indexPath
+ *          索引のファイルのパス
+ * @param   docs
+ *          文書
+ * @param   postings
+ *          語毎の文書の番号 (昇順)
+ * @returns 成功したか
+ */
+static bool
+writeIndex(const char *indexPath, const std::vector<DocEntry> &docs,
+           const std::map<std::string, std::vector<uint32_t> > &postings) {
+  std::string strings;
+  std::vector<IndexDoc> docTable(docs.size());
+  for (size_t i = 0; i < docs.size(); i ++) {
+    docTable[i].path = strings.size();
+    docTable[i].pathSize = docs[i].path.size();
+    docTable[i].mtime = docs[i].mtime;
+    docTable[i].size = docs[i].size;
+    strings.append(docs[i].path.c_str(), docs[i].path.size() + 1);
+  }
+
+  std::string postingData;
+  std::vector<IndexTerm> termTable;
+  termTable.reserve(postings.size());
+  for (auto it = postings.begin(); it != postings.end(); ++ it) {
+    IndexTerm term;
+    term.term = strings.size();
+    term.termSize = it->first.size();
+    term.docCount = it->second.size();
+    term.postings = postingData.size();
+    strings.append(it->first.c_str(), it->first.size() + 1);
+
+    uint32_t prev = 0;
+    for (size_t i = 0; i < it->second.size(); i ++) {
+      appendVarint(it->second[i] - prev, &postingData);
+      prev = it->second[i];
+    }
+    term.postingsSize = postingData.size() - term.postings;
+    termTable.push_back(term);
+  }
+
+  IndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.version = INDEX_VERSION;
+  header.docCount = docTable.size();
+  header.termCount = termTable.size();
+  header.docsOffset = sizeof(IndexHeader);
+  header.termsOffset = header.docsOffset + sizeof(IndexDoc) * docTable.size();
+  header.stringsOffset
+    = header.termsOffset + sizeof(IndexTerm) * termTable.size();
+  header.stringsSize = strings.size();
+  header.postingsOffset = header.stringsOffset + header.stringsSize;
+  header.postingsSize = postingData.size();
+
+  std::string tmpPath = std::string(indexPath) + ".XXXXXX";
+  std::vector<char> tmpl(tmpPath.begin(), tmpPath.end());
+  tmpl.push_back('\0');
+  int fd = mkstemp(tmpl.data());
+  if (fd == -1) {
+    return false;
+  }
+
+  bool result = fchmod(fd, 0644) == 0
+    && writeFully(fd, reinterpret_cast<const char *>(&header), sizeof(header))
+    && writeFully(fd, reinterpret_cast<const char *>(docTable.data()),
+                  sizeof(IndexDoc) * docTable.size())
+    && writeFully(fd, reinterpret_cast<const char *>(termTable.data()),
+                  sizeof(IndexTerm) * termTable.size())
+    && writeFully(fd, strings.data(), strings.size())
+    && writeFully(fd, postingData.data(), postingData.size());
+  if (close(fd) == -1) {
+    result = false;
+  }
+
+  if (!result || rename(tmpl.data(), indexPath) == -1) {
+    unlink(tmpl.data());
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * 索引のファイルの部分がファイルに収まるか
+ *
+ * @param   offset
+ *          部分の位置
+ * @param   length
+ *          部分の長さ
+ * @param   size
+ *          ファイルの長さ
+ * @returns 収まるか
+ */
+static bool
+isInFile(uint64_t offset, uint64_t length, size_t size) {
+  return offset <= size && length <= size - offset;
+}
+
+extern "C" {
+
+int32_t
+update_searchindex(const char *indexPath,
+                   const char *const *paths, size_t count,
+                   const char *script, size_t *extracted) {
+  /* 元の索引の文書と新しいファイルを合わせた一覧を作る */
+  std::vector<DocEntry> candidates;
+  std::unordered_map<std::string, size_t> known;
+  searchindex *old = open_searchindex(indexPath);
+  if (old) {
+    for (uint32_t i = 0; i < old->header->docCount; i ++) {
+      DocEntry entry;
+      entry.path = old->strings + old->docs[i].path;
+      entry.mtime = old->docs[i].mtime;
+      entry.size = old->docs[i].size;
+      entry.oldId = i;
+      known[entry.path] = candidates.size();
+      candidates.push_back(entry);
+    }
+  }
+  for (size_t i = 0; i < count; i ++) {
+    if (known.find(paths[i]) != known.end()) {
+      continue;
+    }
+    DocEntry entry;
+    entry.path = paths[i];
+    entry.mtime = 0;
+    entry.size = 0;
+    entry.oldId = -1;
+    known[entry.path] = candidates.size();
+    candidates.push_back(entry);
+  }
+
+  /* 変わっていない文書を先に、展開する文書を後に並べる
+   * 元の索引の出現リストは番号を付け替えるだけで昇順のまま使える */
+  std::vector<DocEntry> docs;
+  std::vector<size_t> jobs;
+  std::vector<int64_t> oldToNew(old ? old->header->docCount : 0, -1);
+  for (size_t pass = 0; pass < 2; pass ++) {
+    for (size_t i = 0; i < candidates.size(); i ++) {
+      DocEntry &entry = candidates[i];
+      struct stat st;
+      if (stat(entry.path.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      bool unchanged = entry.oldId != -1 &&
+        entry.mtime == static_cast<int64_t>(st.st_mtime) &&
+        entry.size == static_cast<uint64_t>(st.st_size);
+      if (unchanged != (pass == 0)) {
+        continue;
+      }
+
+      if (unchanged) {
+        oldToNew[entry.oldId] = docs.size();
+      } else {
+        entry.oldId = -1;
+        entry.mtime = st.st_mtime;
+        entry.size = st.st_size;
+        jobs.push_back(docs.size());
+      }
+      docs.push_back(entry);
+    }
+  }
+
+  /* 展開は専用のスレッドで並列に行う
+   * 各スレッドは自身の JavaScript の実行環境を持つ */
+  size_t threadCount = 1;
+  std::shared_ptr<ThreadPool> pool = ThreadPool::shared();
+  if (pool) {
+    threadCount = pool->size();
+  }
+  if (threadCount > jobs.size()) {
+    threadCount = jobs.size();
+  }
+
+  std::atomic<size_t> nextJob(0);
+  auto worker = [&docs, &jobs, &nextJob, script]() {
+    for (;;) {
+      size_t j = nextJob ++;
+      if (j >= jobs.size()) {
+        return;
+      }
+      /* 展開に失敗したファイルも語の無い文書として残し、
+       * 変更されるまで展開し直さない */
+      DocEntry &entry = docs[jobs[j]];
+      efileinfo *info = extract_file(entry.path.c_str(), script, true);
+      if (info) {
+        gatherTerms(info, &entry.terms);
+        delete_efileinfo(info);
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i ++) {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t i = 0; i < threads.size(); i ++) {
+    threads[i].join();
+  }
+
+  /* 出現リストを組み立てる */
+  std::map<std::string, std::vector<uint32_t> > postings;
+  bool result = true;
+  if (old) {
+    std::vector<uint32_t> oldDocs;
+    for (uint64_t i = 0; i < old->header->termCount; i ++) {
+      const IndexTerm &term = old->terms[i];
+      if (!readPostings(old, term, &oldDocs)) {
+        result = false;
+        break;
+      }
+
+      std::vector<uint32_t> newDocs;
+      for (size_t j = 0; j < oldDocs.size(); j ++) {
+        if (oldToNew[oldDocs[j]] != -1) {
+          newDocs.push_back(oldToNew[oldDocs[j]]);
+        }
+      }
+      if (!newDocs.empty()) {
+        postings[std::string(old->strings + term.term, term.termSize)]
+          .swap(newDocs);
+      }
+    }
+    close_searchindex(old);
+  }
+  for (size_t j = 0; j < jobs.size(); j ++) {
+    DocEntry &entry = docs[jobs[j]];
+    for (size_t k = 0; k < entry.terms.size(); k ++) {
+      postings[entry.terms[k]].push_back(jobs[j]);
+    }
+    std::vector<std::string>().swap(entry.terms);
+  }
+
+  if (extracted) {
+    *extracted = jobs.size();
+  }
+
+  return result && writeIndex(indexPath, docs, postings);
+}
+
+searchindex *
+open_searchindex(const char *indexPath) {
+  int fd = open(indexPath, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      static_cast<size_t>(st.st_size) < sizeof(IndexHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  const char *data = reinterpret_cast<const char *>(map);
+  const IndexHeader *header = reinterpret_cast<const IndexHeader *>(data);
+  /* 各部分がファイルに収まることを確かめてから、並びを確かめる
+   * 語の数は先に制限するので、長さの計算は桁あふれしない */
+  if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != INDEX_VERSION ||
+      header->termCount > size / sizeof(IndexTerm) ||
+      !isInFile(header->docsOffset,
+                sizeof(IndexDoc) * static_cast<uint64_t>(header->docCount),
+                size) ||
+      !isInFile(header->termsOffset,
+                sizeof(IndexTerm) * header->termCount, size) ||
+      !isInFile(header->stringsOffset, header->stringsSize, size) ||
+      !isInFile(header->postingsOffset, header->postingsSize, size) ||
+      header->docsOffset != sizeof(IndexHeader) ||
+      header->termsOffset
+      != header->docsOffset + sizeof(IndexDoc) * header->docCount ||
+      header->stringsOffset
+      != header->termsOffset + sizeof(IndexTerm) * header->termCount ||
+      header->postingsOffset != header->stringsOffset + header->stringsSize ||
+      header->postingsSize != size - header->postingsOffset) {
+    munmap(map, size);
+    return NULL;
+  }
+
+  searchindex *index = new searchindex();
+  index->map = data;
+  index->size = size;
+  index->header = header;
+  index->docs = reinterpret_cast<const IndexDoc *>(data + header->docsOffset);
+  index->terms
+    = reinterpret_cast<const IndexTerm *>(data + header->termsOffset);
+  index->strings = data + header->stringsOffset;
+  index->postings = reinterpret_cast<const unsigned char *>(data)
+    + header->postingsOffset;
+
+  /* 文字列と出現リストの範囲を確かめる */
+  for (uint32_t i = 0; i < header->docCount; i ++) {
+    const IndexDoc &doc = index->docs[i];
+    if (doc.path >= header->stringsSize ||
+        doc.pathSize >= header->stringsSize - doc.path ||
+        index->strings[doc.path + doc.pathSize] != '\0') {
+      close_searchindex(index);
+      return NULL;
+    }
+  }
+  for (uint64_t i = 0; i < header->termCount; i ++) {
+    const IndexTerm &term = index->terms[i];
+    if (term.term >= header->stringsSize ||
+        term.termSize >= header->stringsSize - term.term ||
+        term.postings > header->postingsSize ||
+        term.postingsSize > header->postingsSize - term.postings) {
+      close_searchindex(index);
+      return NULL;
+    }
+  }
+
+  return index;
+}
+
+size_t
+count_searchindex(const searchindex *index) {
+  return index->header->docCount;
+}
+
+int32_t
+query_searchindex(const searchindex *index, const char *query,
+                  uint32_t **docs, size_t *docsCount) {
+  *docs = NULL;
+  *docsCount = 0;
+
+  std::vector<std::string> words;
+  tokenize(query, strlen(query), true, &words);
+  uniqueTerms(&words);
+  if (words.empty()) {
+    return true;
+  }
+
+  /* 文書の少ない語から絞り込む */
+  std::vector<const IndexTerm *> terms;
+  for (size_t i = 0; i < words.size(); i ++) {
+    const IndexTerm *term = findTerm(index, words[i]);
+    if (term == NULL) {
+      return true;
+    }
+    terms.push_back(term);
+  }
+  std::sort(terms.begin(), terms.end(),
+            [](const IndexTerm *a, const IndexTerm *b) {
+              return a->docCount < b->docCount;
+            });
+
+  std::vector<uint32_t> result, other, merged;
+  if (!readPostings(index, *terms[0], &result)) {
+    return false;
+  }
+  for (size_t i = 1; i < terms.size() && !result.empty(); i ++) {
+    if (!readPostings(index, *terms[i], &other)) {
+      return false;
+    }
+    merged.clear();
+    std::set_intersection(result.begin(), result.end(),
+                          other.begin(), other.end(),
+                          std::back_inserter(merged));
+    result.swap(merged);
+  }
+
+  if (result.empty()) {
+    return true;
+  }
+
+  *docs = reinterpret_cast<uint32_t *>(malloc(sizeof(uint32_t)
+                                              * result.size()));
+  if (*docs == NULL) {
+    return false;
+  }
+  memcpy(*docs, result.data(), sizeof(uint32_t) * result.size());
+  *docsCount = result.size();
+
+  return true;
+}
+
+const char *
+lookup_searchindex(const searchindex *index, uint32_t doc) {
+  if (doc >= index->header->docCount) {
+    return NULL;
+  }
+  return index->strings + index->docs[doc].path;
+}
+
+void
+close_searchindex(searchindex *index) {
+  munmap(const_cast<char *>(index->map), index->size);
+  delete index;
+}
+
+}
@@ -0,0 +1,150 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __searchindex_h_included__
+#define __searchindex_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 全文検索の索引
+ *
+ * 索引は 1 つのファイルで、文書の一覧と、ソートした語の辞書と、
+ * 語毎に文書番号の差分を可変長整数で並べた出現リストからなる
+ * 語は ASCII の英数字の並びを小文字にしたものと、
+ * CJK 等の文字の並びの 2 文字ずつの組 (bigram) とする
+ */
+typedef struct searchindex searchindex;
+
+/**
+ * 索引を更新する
+ * 索引の文書と paths のファイルのうち、
+ * 更新日時と長さが変わったファイルと新しいファイルのみを展開して索引に加える
+ * 存在しなくなったファイルは索引から除く
+ * Subject と、テキストと HTML のパートの内容を索引に加える
+ * 新しい索引は一時ファイルに書き出してから置き換える
+ *
+ * @param   indexPath
+ *          索引のファイルのパス
+ *          無ければ作成する
+ * @param   paths
+ *          索引に加える MHT ファイルのパス
+ * @param   count
+ *          paths の数
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   extracted
+ *          (出力) 展開したファイルの数
+ *          不要ならば NULL
+ * @returns 成功したか
+ */
+int32_t
+update_searchindex(const char *indexPath,
+                   const char *const *paths, size_t count,
+                   const char *script, size_t *extracted);
+
+/**
+ * 索引をマップして開く
+ *
+ * @param   indexPath
+ *          索引のファイルのパス
+ * @returns 全文検索の索引
+ *          失敗したら NULL
+ */
+searchindex *
+open_searchindex(const char *indexPath);
+
+/**
+ * 文書の数を取得する
+ *
+ * @param   index
+ *          全文検索の索引
+ * @returns 文書の数
+ */
+size_t
+count_searchindex(const searchindex *index);
+
+/**
+ * 全ての語を含む文書を検索する
+ *
+ * @param   index
+ *          全文検索の索引
+ * @param   query
+ *          検索する文字列 (UTF-8)
+ *          索引と同じ方法で語に分ける
+ * @param   docs
+ *          (出力) 見つかった文書の番号 (昇順)
+ *          free で開放する
+ * @param   docsCount
+ *          (出力) 見つかった文書の数
+ * @returns 成功したか
+ */
+int32_t
+query_searchindex(const searchindex *index, const char *query,
+                  uint32_t **docs, size_t *docsCount);
+
+/**
+ * 文書のファイルのパスを取得する
+ *
+ * @param   index
+ *          全文検索の索引
+ * @param   doc
+ *          文書の番号
+ * @returns ファイルのパス
+ *          索引が開いている間のみ有効
+ *          番号が不正ならば NULL
+ */
+const char *
+lookup_searchindex(const searchindex *index, uint32_t doc);
+
+/**
+ * 索引を閉じる
+ *
+ * @param   index
+ *          全文検索の索引
+ */
+void
+close_searchindex(searchindex *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __searchindex_h_included__ */
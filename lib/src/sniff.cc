@@ -0,0 +1,238 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "sniff.h"
+
+#include <strings.h>
+
+/**
+ * 制御文字の割合がこれ以上ならばバイナリとみなす (1/16)
+ */
+#define BINARY_CONTROL_SHIFT 4
+
+/**
+ * 行末の位置を取得する
+ *
+ * @param   p
+ *          行の先頭
+ * @param   end
+ *          読む範囲の末尾
+ * @returns 行末の改行の位置
+ *          改行が無ければ end
+ */
+static const char *
+lineEnd(const char *p, const char *end) {
+  while (p < end && *p != '\r' && *p != '\n') {
+    p ++;
+  }
+  return p;
+}
+
+/**
+ * 次の行の先頭を取得する
+ *
+ * @param   p
+ *          行末の改行の位置
+ * @param   end
+ *          読む範囲の末尾
+ * @returns 次の行の先頭
+ */
+static const char *
+nextLine(const char *p, const char *end) {
+  if (p < end && *p == '\r') {
+    p ++;
+  }
+  if (p < end && *p == '\n') {
+    p ++;
+  }
+  return p;
+}
+
+/**
+ * フィールドの行か
+ * field-name *WSP ":" の形式の行を調べる
+ *
+ * @param   p
+ *          行の先頭
+ * @param   end
+ *          行末
+ * @returns フィールドの値の位置
+ *          フィールドでなければ NULL
+ */
+static const char *
+fieldValue(const char *p, const char *end) {
+  const char *start = p;
+  while (p < end && *p >= '!' && *p <= '~' && *p != ':') {
+    p ++;
+  }
+  if (p == start) {
+    return NULL;
+  }
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p ++;
+  }
+  if (p == end || *p != ':') {
+    return NULL;
+  }
+  return p + 1;
+}
+
+/**
+ * 範囲内に文字列が含まれるかを大文字と小文字を区別せずに調べる
+ *
+ * @param   p
+ *          範囲の先頭
+ * @param   end
+ *          範囲の末尾
+ * @param   needle
+ *          探す文字列 (小文字)
+ * @returns 含まれるか
+ */
+static bool
+containsCase(const char *p, const char *end, const char *needle) {
+  size_t length = strlen(needle);
+  for (; p + length <= end; p ++) {
+    if (strncasecmp(p, needle, length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * ヘッダを読んでマルチパートかを調べる
+ *
+ * @param   p
+ *          ヘッダの先頭
+ * @param   end
+ *          読む範囲の末尾
+ * @returns メッセージの形式
+ */
+static inputformat
+sniffHeader(const char *p, const char *end) {
+  bool inContentType = false;
+  while (p < end) {
+    const char *eol = lineEnd(p, end);
+    if (eol == p) {
+      /* 空行でヘッダが終わる */
+      break;
+    }
+
+    if (*p == ' ' || *p == '\t') {
+      /* 折り返した行は直前のフィールドの続き */
+    } else {
+      const char *value = fieldValue(p, eol);
+      if (value == NULL) {
+        break;
+      }
+      inContentType = eol - p >= 12 && strncasecmp(p, "content-type", 12) == 0;
+      p = value;
+    }
+
+    if (inContentType && containsCase(p, eol, "multipart/")) {
+      return INPUT_FORMAT_MULTIPART;
+    }
+
+    p = nextLine(eol, end);
+  }
+
+  return INPUT_FORMAT_MESSAGE;
+}
+
+/**
+ * バイナリか
+ * NUL を含むか、改行やタブ等以外の制御文字が多ければバイナリとみなす
+ *
+ * @param   p
+ *          読む範囲の先頭
+ * @param   end
+ *          読む範囲の末尾
+ * @returns バイナリか
+ */
+static bool
+isBinary(const char *p, const char *end) {
+  size_t controls = 0;
+  size_t size = end - p;
+  for (; p < end; p ++) {
+    unsigned char c = *p;
+    if (c == 0) {
+      return true;
+    }
+    if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' &&
+         c != '\v' && c != 0x1b) || c == 0x7f) {
+      controls ++;
+    }
+  }
+  return (controls << BINARY_CONTROL_SHIFT) > size;
+}
+
+extern "C" {
+
+inputformat
+sniffFormat(const char *data, size_t size) {
+  const char *p = data;
+  const char *end = data + (size < SNIFF_SIZE ? size : SNIFF_SIZE);
+
+  if (end - p >= 3 && memcmp(p, "\xef\xbb\xbf", 3) == 0) {
+    p += 3;
+  }
+
+  /* ヘッダの前の mbox の From 行は読み飛ばす */
+  const char *header = p;
+  if (end - header >= 5 && memcmp(header, "From ", 5) == 0) {
+    header = nextLine(lineEnd(header, end), end);
+  }
+  const char *eol = lineEnd(header, end);
+  if (fieldValue(header, eol)) {
+    return sniffHeader(header, end);
+  }
+
+  /* 改行で始まる場合は空のヘッダのメッセージとして読めるので除く */
+  const char *q = p;
+  while (q < end && (*q == ' ' || *q == '\t' || *q == '\f')) {
+    q ++;
+  }
+  if (q < end && *q == '<' && !isBinary(q, end)) {
+    return INPUT_FORMAT_HTML;
+  }
+
+  if (isBinary(p, end)) {
+    return INPUT_FORMAT_UNSUPPORTED;
+  }
+
+  return INPUT_FORMAT_TEXT;
+}
+
+}
@@ -0,0 +1,78 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __sniff_h_included__
+#define __sniff_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 入力の形式
+ */
+typedef enum {
+  INPUT_FORMAT_MULTIPART = 0, /* マルチパートの MIME メッセージ */
+  INPUT_FORMAT_MESSAGE,       /* シングルパートの MIME メッセージ (EML) */
+  INPUT_FORMAT_HTML,          /* ヘッダの無い HTML */
+  INPUT_FORMAT_TEXT,          /* 上記以外のテキスト */
+  INPUT_FORMAT_UNSUPPORTED    /* バイナリ等の対応していない形式 */
+} inputformat;
+
+/**
+ * 入力の形式を調べる際に読む長さ
+ */
+#define SNIFF_SIZE 4096
+
+/**
+ * 入力の先頭の SNIFF_SIZE バイトのみを読んで形式を調べる
+ *
+ * @param   data
+ *          入力の内容
+ * @param   size
+ *          入力の長さ
+ * @returns 入力の形式
+ */
+inputformat
+sniffFormat(const char *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __sniff_h_included__ */
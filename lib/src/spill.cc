@@ -0,0 +1,140 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "spill.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * ページ単位に切り上げた長さを返す
+ * 空の領域はマップできないので最低 1 ページとする
+ *
+ * @param   size
+ *          長さ
+ * @returns 切り上げた長さ
+ */
+static size_t
+roundToPage(size_t size) {
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  if (size == 0) {
+    size = 1;
+  }
+  return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+extern "C" {
+
+int
+createTemporaryFile(void) {
+  const char *dir = getenv("TMPDIR");
+  if (dir == NULL || dir[0] == '\0') {
+    dir = "/tmp";
+  }
+  std::string path = std::string(dir) + "/ql_unmht.XXXXXX";
+  std::vector<char> tmpl(path.begin(), path.end());
+  tmpl.push_back('\0');
+
+  int fd = mkstemp(tmpl.data());
+  if (fd == -1) {
+    return -1;
+  }
+  unlink(tmpl.data());
+
+  return fd;
+}
+
+int32_t
+writeFully(int fd, const char *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, buffer, size);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buffer += n;
+    size -= n;
+  }
+  return true;
+}
+
+char *
+allocateSpill(size_t capacity, int *fd) {
+  *fd = createTemporaryFile();
+  if (*fd == -1) {
+    return NULL;
+  }
+
+  size_t mapSize = roundToPage(capacity);
+  if (ftruncate(*fd, mapSize) == -1) {
+    close(*fd);
+    *fd = -1;
+    return NULL;
+  }
+
+  void *map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (map == MAP_FAILED) {
+    close(*fd);
+    *fd = -1;
+    return NULL;
+  }
+
+  return reinterpret_cast<char *>(map);
+}
+
+void
+shrinkSpill(char *data, size_t capacity, size_t size, int fd) {
+  size_t mapSize = roundToPage(capacity);
+  size_t usedSize = roundToPage(size);
+  if (usedSize < mapSize) {
+    munmap(data + usedSize, mapSize - usedSize);
+  }
+  ftruncate(fd, size);
+  close(fd);
+}
+
+void
+releaseSpill(char *data, size_t size) {
+  munmap(data, roundToPage(size));
+}
+
+}
@@ -0,0 +1,117 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __spill_h_included__
+#define __spill_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 削除済みの一時ファイルを作成する
+ * TMPDIR (無ければ /tmp) に作成し、閉じると消える
+ *
+ * @returns ファイル記述子
+ *          失敗したら -1
+ */
+int
+createTemporaryFile(void);
+
+/**
+ * ファイル記述子に全て書き込む
+ * 途中までしか書き込めなかった場合やシグナルで中断された場合は続きを書き込む
+ *
+ * @param   fd
+ *          ファイル記述子
+ * @param   buffer
+ *          書き込む内容
+ * @param   size
+ *          書き込む長さ
+ * @returns 成功したか
+ */
+int32_t
+writeFully(int fd, const char *buffer, size_t size);
+
+/**
+ * 一時ファイルをマップした領域を確保する
+ * 書き込んだページはファイルに書き戻されるので、
+ * メモリが足りなければ開放される
+ *
+ * @param   capacity
+ *          確保する長さ
+ * @param   fd
+ *          (出力) 一時ファイルのファイル記述子
+ *          shrinkSpill で閉じる
+ * @returns 確保した領域
+ *          失敗したら NULL
+ */
+char *
+allocateSpill(size_t capacity, int *fd);
+
+/**
+ * 一時ファイルをマップした領域を書き込んだ長さに縮めて、ファイルを閉じる
+ *
+ * @param   data
+ *          allocateSpill で確保した領域
+ * @param   capacity
+ *          確保した長さ
+ * @param   size
+ *          書き込んだ長さ
+ * @param   fd
+ *          一時ファイルのファイル記述子
+ */
+void
+shrinkSpill(char *data, size_t capacity, size_t size, int fd);
+
+/**
+ * 一時ファイルをマップした領域を開放する
+ *
+ * @param   data
+ *          allocateSpill で確保した領域
+ * @param   size
+ *          shrinkSpill で縮めた長さ
+ */
+void
+releaseSpill(char *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __spill_h_included__ */
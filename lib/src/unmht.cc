@@ -34,12 +34,155 @@
 
 #include "unmht.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <jsapi.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
 #include <jsfriendapi.h>
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
 #include "conv.h"
+#include "decode.h"
+#include "gunzip.h"
+#include "hash.h"
 #include "JSWrapper.hh"
+#include "sniff.h"
+#include "SourceText.hh"
+#include "spill.h"
+#include "ThreadPool.hh"
+#include "utf8.h"
+
+/**
+ * JavaScript に渡さずに直接デコードするボディの長さの既定値
+ */
+#define NATIVE_BODY_SIZE (1024 * 1024)
+
+/**
+ * 一時ファイルに移すボディの長さの既定値
+ */
+#define SPILL_SIZE (64 * 1024 * 1024)
+
+/**
+ * extractstream がメモリ上に保持する入力の長さ
+ * これを超えたら一時ファイルに書き出す
+ */
+#define STREAM_MEMORY_SIZE (16 * 1024 * 1024)
+
+/**
+ * 入力を JavaScript の文字列に広げる単位
+ * 広げ終わった部分のマップは順に開放する
+ */
+#define WIDEN_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * 参照に cid を使用する場合の参照の起点となる URI
+ */
+#define CID_BASE_URI "cid:"
+
+/**
+ * 参照にダミーの URL を使用する場合の参照の起点となる URI
+ */
+#define DUMMY_BASE_URI "http://ql_unmht/"
+
+/**
+ * 大域オブジェクトを取得するスクリプト
+ */
+#define GLOBAL_SCRIPT "this;"
+
+/**
+ * 評価済みの ql_unmht.js で展開するスクリプト
+ */
+#define MAIN_SCRIPT \
+  "extractMain(text, cidMode, pruneMode, htmlMode, spliceMode);"
+
+/**
+ * ql_unmht.js が extractMain を定義しているかを調べるスクリプト
+ */
+#define HAS_MAIN_SCRIPT "typeof extractMain == \"function\";"
+
+/**
+ * 計測結果を取り出すスクリプト
+ * 古い ql_unmht.js には arProfiler が無い
+ */
+#define PROFILE_REPORT_SCRIPT \
+  "typeof arProfiler == \"undefined\" ? null : arProfiler.report();"
+
+/**
+ * JavaScript に渡さずに直接デコードするボディの長さ
+ */
+static std::atomic<size_t> nativeBodySize(NATIVE_BODY_SIZE);
+
+/**
+ * 一時ファイルに移すボディの長さ
+ */
+static std::atomic<size_t> spillSize(SPILL_SIZE);
+
+/**
+ * 計測結果を書き出すファイルのパス
+ * 空ならば計測しない
+ */
+static std::string profilePath;
+
+/**
+ * profilePath の排他制御と計測結果の書き出しの直列化
+ */
+static std::mutex profileMutex;
+
+/**
+ * スレッド毎の JavaScript の実行環境
+ * SpiderMonkey の実行環境はスレッド間で共有できないので
+ * スレッド毎に作成して使い回す
+ */
+struct ThreadRuntime {
+  JSWrapper *js;
+  bool scriptLoaded;   /* extractMain を呼び出せるか */
+  uint64_t scriptHash; /* 評価したスクリプトのハッシュ */
+  size_t scriptSize;   /* 評価したスクリプトの長さ
+                        * 評価していなければ 0 */
+  bool profiled;       /* 関数毎の実行時間を計測するか */
+  uint64_t gcStart;    /* 実行中の GC の開始時刻 (マイクロ秒) */
+  uint64_t gcTime;     /* GC に掛かった時間の合計 (マイクロ秒) */
+  uint32_t gcCount;    /* GC の回数 */
+};
+
+/**
+ * ThreadRuntime を保持するキー
+ */
+static pthread_key_t runtimeKey;
+
+/**
+ * runtimeKey の初期化
+ */
+static pthread_once_t runtimeKeyOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * 分割して入力する MHT ファイル
+ */
+struct extractstream {
+  std::string buffer; /* メモリ上に保持している入力 */
+  int fd;             /* 一時ファイル
+                       * メモリ上に保持している場合は -1 */
+  size_t size;        /* 入力の長さ */
+  bool failed;        /* 書き込みに失敗したか */
+};
 
 /**
  * JavaScript 用の print 関数
@@ -212,7 +355,7 @@ ConvertToUnicodeFunc(JSContext *cx, unsigned argc, jsval *vp) {
   ConvertToBinary(cx, JS_ValueToString(cx, args[1]), &charset, &charsetLength);
 
   unsigned short *result;
-  uint32_t resultLength;
+  size_t resultLength;
   if (!convertToUnicode(text, textLength, charset, &result, &resultLength)) {
     free(text);
     free(charset);
@@ -259,7 +402,7 @@ ConvertFromUnicodeFunc(JSContext *cx, unsigned argc, jsval *vp) {
   ConvertToBinary(cx, JS_ValueToString(cx, args[1]), &charset, &charsetLength);
 
   char *result;
-  uint32_t resultLength;
+  size_t resultLength;
   if (!convertFromUnicode(text, textLength, charset, &result, &resultLength)) {
     free(text);
     free(charset);
@@ -279,187 +422,1794 @@ ConvertFromUnicodeFunc(JSContext *cx, unsigned argc, jsval *vp) {
 }
 
 /**
- * 関数情報
+ * JavaScript 用の ConvertToUTF8 関数
+ * 指定したエンコーディングの文字列を UTF16 を経由せずに UTF-8 に変換する
+ *
+ * @param   cx
+ *          実行コンテキスト
+ * @param   argc
+ *          引数の数
+ * @param   vp
+ *          スタック
+ * @returns 成功したか
  */
-static JSFunctionSpecWithHelp funcs[] = {
-  JS_FN_HELP("print", printFunc, 0, 0,
-             "print([exp ...])",
-             "  Evaluate and print expressions to stdout."),
-  JS_FN_HELP("atob", atobFunc, 0, 0,
-             "atob(str)",
-             "  Decode BASE64 encoded string."),
-  JS_FN_HELP("ConvertFromUnicode", ConvertFromUnicodeFunc, 0, 0,
-             "ConvertFromUnicode(str, charset)",
-             "  Convert String from Unicode to specified charset."),
-  JS_FN_HELP("ConvertToUnicode", ConvertToUnicodeFunc, 0, 0,
-             "ConvertToUnicode(str, charset)",
-             "  Convert String from specified charset to Unicode."),
-  JS_FS_HELP_END
-};
+static JSBool
+ConvertToUTF8Func(JSContext *cx, unsigned argc, jsval *vp) {
+  JS::CallArgs args = CallArgsFromVp(argc, vp);
+  if (argc != 2) {
+    return false;
+  }
 
-extern "C" {
+  char *text;
+  size_t textLength;
+  ConvertToBinary(cx, JS_ValueToString(cx, args[0]), &text, &textLength);
 
-efileinfo *
-extract(const char *text, const char *script, int32_t cidMode) {
-  efileinfo *info = NULL;
-  JSWrapper *js = NULL;
+  char *charset;
+  size_t charsetLength;
+  ConvertToBinary(cx, JS_ValueToString(cx, args[1]), &charset, &charsetLength);
 
-#define CLEANUP()                               \
-  if (info) {                                   \
-    free(info);                                 \
-    info = NULL;                                \
-  }                                             \
-  if (js) {                                     \
-    delete js;                                  \
-    js = NULL;                                  \
-  }
+  char *result;
+  size_t resultLength;
+  if (!convertToUTF8(text, textLength, charset, &result, &resultLength)) {
+    free(text);
+    free(charset);
+    args.rval().setUndefined();
 
-  js = new JSWrapper();
-  if (!js->init()) {
-    CLEANUP();
-    return NULL;
+    JS_ReportError(cx, "Failed to convert to UTF-8!");
+    return false;
   }
+  free(text);
+  free(charset);
 
-  if (!js->defineGlobalFuncs(funcs)) {
-    CLEANUP();
-    return NULL;
-  }
+  args.rval().setString(JS_NewStringCopyN(cx, result, resultLength));
 
-  if (!js->defineGlobalStringProp("text", text)) {
-    CLEANUP();
-    return NULL;
-  }
+  free(result);
 
-  if (!js->defineGlobalBoolProp("cidMode", cidMode)) {
-    CLEANUP();
-    return NULL;
+  return true;
+}
+
+/**
+ * JavaScript 用の CheckText 関数
+ * 指定したエンコーディングの文字列を変換せずに UTF-8 として扱えるかを調べる
+ *
+ * @param   cx
+ *          実行コンテキスト
+ * @param   argc
+ *          引数の数
+ * @param   vp
+ *          スタック
+ * @returns 成功したか
+ *          ASCII のみならば "ascii", 正しい UTF-8 ならば "utf-8",
+ *          変換が必要ならば空文字列を返す
+ */
+static JSBool
+CheckTextFunc(JSContext *cx, unsigned argc, jsval *vp) {
+  JS::CallArgs args = CallArgsFromVp(argc, vp);
+  if (argc != 2) {
+    return false;
   }
 
-  JS::RootedValue eFileInfo(js->cx);
-  const char *filename = "ql_unmht.js";
-  unsigned lineno = 1;
-  if (!js->evaluate(script, filename, lineno, eFileInfo.address())) {
-    CLEANUP();
-    return NULL;
+  char *text;
+  size_t textLength;
+  if (!ConvertToBinary(cx, JS_ValueToString(cx, args[0]), &text, &textLength)) {
+    return false;
   }
 
-  if (eFileInfo.isNullOrUndefined()) {
-    CLEANUP();
-    return NULL;
+  char *charset;
+  size_t charsetLength;
+  if (!ConvertToBinary(cx, JS_ValueToString(cx, args[1]),
+                       &charset, &charsetLength)) {
+    free(text);
+    return false;
   }
 
-  JS::RootedValue parts(js->cx);
-  JS::RootedValue part(js->cx);
-  JS::RootedValue eParam(js->cx);
-  size_t length;
+  const char *kind;
+  switch (checkText(text, textLength, charset)) {
+    case TEXT_KIND_ASCII:
+      kind = "ascii";
+      break;
+    case TEXT_KIND_UTF8:
+      kind = "utf-8";
+      break;
+    default:
+      kind = "";
+      break;
+  }
+  free(text);
+  free(charset);
 
-  info = reinterpret_cast<efileinfo *>(malloc(sizeof(efileinfo)));
-  info->parts = NULL;
+  args.rval().setString(JS_NewStringCopyZ(cx, kind));
 
-  if (!js->getStringProp(eFileInfo, "baseURI", &info->baseURI, &length)) {
-    CLEANUP();
-    return NULL;
-  }
+  return true;
+}
 
-  if (!js->getStringProp(eFileInfo, "subject", &info->subject, &length)) {
-    CLEANUP();
-    return NULL;
+/**
+ * JavaScript 用の DecodeParts 関数
+ * 複数のパートのボディをスレッドプールでデコードする
+ *
+ * @param   cx
+ *          実行コンテキスト
+ * @param   argc
+ *          引数の数
+ * @param   vp
+ *          スタック
+ *            [0] ボディの配列
+ *            [1] Content-Transfer-Encoding の配列
+ *            [2] (オプショナル) UTF-8 に変換する元の charset の配列
+ *                空文字列のパートは変換しない
+ * @returns 成功したか
+ *          デコードしたボディの配列を返す
+ *          デコードか変換に失敗したパートは null になる
+ */
+static JSBool
+DecodePartsFunc(JSContext *cx, unsigned argc, jsval *vp) {
+  JS::CallArgs args = CallArgsFromVp(argc, vp);
+  if ((argc != 2 && argc != 3) ||
+      !args[0].isObject() || !args[1].isObject() ||
+      (argc == 3 && !args[2].isObject())) {
+    return false;
   }
 
-  if (!js->getProp(eFileInfo, "parts", parts.address())) {
-    CLEANUP();
-    return NULL;
-  }
-  if (parts.isNullOrUndefined()) {
-    CLEANUP();
-    return NULL;
+  JS::RootedObject bodies(cx, &args[0].toObject());
+  JS::RootedObject encodings(cx, &args[1].toObject());
+  JS::RootedObject charsets(cx, argc == 3 ? &args[2].toObject() : NULL);
+  uint32_t count;
+  if (!JS_GetArrayLength(cx, bodies, &count)) {
+    return false;
   }
 
-  if (!js->getUInt32Prop(parts, "length", &info->partsCount)) {
-    CLEANUP();
-    return NULL;
+  decodejob *jobs
+    = reinterpret_cast<decodejob *>(malloc(sizeof(decodejob) * (count + 1)));
+  decodedpart *results
+    = reinterpret_cast<decodedpart *>(malloc(sizeof(decodedpart) * (count + 1)));
+  if (jobs == NULL || results == NULL) {
+    free(jobs);
+    free(results);
+    return false;
   }
-
-  info->parts = reinterpret_cast<mimepart **>(malloc(sizeof(mimepart *) * info->partsCount));
-  for (size_t i = 0; i < info->partsCount; i ++) {
-    info->parts[i] = NULL;
+  for (uint32_t i = 0; i < count; i ++) {
+    jobs[i].source = NULL;
+    jobs[i].sourceSize = 0;
+    jobs[i].encoding = TRANSFER_ENCODING_NONE;
+    jobs[i].charset = NULL;
+    jobs[i].spillSize = 0;
+    results[i].content = NULL;
   }
-  info->startPart = NULL;
-
-  char buf[256];
-
-  for (size_t i = 0; i < info->partsCount; i ++) {
-    mimepart *p = reinterpret_cast<mimepart *>(malloc(sizeof(mimepart)));
-    info->parts[i] = p;
-    p->charset = NULL;
-    p->mimetype = NULL;
-    p->cid = NULL;
-    p->content = NULL;
 
-    sprintf(buf, "%lu", i);
-    if (!js->getProp(parts, buf, part.address())) {
-      CLEANUP();
-      return NULL;
-    }
-    if (part.isNullOrUndefined()) {
+#define CLEANUP()                                       \
+  for (uint32_t i = 0; i < count; i ++) {               \
+    free(const_cast<char *>(jobs[i].source));           \
+    free(const_cast<char *>(jobs[i].charset));          \
+    free(results[i].content);                           \
+  }                                                     \
+  free(jobs);                                           \
+  free(results);
+
+  JS::RootedValue v(cx);
+  for (uint32_t i = 0; i < count; i ++) {
+    char *body;
+    size_t bodyLength;
+    if (!JS_GetElement(cx, bodies, i, v.address()) ||
+        !ConvertToBinary(cx, JS_ValueToString(cx, v), &body, &bodyLength)) {
       CLEANUP();
-      return NULL;
+      return false;
     }
-
-    if (!js->getStringProp(part, "charset", &p->charset, &length)) {
+    jobs[i].source = body;
+    jobs[i].sourceSize = bodyLength;
+
+    char *encoding;
+    size_t encodingLength;
+    if (!JS_GetElement(cx, encodings, i, v.address()) ||
+        !ConvertToBinary(cx, JS_ValueToString(cx, v),
+                         &encoding, &encodingLength)) {
       CLEANUP();
-      return NULL;
+      return false;
     }
-
-    if (!js->getStringProp(part, "mimetype", &p->mimetype, &length)) {
-      CLEANUP();
-      return NULL;
+    jobs[i].encoding = parseTransferEncoding(encoding);
+    free(encoding);
+
+    if (charsets) {
+      char *charset;
+      size_t charsetLength;
+      if (!JS_GetElement(cx, charsets, i, v.address()) ||
+          !ConvertToBinary(cx, JS_ValueToString(cx, v),
+                           &charset, &charsetLength)) {
+        CLEANUP();
+        return false;
+      }
+      if (charset[0] == '\0') {
+        free(charset);
+      } else {
+        jobs[i].charset = charset;
+      }
     }
+  }
 
-    if (!js->getProp(part, "eParam", eParam.address())) {
-      CLEANUP();
-      return NULL;
-    }
-    if (eParam.isNullOrUndefined()) {
-      CLEANUP();
-      return NULL;
-    }
+  /* 入力が同じパートは同じ文字列を共有する */
+  decodeParts(jobs, count, results);
 
-    if (!js->getStringProp(eParam, "cid", &p->cid, &length)) {
-      CLEANUP();
-      return NULL;
+  JS::RootedObject decoded(cx, JS_NewArrayObject(cx, 0, NULL));
+  if (!decoded) {
+    CLEANUP();
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i ++) {
+    if (results[i].sameAs >= 0) {
+      if (!JS_GetElement(cx, decoded, results[i].sameAs, v.address()) ||
+          !JS_SetElement(cx, decoded, i, v.address())) {
+        CLEANUP();
+        return false;
+      }
+      continue;
     }
 
-    if (!js->getBinaryProp(eParam, "content", &p->content, &p->contentSize)) {
-      CLEANUP();
-      return NULL;
+    if (!results[i].succeeded) {
+      /* 呼び出し元で JavaScript のデコーダを使う */
+      v.setNull();
+    } else {
+      JSString *str = JS_NewStringCopyN(cx, results[i].content,
+                                        results[i].contentSize);
+      if (!str) {
+        CLEANUP();
+        return false;
+      }
+      v.setString(str);
     }
-
-    bool isStartPart;
-    if (!js->getBoolProp(eParam, "isStartPart", &isStartPart)) {
+    if (!JS_SetElement(cx, decoded, i, v.address())) {
       CLEANUP();
-      return NULL;
-    }
-    if (isStartPart) {
-      info->startPart = p;
+      return false;
     }
   }
 
-  if (info->startPart == NULL) {
-    CLEANUP();
+  CLEANUP();
+#undef CLEANUP
+
+  args.rval().setObject(*decoded.get());
+
+  return true;
+}
+
+/**
+ * 単調増加する時刻を取得する
+ *
+ * @returns 時刻 (マイクロ秒)
+ */
+static uint64_t
+getMonotonicTime(void) {
+#ifdef __APPLE__
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0) {
+    mach_timebase_info(&timebase);
+  }
+  return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/**
+ * 呼び出したスレッドの GC に掛かった時間を取得する
+ *
+ * @returns GC に掛かった時間の合計 (マイクロ秒)
+ */
+static uint64_t
+getThreadGCTime(void) {
+  ThreadRuntime *rt
+    = reinterpret_cast<ThreadRuntime *>(pthread_getspecific(runtimeKey));
+  if (rt == NULL) {
+    return 0;
+  }
+
+  uint64_t gcTime = rt->gcTime;
+  if (rt->gcStart) {
+    gcTime += getMonotonicTime() - rt->gcStart;
+  }
+  return gcTime;
+}
+
+/**
+ * GC の開始と終了を記録する
+ * 実行環境はスレッド毎なので、呼び出したスレッドの実行環境に記録する
+ *
+ * @param   runtime
+ *          SpiderMonkey の実行環境
+ * @param   status
+ *          GC の状態
+ */
+static void
+profileGCCallback(JSRuntime *runtime, JSGCStatus status) {
+  ThreadRuntime *rt
+    = reinterpret_cast<ThreadRuntime *>(pthread_getspecific(runtimeKey));
+  if (rt == NULL) {
+    return;
+  }
+
+  if (status == JSGC_BEGIN) {
+    rt->gcStart = getMonotonicTime();
+  } else if (status == JSGC_END && rt->gcStart) {
+    rt->gcTime += getMonotonicTime() - rt->gcStart;
+    rt->gcCount ++;
+    rt->gcStart = 0;
+  }
+}
+
+/**
+ * JavaScript 用の ProfileClock 関数
+ * 関数毎の実行時間の計測に使用する
+ *
+ * @param   cx
+ *          実行コンテキスト
+ * @param   argc
+ *          引数の数
+ * @param   vp
+ *          スタック
+ * @returns 成功したか
+ *          GC に掛かった時間を除いた時刻 (マイクロ秒) を返す
+ */
+static JSBool
+ProfileClockFunc(JSContext *cx, unsigned argc, jsval *vp) {
+  JS::CallArgs args = CallArgsFromVp(argc, vp);
+
+  args.rval().setNumber(static_cast<double>(getMonotonicTime() -
+                                            getThreadGCTime()));
+
+  return true;
+}
+
+/**
+ * 関数情報
+ */
+static JSFunctionSpecWithHelp funcs[] = {
+  JS_FN_HELP("print", printFunc, 0, 0,
+             "print([exp ...])",
+             "  Evaluate and print expressions to stdout."),
+  JS_FN_HELP("atob", atobFunc, 0, 0,
+             "atob(str)",
+             "  Decode BASE64 encoded string."),
+  JS_FN_HELP("ConvertFromUnicode", ConvertFromUnicodeFunc, 0, 0,
+             "ConvertFromUnicode(str, charset)",
+             "  Convert String from Unicode to specified charset."),
+  JS_FN_HELP("ConvertToUnicode", ConvertToUnicodeFunc, 0, 0,
+             "ConvertToUnicode(str, charset)",
+             "  Convert String from specified charset to Unicode."),
+  JS_FN_HELP("CheckText", CheckTextFunc, 0, 0,
+             "CheckText(str, charset)",
+             "  Check whether String can be used as UTF-8 without conversion."),
+  JS_FN_HELP("ConvertToUTF8", ConvertToUTF8Func, 0, 0,
+             "ConvertToUTF8(str, charset)",
+             "  Convert String from specified charset to UTF-8."),
+  JS_FN_HELP("DecodeParts", DecodePartsFunc, 0, 0,
+             "DecodeParts(bodies, encodings[, charsets])",
+             "  Decode Content-Transfer-Encoding of parts in parallel,\n"
+             "  converting text parts to UTF-8 if charsets is given."),
+  JS_FN_HELP("ProfileClock", ProfileClockFunc, 0, 0,
+             "ProfileClock()",
+             "  Return monotonic time in microseconds excluding GC."),
+  JS_FS_HELP_END
+};
+
+/**
+ * 数値のプロパティを取得する
+ *
+ * @param   js
+ *          JavaScript の実行環境
+ * @param   obj
+ *          対象のオブジェクト
+ * @param   name
+ *          プロパティ名
+ * @param   result
+ *          (出力) プロパティの値
+ * @returns 成功したか
+ */
+static bool
+getNumberProp(JSWrapper *js, jsval obj, const char *name, double *result) {
+  JS::RootedValue v(js->cx);
+  if (!js->getProp(obj, name, v.address())) {
+    return false;
+  }
+  if (!v.isNumber()) {
+    return false;
+  }
+  *result = v.toNumber();
+  return true;
+}
+
+/**
+ * 元のファイル中の位置を取得する
+ *
+ * @param   js
+ *          JavaScript の実行環境
+ * @param   part
+ *          arMIMEPart
+ * @param   p
+ *          (出力) パート
+ * @returns 成功したか
+ */
+static bool
+getSourceRange(JSWrapper *js, jsval part, mimepart *p) {
+  double headerOffset, headerSize, bodyOffset, bodySize;
+  if (!getNumberProp(js, part, "headerOffset", &headerOffset) ||
+      !getNumberProp(js, part, "headerSize", &headerSize) ||
+      !getNumberProp(js, part, "bodyOffset", &bodyOffset) ||
+      !getNumberProp(js, part, "bodySize", &bodySize)) {
+    return false;
+  }
+
+  if (headerOffset < 0 || bodyOffset < 0) {
+    return true;
+  }
+
+  p->headerOffset = static_cast<int64_t>(headerOffset);
+  p->headerSize = static_cast<size_t>(headerSize);
+  p->bodyOffset = static_cast<int64_t>(bodyOffset);
+  p->bodySize = static_cast<size_t>(bodySize);
+  return true;
+}
+
+/**
+ * JavaScript に渡した文字列中の位置を元のファイル中の位置に変換する
+ *
+ * @param   source
+ *          JavaScript に渡した文字列
+ * @param   p
+ *          (入出力) パート
+ */
+static void
+mapSourceRange(const SourceText &source, mimepart *p) {
+  if (p->headerOffset < 0 || p->bodyOffset < 0) {
+    return;
+  }
+
+  int64_t headerOffset = source.toSourceOffset(p->headerOffset);
+  int64_t bodyOffset = source.toSourceOffset(p->bodyOffset);
+  int64_t bodyEnd = source.toSourceOffset(p->bodyOffset + p->bodySize);
+
+  p->headerOffset = headerOffset;
+  p->headerSize = bodyOffset - headerOffset;
+  p->bodyOffset = bodyOffset;
+  p->bodySize = bodyEnd - bodyOffset;
+}
+
+/**
+ * JavaScript に渡さなかったボディをデコードする
+ *
+ * @param   source
+ *          JavaScript に渡した文字列
+ * @param   natives
+ *          パートと元のファイル中のパートの組
+ * @param   info
+ *          (入出力) MHT ファイルの展開情報
+ * @returns 成功したか
+ */
+static bool
+decodeNativeBodies(const SourceText &source,
+                   const std::vector<std::pair<mimepart *, const scanpart *> > &natives,
+                   efileinfo *info) {
+  if (natives.empty()) {
+    return true;
+  }
+
+  std::vector<decodejob> jobs(natives.size());
+  std::vector<decodedpart> results(natives.size());
+  for (size_t i = 0; i < natives.size(); i ++) {
+    const scanpart *sp = natives[i].second;
+    jobs[i].source = source.source() + sp->bodyOffset;
+    jobs[i].sourceSize = sp->bodySize;
+    jobs[i].encoding = parseTransferEncoding(sp->transferEncoding);
+    /* テキストのパートは JavaScript に渡すので、ここでは変換しない */
+    jobs[i].charset = NULL;
+    jobs[i].spillSize = spillSize;
+  }
+
+  decodeParts(jobs.data(), jobs.size(), results.data());
+
+  /* 失敗しても全ての結果をパートに渡して delete_efileinfo で開放する */
+  bool succeeded = true;
+  for (size_t i = 0; i < natives.size(); i ++) {
+    mimepart *p = natives[i].first;
+    const scanpart *sp = natives[i].second;
+    free(p->content);
+    p->content = NULL;
+
+    p->headerOffset = sp->headerOffset;
+    p->headerSize = sp->headerSize;
+    p->bodyOffset = sp->bodyOffset;
+    p->bodySize = sp->bodySize;
+
+    if (results[i].sameAs >= 0) {
+      mimepart *original = natives[results[i].sameAs].first;
+      p->content = original->content;
+      p->contentSize = original->contentSize;
+      p->contentStorage = CONTENT_STORAGE_SHARED;
+      info->dedupSavedSize += p->contentSize;
+      continue;
+    }
+
+    /* 空のボディで続けずに展開を失敗させる */
+    if (!results[i].succeeded) {
+      p->contentSize = 0;
+      succeeded = false;
+      continue;
+    }
+    p->content = results[i].content;
+    p->contentSize = results[i].contentSize;
+    if (results[i].spilled) {
+      p->contentStorage = CONTENT_STORAGE_MAPPED;
+    }
+  }
+
+  return succeeded;
+}
+
+/**
+ * JavaScript から受け取った長いボディを一時ファイルに移す
+ *
+ * @param   part
+ *          パート
+ */
+static void
+spillContent(mimepart *part) {
+  size_t limit = spillSize;
+  if (limit == 0 || part->content == NULL || part->contentSize <= limit) {
+    return;
+  }
+
+  int fd;
+  char *spilled = allocateSpill(part->contentSize + 1, &fd);
+  if (spilled == NULL) {
+    return;
+  }
+  memcpy(spilled, part->content, part->contentSize);
+  spilled[part->contentSize] = '\0';
+  shrinkSpill(spilled, part->contentSize + 1, part->contentSize + 1, fd);
+
+  free(part->content);
+  part->content = spilled;
+  part->contentStorage = CONTENT_STORAGE_MAPPED;
+}
+
+/**
+ * ql_unmht.js が参照を書き換えるパートか
+ *
+ * @param   part
+ *          パート
+ * @returns HTML か CSS のパートか
+ */
+static bool
+isReferringPart(const mimepart *part) {
+  return part->mimetype &&
+    (strcasecmp(part->mimetype, "text/html") == 0 ||
+     strcasecmp(part->mimetype, "application/xhtml+xml") == 0 ||
+     strcasecmp(part->mimetype, "text/css") == 0);
+}
+
+/**
+ * ボディ中の参照の起点となる URI の位置を記録する
+ *
+ * @param   part
+ *          パート
+ * @param   base
+ *          参照の起点となる URI
+ * @returns 成功したか
+ */
+static bool
+findReferences(mimepart *part, const std::string &base) {
+  std::vector<size_t> found;
+  size_t pos = 0;
+  while (pos < part->contentSize) {
+    const char *p = reinterpret_cast<const char *>
+      (memmem(part->content + pos, part->contentSize - pos,
+              base.data(), base.size()));
+    if (p == NULL) {
+      break;
+    }
+    found.push_back(p - part->content);
+    pos = p - part->content + base.size();
+  }
+
+  if (found.empty()) {
+    return true;
+  }
+
+  part->references
+    = reinterpret_cast<size_t *>(malloc(sizeof(size_t) * found.size()));
+  if (part->references == NULL) {
+    return false;
+  }
+  memcpy(part->references, found.data(), sizeof(size_t) * found.size());
+  part->referencesCount = found.size();
+
+  return true;
+}
+
+/**
+ * 参照の起点となる URI を置き換えた後のボディの長さを求める
+ *
+ * @param   part
+ *          パート
+ * @param   fromSize
+ *          置き換える前の URI の長さ
+ * @param   toSize
+ *          置き換えた後の URI の長さ
+ * @returns 置き換えた後のボディの長さ
+ */
+static size_t
+splicedSize(const mimepart *part, size_t fromSize, size_t toSize) {
+  return part->contentSize
+    - part->referencesCount * fromSize + part->referencesCount * toSize;
+}
+
+/**
+ * ボディ中の参照の起点となる URI を置き換える
+ * 前から詰めるので、短くなる場合は content に元のボディを渡してもよい
+ * contentSize と references は置き換えた後のものになる
+ *
+ * @param   part
+ *          パート
+ * @param   fromSize
+ *          置き換える前の URI の長さ
+ * @param   to
+ *          置き換えた後の URI
+ * @param   content
+ *          (出力) 置き換えたボディを書き込む領域
+ *          splicedSize + 1 以上の長さが必要で、NUL で終端する
+ */
+static void
+spliceReferences(mimepart *part, size_t fromSize, const std::string &to,
+                 char *content) {
+  size_t src = 0, dst = 0;
+  for (size_t i = 0; i < part->referencesCount; i ++) {
+    size_t ref = part->references[i];
+    memmove(content + dst, part->content + src, ref - src);
+    dst += ref - src;
+    memcpy(content + dst, to.data(), to.size());
+    part->references[i] = dst;
+    dst += to.size();
+    src = ref + fromSize;
+  }
+  memmove(content + dst, part->content + src, part->contentSize - src);
+  dst += part->contentSize - src;
+  content[dst] = '\0';
+  part->contentSize = dst;
+}
+
+/**
+ * ql_unmht.js が書き込んだ仮の参照の起点となる URI の位置を記録して
+ * 実際の URI に置き換える
+ *
+ * @param   part
+ *          JavaScript から受け取ったボディを持つパート
+ * @param   from
+ *          仮の参照の起点となる URI
+ * @param   to
+ *          実際の参照の起点となる URI
+ * @returns 成功したか
+ */
+static bool
+spliceContent(mimepart *part, const std::string &from, const std::string &to) {
+  if (!findReferences(part, from)) {
+    return false;
+  }
+  if (part->referencesCount == 0) {
+    return true;
+  }
+
+  char *content = part->content;
+  if (to.size() > from.size()) {
+    size_t size = splicedSize(part, from.size(), to.size());
+    content = reinterpret_cast<char *>(malloc(size + 1));
+    if (content == NULL) {
+      return false;
+    }
+  }
+
+  spliceReferences(part, from.size(), to, content);
+  if (content != part->content) {
+    free(part->content);
+    part->content = content;
+  }
+
+  return true;
+}
+
+/**
+ * 内容が同じパートのボディを共有する
+ * 共有されたパートの contentStorage は CONTENT_STORAGE_SHARED になる
+ * 直接デコードした時に既に共有しているパートは、
+ * 共有元のボディを開放したら残ったボディを指すようにする
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ */
+static void
+dedupContents(efileinfo *info) {
+  std::unordered_multimap<uint64_t, mimepart *> hashes;
+  std::unordered_multimap<const char *, mimepart *> sharers;
+
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    mimepart *p = info->parts[i];
+    if (p->content != NULL && p->contentStorage == CONTENT_STORAGE_SHARED) {
+      sharers.insert(std::make_pair(p->content, p));
+    }
+  }
+
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    mimepart *p = info->parts[i];
+    if (p->content == NULL || p->contentSize == 0 ||
+        p->contentStorage != CONTENT_STORAGE_OWNED) {
+      continue;
+    }
+
+    uint64_t h = hashBytes(p->content, p->contentSize, 0);
+    mimepart *original = NULL;
+    auto range = hashes.equal_range(h);
+    for (auto it = range.first; it != range.second; ++ it) {
+      mimepart *other = it->second;
+      /* 参照の位置も同じでなければ形式を切り替えた後の内容が異なる */
+      if (other->contentSize == p->contentSize &&
+          other->referencesCount == p->referencesCount &&
+          memcmp(other->content, p->content, p->contentSize) == 0 &&
+          (p->referencesCount == 0 ||
+           memcmp(other->references, p->references,
+                  sizeof(size_t) * p->referencesCount) == 0)) {
+        original = other;
+        break;
+      }
+    }
+
+    if (original == NULL) {
+      hashes.insert(std::make_pair(h, p));
+      continue;
+    }
+
+    auto shared = sharers.equal_range(p->content);
+    for (auto it = shared.first; it != shared.second; ++ it) {
+      it->second->content = original->content;
+    }
+    sharers.erase(p->content);
+
+    free(p->content);
+    p->content = original->content;
+    p->contentStorage = CONTENT_STORAGE_SHARED;
+    info->dedupSavedSize += p->contentSize;
+  }
+}
+
+/**
+ * スレッドの実行環境を開放する
+ *
+ * @param   ptr
+ *          スレッドの実行環境
+ */
+static void
+deleteThreadRuntime(void *ptr) {
+  ThreadRuntime *rt = reinterpret_cast<ThreadRuntime *>(ptr);
+  rt->js->term();
+  delete rt->js;
+  delete rt;
+}
+
+/**
+ * runtimeKey を作成する
+ */
+static void
+createRuntimeKey(void) {
+  pthread_key_create(&runtimeKey, deleteThreadRuntime);
+}
+
+/**
+ * 呼び出したスレッドの実行環境を取得する
+ * 無ければ作成する
+ *
+ * @param   profiled
+ *          関数毎の実行時間を計測するか
+ * @returns スレッドの実行環境
+ *          失敗したら NULL
+ */
+static ThreadRuntime *
+acquireRuntime(bool profiled) {
+  pthread_once(&runtimeKeyOnce, createRuntimeKey);
+
+  ThreadRuntime *rt
+    = reinterpret_cast<ThreadRuntime *>(pthread_getspecific(runtimeKey));
+  if (rt) {
+    if (rt->profiled == profiled) {
+      return rt;
+    }
+
+    /* 計測用の関数で包むかはスクリプトの評価時に決まるので作り直す */
+    pthread_setspecific(runtimeKey, NULL);
+    deleteThreadRuntime(rt);
+  }
+
+  JSWrapper *js = new JSWrapper();
+  if (!js->init()) {
+    delete js;
+    return NULL;
+  }
+
+  if (!js->defineGlobalFuncs(funcs)) {
+    js->term();
+    delete js;
+    return NULL;
+  }
+
+  rt = new ThreadRuntime();
+  rt->js = js;
+  rt->scriptLoaded = false;
+  rt->scriptHash = 0;
+  rt->scriptSize = 0;
+  rt->profiled = profiled;
+  rt->gcStart = 0;
+  rt->gcTime = 0;
+  rt->gcCount = 0;
+
+  if (profiled) {
+    JS_SetGCCallback(JS_GetRuntime(js->cx), profileGCCallback);
+  }
+
+  if (pthread_setspecific(runtimeKey, rt) != 0) {
+    deleteThreadRuntime(rt);
+    return NULL;
+  }
+
+  return rt;
+}
+
+/**
+ * 使い回せない状態になった実行環境を破棄する
+ *
+ * @param   rt
+ *          スレッドの実行環境
+ */
+static void
+discardRuntime(ThreadRuntime *rt) {
+  pthread_setspecific(runtimeKey, NULL);
+  deleteThreadRuntime(rt);
+}
+
+/**
+ * 展開が終わった実行環境を次の展開のために戻す
+ * 入力の文字列への参照を外して、必要ならば GC を行う
+ *
+ * @param   rt
+ *          スレッドの実行環境
+ */
+static void
+resetRuntime(ThreadRuntime *rt) {
+  if (!rt->js->defineGlobalStringProp("text", "")) {
+    discardRuntime(rt);
+    return;
+  }
+
+  JS_MaybeGC(rt->js->cx);
+}
+
+/**
+ * ql_unmht.js に渡す文字列を大域変数 text に設定する
+ * defineGlobalStringProp は NUL で終端した文字列を複写するので使わずに、
+ * 入力の区切りから JavaScript の文字列の領域に直接広げる
+ *
+ * @param   js
+ *          JavaScript の実行環境
+ * @param   source
+ *          ql_unmht.js に渡す文字列
+ * @param   mapped
+ *          区切りがファイルをマップした領域か
+ *          true ならば広げ終わった部分のページを開放する
+ *          開放したページは次に読む時にファイルから読み直される
+ * @returns 成功したか
+ */
+static bool
+defineSourceText(JSWrapper *js, const SourceText &source, bool mapped) {
+  JS::RootedValue global(js->cx);
+  unsigned lineno = 1;
+  if (!js->evaluate(GLOBAL_SCRIPT, "ql_unmht-global.js", lineno,
+                    global.address())) {
+    return false;
+  }
+  if (!global.isObject()) {
+    return false;
+  }
+
+  size_t size = source.textSize();
+  jschar *chars
+    = reinterpret_cast<jschar *>(JS_malloc(js->cx,
+                                           sizeof(jschar) * (size + 1)));
+  if (chars == NULL) {
+    return false;
+  }
+
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  jschar *out = chars;
+  for (size_t index = 0; index < source.chunkCount(); index ++) {
+    size_t chunkSize;
+    const char *text = source.chunk(index, &chunkSize);
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(text);
+    size_t released = 0;
+    for (size_t pos = 0; pos < chunkSize; ) {
+      size_t end = pos + WIDEN_CHUNK_SIZE < chunkSize
+        ? pos + WIDEN_CHUNK_SIZE : chunkSize;
+      for (size_t i = pos; i < end; i ++) {
+        out[i] = src[i];
+      }
+      pos = end;
+
+      if (mapped) {
+        size_t boundary = pos / pageSize * pageSize;
+        if (boundary > released) {
+          madvise(const_cast<char *>(text) + released, boundary - released,
+                  MADV_DONTNEED);
+          released = boundary;
+        }
+      }
+    }
+    out += chunkSize;
+  }
+  chars[size] = 0;
+
+  /* 成功したら chars は文字列が所有する */
+  JSString *str = JS_NewUCString(js->cx, chars, size);
+  if (str == NULL) {
+    JS_free(js->cx, chars);
+    return false;
+  }
+
+  return JS_DefineProperty(js->cx, &global.toObject(), "text",
+                           STRING_TO_JSVAL(str), NULL, NULL,
+                           JSPROP_ENUMERATE);
+}
+
+/**
+ * スレッドの実行環境で MHT ファイルを展開する
+ *
+ * @param   rt
+ *          スレッドの実行環境
+ * @param   source
+ *          JavaScript に渡す文字列
+ * @param   mapped
+ *          MHT ファイルの内容がファイルをマップした領域か
+ * @param   html
+ *          MHT ファイルの内容がヘッダの無い HTML か
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @param   broken
+ *          (出力) 実行環境が使い回せない状態になったか
+ * @param   mismatched
+ *          (出力) 取り除いたボディと JavaScript が解析したパートが
+ *          対応しなかったか
+ * @returns MHT ファイルの展開情報
+ */
+static efileinfo *
+extractWithRuntime(ThreadRuntime *rt, const SourceText &source, bool mapped,
+                   bool html, const char *script, int32_t mode,
+                   bool *broken, bool *mismatched) {
+  efileinfo *info = NULL;
+  JSWrapper *js = rt->js;
+
+#define CLEANUP()                               \
+  if (info) {                                   \
+    delete_efileinfo(info);                     \
+    info = NULL;                                \
+  }
+
+  *broken = false;
+  *mismatched = false;
+
+  if (!defineSourceText(js, source, mapped && source.isSourceText())) {
+    *broken = true;
+    return NULL;
+  }
+
+  if (!js->defineGlobalBoolProp("cidMode", (mode & EXTRACT_CID) != 0)) {
+    *broken = true;
+    return NULL;
+  }
+
+  if (!js->defineGlobalBoolProp("profileMode", rt->profiled)) {
+    *broken = true;
+    return NULL;
+  }
+
+  if (!js->defineGlobalBoolProp("pruneMode", (mode & EXTRACT_PRUNE) != 0)) {
+    *broken = true;
+    return NULL;
+  }
+
+  if (!js->defineGlobalBoolProp("htmlMode", html)) {
+    *broken = true;
+    return NULL;
+  }
+
+  if (!js->defineGlobalBoolProp("spliceMode",
+                                (mode & EXTRACT_REBASABLE) != 0)) {
+    *broken = true;
+    return NULL;
+  }
+
+  JS::RootedValue eFileInfo(js->cx);
+  unsigned lineno = 1;
+  size_t scriptSize = strlen(script);
+  uint64_t scriptHash = hashBytes(script, scriptSize, 0);
+  if (rt->scriptLoaded &&
+      rt->scriptSize == scriptSize && rt->scriptHash == scriptHash) {
+    /* 評価済みのスクリプトの関数のみを呼び出す */
+    if (!js->evaluate(MAIN_SCRIPT, "ql_unmht-main.js", lineno,
+                      eFileInfo.address())) {
+      *broken = true;
+      return NULL;
+    }
+  } else {
+    if (rt->scriptSize != 0) {
+      /* 異なるスクリプトは同じ大域オブジェクトで評価できない */
+      *broken = true;
+      return NULL;
+    }
+
+    const char *filename = "ql_unmht.js";
+    if (!js->evaluate(script, filename, lineno, eFileInfo.address())) {
+      *broken = true;
+      return NULL;
+    }
+
+    rt->scriptSize = scriptSize;
+    rt->scriptHash = scriptHash;
+
+    /* 古いスクリプトには extractMain が無い */
+    JS::RootedValue hasMain(js->cx);
+    rt->scriptLoaded
+      = js->evaluate(HAS_MAIN_SCRIPT, "ql_unmht-main.js", lineno,
+                     hasMain.address())
+      && hasMain.isBoolean() && hasMain.toBoolean();
+  }
+
+  if (eFileInfo.isNullOrUndefined()) {
+    CLEANUP();
+    return NULL;
+  }
+
+  JS::RootedValue parts(js->cx);
+  JS::RootedValue part(js->cx);
+  JS::RootedValue eParam(js->cx);
+  JS::RootedValue pruned(js->cx);
+  JS::RootedValue spliced(js->cx);
+  size_t length;
+
+  info = reinterpret_cast<efileinfo *>(malloc(sizeof(efileinfo)));
+  if (info == NULL) {
+    return NULL;
+  }
+  /* 途中で失敗しても delete_efileinfo で開放できるように初期化する */
+  info->baseURI = NULL;
+  info->subject = NULL;
+  info->startPart = NULL;
+  info->parts = NULL;
+  info->partsCount = 0;
+  info->dedupSavedSize = 0;
+  info->cidMode = (mode & EXTRACT_CID) != 0;
+  info->rebasable = false;
+  info->nativeMismatch = false;
+
+  if (!js->getStringProp(eFileInfo, "baseURI", &info->baseURI, &length)) {
+    CLEANUP();
+    return NULL;
+  }
+
+  /* 古い ql_unmht.js には isSpliced が無い */
+  if (!js->getProp(eFileInfo, "isSpliced", spliced.address())) {
+    CLEANUP();
+    return NULL;
+  }
+  std::string spliceBase, referenceBase;
+  if (spliced.isBoolean() && spliced.toBoolean()) {
+    /* 参照の位置を記録しながら仮の URI を置き換える */
+    spliceBase = info->baseURI;
+    referenceBase = mode & EXTRACT_CID ? CID_BASE_URI : DUMMY_BASE_URI;
+    free(info->baseURI);
+    info->baseURI = strdup(referenceBase.c_str());
+    if (info->baseURI == NULL) {
+      CLEANUP();
+      return NULL;
+    }
+    info->rebasable = true;
+  }
+
+  if (!js->getStringProp(eFileInfo, "subject", &info->subject, &length)) {
+    CLEANUP();
+    return NULL;
+  }
+
+  if (!js->getProp(eFileInfo, "parts", parts.address())) {
+    CLEANUP();
+    return NULL;
+  }
+  if (parts.isNullOrUndefined()) {
+    CLEANUP();
+    return NULL;
+  }
+
+  uint32_t partsCount;
+  if (!js->getUInt32Prop(parts, "length", &partsCount)) {
+    CLEANUP();
+    return NULL;
+  }
+
+  info->parts = reinterpret_cast<mimepart **>(malloc(sizeof(mimepart *) * (partsCount + 1)));
+  if (info->parts == NULL) {
+    CLEANUP();
+    return NULL;
+  }
+  info->partsCount = partsCount;
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    info->parts[i] = NULL;
+  }
+
+  char buf[256];
+  std::vector<std::pair<mimepart *, const scanpart *> > natives;
+  std::unordered_set<const scanpart *> nativeSeen;
+
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    mimepart *p = reinterpret_cast<mimepart *>(malloc(sizeof(mimepart)));
+    if (p == NULL) {
+      CLEANUP();
+      return NULL;
+    }
+    info->parts[i] = p;
+    p->charset = NULL;
+    p->mimetype = NULL;
+    p->cid = NULL;
+    p->location = NULL;
+    p->content = NULL;
+    p->contentStorage = CONTENT_STORAGE_OWNED;
+    p->transferEncoding = NULL;
+    p->headerOffset = -1;
+    p->headerSize = 0;
+    p->bodyOffset = -1;
+    p->bodySize = 0;
+    p->references = NULL;
+    p->referencesCount = 0;
+
+    sprintf(buf, "%lu", i);
+    if (!js->getProp(parts, buf, part.address())) {
+      CLEANUP();
+      return NULL;
+    }
+    if (part.isNullOrUndefined()) {
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!js->getStringProp(part, "charset", &p->charset, &length)) {
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!js->getStringProp(part, "mimetype", &p->mimetype, &length)) {
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!js->getStringProp(part, "contentTransferEncoding",
+                           &p->transferEncoding, &length)) {
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!getSourceRange(js, part, p)) {
+      CLEANUP();
+      return NULL;
+    }
+    mapSourceRange(source, p);
+
+    char *nativeBody;
+    if (!js->getStringProp(part, "nativeBody", &nativeBody, &length)) {
+      CLEANUP();
+      return NULL;
+    }
+    const scanpart *sp = source.nativePart(nativeBody);
+    free(nativeBody);
+    if (sp && !nativeSeen.insert(sp).second) {
+      *mismatched = true;
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!js->getProp(part, "eParam", eParam.address())) {
+      CLEANUP();
+      return NULL;
+    }
+    if (eParam.isNullOrUndefined()) {
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!js->getStringProp(eParam, "cid", &p->cid, &length)) {
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!js->getStringProp(eParam, "location", &p->location, &length)) {
+      CLEANUP();
+      return NULL;
+    }
+
+    if (!js->getBinaryProp(eParam, "content", &p->content, &p->contentSize)) {
+      CLEANUP();
+      return NULL;
+    }
+
+    /* 古い ql_unmht.js には isPruned が無い */
+    if (!js->getProp(eParam, "isPruned", pruned.address())) {
+      CLEANUP();
+      return NULL;
+    }
+    if (pruned.isBoolean() && pruned.toBoolean()) {
+      free(p->content);
+      p->content = NULL;
+      p->contentSize = 0;
+      p->contentStorage = CONTENT_STORAGE_PRUNED;
+      if (sp) {
+        /* 取り除いたボディの位置は文字列からは求められない */
+        p->headerOffset = sp->headerOffset;
+        p->headerSize = sp->headerSize;
+        p->bodyOffset = sp->bodyOffset;
+        p->bodySize = sp->bodySize;
+      }
+    } else if (sp) {
+      natives.push_back(std::make_pair(p, sp));
+    } else {
+      if (!spliceBase.empty() && isReferringPart(p) &&
+          !spliceContent(p, spliceBase, referenceBase)) {
+        CLEANUP();
+        return NULL;
+      }
+      spillContent(p);
+    }
+
+    bool isStartPart;
+    if (!js->getBoolProp(eParam, "isStartPart", &isStartPart)) {
+      CLEANUP();
+      return NULL;
+    }
+    if (isStartPart) {
+      info->startPart = p;
+    }
+  }
+
+  /* スキャンと JavaScript でパートの区切りが異なると、取り除いたボディの
+   * フィールドが別のパートのボディに紛れ込んで、そのボディが欠ける */
+  if (nativeSeen.size() != source.nativeCount()) {
+    *mismatched = true;
+    CLEANUP();
+    return NULL;
+  }
+
+  if (info->startPart == NULL) {
+    CLEANUP();
+    return NULL;
+  }
+
+  if (!decodeNativeBodies(source, natives, info)) {
+    CLEANUP();
+    return NULL;
+  }
+
+  dedupContents(info);
+
+  return info;
+#undef CLEANUP
+}
+
+/**
+ * 計測結果をファイルに追記する
+ * path には flamegraph.pl に渡せる折り畳んだ呼び出し列を、
+ * path.functions には関数毎の呼び出し回数と自身の時間と合計時間を書き出す
+ * GC に掛かった時間は [gc] として extractMain の下に加える
+ *
+ * @param   rt
+ *          展開が終わったスレッドの実行環境
+ * @param   path
+ *          計測結果を書き出すファイルのパス
+ */
+static void
+writeProfileReport(ThreadRuntime *rt, const std::string &path) {
+  JSWrapper *js = rt->js;
+  JS::RootedValue report(js->cx);
+  unsigned lineno = 1;
+  if (!js->evaluate(PROFILE_REPORT_SCRIPT, "ql_unmht-profile.js", lineno,
+                    report.address())) {
+    return;
+  }
+  if (report.isNullOrUndefined()) {
+    return;
+  }
+
+  char *stacks, *functions;
+  size_t stacksSize, functionsSize;
+  if (!js->getStringProp(report, "stacks", &stacks, &stacksSize)) {
+    return;
+  }
+  if (!js->getStringProp(report, "functions", &functions, &functionsSize)) {
+    free(stacks);
+    return;
+  }
+
+  std::string stacksText(stacks, stacksSize);
+  std::string functionsText("# function\tcalls\tself_us\ttotal_us\n");
+  functionsText.append(functions, functionsSize);
+  free(stacks);
+  free(functions);
+
+  if (rt->gcCount) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "extractMain;[gc] %llu\n",
+             static_cast<unsigned long long>(rt->gcTime));
+    stacksText += buf;
+    snprintf(buf, sizeof(buf), "[gc]\t%u\t%llu\t%llu\n", rt->gcCount,
+             static_cast<unsigned long long>(rt->gcTime),
+             static_cast<unsigned long long>(rt->gcTime));
+    functionsText += buf;
+  }
+
+  std::lock_guard<std::mutex> lock(profileMutex);
+  std::string functionsPath = path + ".functions";
+  const std::pair<const char *, const std::string *> outputs[] = {
+    std::make_pair(path.c_str(), &stacksText),
+    std::make_pair(functionsPath.c_str(), &functionsText)
+  };
+  for (size_t i = 0; i < 2; i ++) {
+    int fd = open(outputs[i].first, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {
+      continue;
+    }
+    writeFully(fd, outputs[i].second->data(), outputs[i].second->size());
+    close(fd);
+  }
+}
+
+/**
+ * 展開したパートの元のファイル中の位置を不明にする
+ * 圧縮されたファイルでは展開後の位置からはデコードできない
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ */
+static void
+clearSourceRanges(efileinfo *info) {
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    mimepart *p = info->parts[i];
+    p->headerOffset = -1;
+    p->headerSize = 0;
+    p->bodyOffset = -1;
+    p->bodySize = 0;
+  }
+}
+
+/**
+ * JavaScript に渡す文字列を展開する
+ *
+ * @param   source
+ *          JavaScript に渡す文字列
+ * @param   mapped
+ *          MHT ファイルの内容がファイルをマップした領域か
+ * @param   html
+ *          MHT ファイルの内容がヘッダの無い HTML か
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @param   mismatched
+ *          (出力) 取り除いたボディと JavaScript が解析したパートが
+ *          対応しなかったか
+ * @returns MHT ファイルの展開情報
+ */
+static efileinfo *
+extractSourceText(const SourceText &source, bool mapped, bool html,
+                  const char *script, int32_t mode, bool *mismatched) {
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(profileMutex);
+    path = profilePath;
+  }
+
+  /* 使い回した実行環境で失敗した場合は作り直してもう 1 度試す */
+  for (int attempt = 0; attempt < 2; attempt ++) {
+    ThreadRuntime *rt = acquireRuntime(!path.empty());
+    if (rt == NULL) {
+      return NULL;
+    }
+
+    bool reused = rt->scriptSize != 0;
+    bool broken;
+    rt->gcTime = 0;
+    rt->gcCount = 0;
+    efileinfo *info = extractWithRuntime(rt, source, mapped, html,
+                                         script, mode, &broken, mismatched);
+    if (!broken) {
+      if (rt->profiled) {
+        writeProfileReport(rt, path);
+      }
+      resetRuntime(rt);
+      return info;
+    }
+
+    discardRuntime(rt);
+    if (!reused) {
+      return info;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * MHT ファイルを展開する
+ *
+ * @param   data
+ *          MHT ファイルの内容
+ * @param   size
+ *          MHT ファイルの長さ
+ * @param   mapped
+ *          data がファイルをマップした領域か
+ *          true ならば JavaScript に渡し終えたページを開放する
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @returns MHT ファイルの展開情報
+ */
+static efileinfo *
+extractSource(const char *data, size_t size, bool mapped,
+              const char *script, int32_t mode) {
+  /* バイナリ等は JavaScript に渡さずに先頭のみを見て失敗する */
+  inputformat format = sniffFormat(data, size);
+  if (format == INPUT_FORMAT_UNSUPPORTED) {
+    return NULL;
+  }
+  bool html = format == INPUT_FORMAT_HTML;
+
+  bool mismatched = false;
+  {
+    SourceText source;
+    if (!source.build(data, size, nativeBodySize)) {
+      return NULL;
+    }
+
+    efileinfo *info = extractSourceText(source, mapped, html, script, mode,
+                                        &mismatched);
+    if (!mismatched) {
+      return info;
+    }
+  }
+
+  /* 取り除いたボディの対応が取れなかった場合は、ボディを取り除かずに
+   * 展開し直し、その旨を展開情報に残す */
+  SourceText source;
+  if (!source.build(data, size, 0)) {
+    return NULL;
+  }
+  efileinfo *info = extractSourceText(source, mapped, html, script, mode,
+                                      &mismatched);
+  if (info) {
+    info->nativeMismatch = true;
+  }
+  return info;
+}
+
+/**
+ * 展開した MHT ファイルの続きを分割して入力する MHT ファイルに渡す
+ *
+ * @param   data
+ *          展開した MHT ファイルの続き
+ * @param   size
+ *          展開した MHT ファイルの続きの長さ
+ * @param   context
+ *          分割して入力する MHT ファイル
+ * @returns 成功したか
+ */
+static int32_t
+feedDecompressed(const char *data, size_t size, void *context) {
+  return feed_extractstream(reinterpret_cast<extractstream *>(context),
+                            data, size);
+}
+
+extern "C" {
+
+efileinfo *
+extract(const char *text, const char *script, int32_t mode) {
+  if (text == NULL) {
+    return NULL;
+  }
+
+  return extractSource(text, strlen(text), false, script, mode);
+}
+
+efileinfo *
+extract_buffer(const char *data, size_t size,
+               const char *script, int32_t mode) {
+  if (data == NULL) {
+    return NULL;
+  }
+
+  return extractSource(data, size, false, script, mode);
+}
+
+efileinfo *
+extract_file(const char *path, const char *script, int32_t mode) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return extractSource("", 0, false, script, mode);
+  }
+
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (isCompressed(reinterpret_cast<const char *>(map), size)) {
+    /* 展開しながら分割して入力する MHT ファイルに渡し、長くなれば
+     * 一時ファイルに書き出す
+     * 展開できなければ圧縮されていないものとして扱う */
+    madvise(map, size, MADV_SEQUENTIAL);
+    extractstream *stream = create_extractstream();
+    if (decompressData(reinterpret_cast<const char *>(map), size,
+                       feedDecompressed, stream)) {
+      munmap(map, size);
+
+      efileinfo *info = finish_extractstream(stream, script, mode);
+      delete_extractstream(stream);
+      /* 位置は展開後のものなので元のファイルからは読めない */
+      if (info) {
+        clearSourceRanges(info);
+      }
+
+      return info;
+    }
+    delete_extractstream(stream);
+  }
+
+  efileinfo *info = extractSource(reinterpret_cast<const char *>(map), size,
+                                  true, script, mode);
+
+  munmap(map, size);
+
+  return info;
+}
+
+extractstream *
+create_extractstream(void) {
+  extractstream *stream = new extractstream();
+  stream->fd = -1;
+  stream->size = 0;
+  stream->failed = false;
+
+  return stream;
+}
+
+int32_t
+feed_extractstream(extractstream *stream, const char *data, size_t size) {
+  if (stream->failed) {
+    return false;
+  }
+
+  if (stream->fd == -1 &&
+      stream->buffer.size() + size > STREAM_MEMORY_SIZE) {
+    /* 長くなったので一時ファイルに移す */
+    stream->fd = createTemporaryFile();
+    if (stream->fd == -1) {
+      stream->failed = true;
+      return false;
+    }
+
+    if (!writeFully(stream->fd, stream->buffer.data(), stream->buffer.size())) {
+      stream->failed = true;
+      return false;
+    }
+    std::string().swap(stream->buffer);
+  }
+
+  if (stream->fd == -1) {
+    stream->buffer.append(data, size);
+  } else if (!writeFully(stream->fd, data, size)) {
+    stream->failed = true;
+    return false;
+  }
+  stream->size += size;
+
+  return true;
+}
+
+efileinfo *
+finish_extractstream(extractstream *stream,
+                     const char *script, int32_t mode) {
+  if (stream->failed) {
+    return NULL;
+  }
+
+  if (stream->fd == -1) {
+    return extractSource(stream->buffer.data(), stream->buffer.size(),
+                         false, script, mode);
+  }
+
+  void *map = mmap(NULL, stream->size, PROT_READ, MAP_PRIVATE, stream->fd, 0);
+  if (map == MAP_FAILED) {
     return NULL;
   }
 
-  js->term();
-  delete js;
+  efileinfo *info = extractSource(reinterpret_cast<const char *>(map),
+                                  stream->size, true, script, mode);
+
+  munmap(map, stream->size);
 
   return info;
 }
 
+void
+delete_extractstream(extractstream *stream) {
+  if (stream->fd != -1) {
+    close(stream->fd);
+  }
+  delete stream;
+}
+
+void
+set_decode_thread_count(uint32_t count) {
+  ThreadPool::setSharedThreadCount(count);
+}
+
+void
+set_native_body_size(size_t size) {
+  nativeBodySize = size;
+}
+
+void
+set_spill_size(size_t size) {
+  spillSize = size;
+}
+
+void
+set_profile_path(const char *path) {
+  std::lock_guard<std::mutex> lock(profileMutex);
+  profilePath = path ? path : "";
+}
+
+void
+release_thread_runtime(void) {
+  pthread_once(&runtimeKeyOnce, createRuntimeKey);
+
+  ThreadRuntime *rt
+    = reinterpret_cast<ThreadRuntime *>(pthread_getspecific(runtimeKey));
+  if (rt) {
+    discardRuntime(rt);
+  }
+}
+
+int32_t
+rebase_efileinfo(efileinfo *info, int32_t cidMode) {
+  if (!cidMode == !info->cidMode) {
+    return true;
+  }
+  if (!info->rebasable) {
+    return false;
+  }
+
+  std::string from(info->baseURI);
+  std::string to(cidMode ? CID_BASE_URI : DUMMY_BASE_URI);
+  char *baseURI = strdup(to.c_str());
+  if (baseURI == NULL) {
+    return false;
+  }
+
+  /* 途中で失敗しても元のままにできるように、
+   * 上書きできないボディの領域を先に全て確保する */
+  struct Rebased {
+    mimepart *part;
+    char *content;
+    size_t size;
+    int fd;
+  };
+  std::vector<Rebased> rebased;
+  bool failed = false;
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    mimepart *p = info->parts[i];
+    if (p->referencesCount == 0 ||
+        p->contentStorage == CONTENT_STORAGE_SHARED) {
+      continue;
+    }
+
+    Rebased r = { p, p->content, splicedSize(p, from.size(), to.size()), -1 };
+    if (p->contentStorage == CONTENT_STORAGE_MAPPED) {
+      r.content = allocateSpill(r.size + 1, &r.fd);
+    } else if (to.size() > from.size()) {
+      r.content = reinterpret_cast<char *>(malloc(r.size + 1));
+    }
+    if (r.content == NULL) {
+      failed = true;
+      break;
+    }
+    rebased.push_back(r);
+  }
+  if (failed) {
+    for (size_t i = 0; i < rebased.size(); i ++) {
+      Rebased &r = rebased[i];
+      if (r.fd != -1) {
+        close(r.fd);
+        releaseSpill(r.content, r.size + 1);
+      } else if (r.content != r.part->content) {
+        free(r.content);
+      }
+    }
+    free(baseURI);
+    return false;
+  }
+
+  /* 共有しているパートのために元の領域と新しい領域を対応付ける */
+  std::unordered_map<const char *, char *> moved;
+  for (size_t i = 0; i < rebased.size(); i ++) {
+    Rebased &r = rebased[i];
+    mimepart *p = r.part;
+    char *old = p->content;
+    size_t oldSize = p->contentSize;
+    spliceReferences(p, from.size(), to, r.content);
+    if (r.fd != -1) {
+      shrinkSpill(r.content, r.size + 1, r.size + 1, r.fd);
+      releaseSpill(old, oldSize + 1);
+    } else if (r.content != old) {
+      free(old);
+    }
+    p->content = r.content;
+    moved[old] = r.content;
+  }
+
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    mimepart *p = info->parts[i];
+    if (p->contentStorage != CONTENT_STORAGE_SHARED) {
+      continue;
+    }
+    auto it = moved.find(p->content);
+    if (it == moved.end()) {
+      continue;
+    }
+
+    /* 共有元と同じ位置に参照があるので、位置と長さは計算で求まる */
+    size_t size = splicedSize(p, from.size(), to.size());
+    for (size_t j = 0; j < p->referencesCount; j ++) {
+      p->references[j] = p->references[j] - j * from.size() + j * to.size();
+    }
+    info->dedupSavedSize += size;
+    info->dedupSavedSize -= p->contentSize;
+    p->content = it->second;
+    p->contentSize = size;
+  }
+
+  free(info->baseURI);
+  info->baseURI = baseURI;
+  info->cidMode = cidMode != 0;
+
+  return true;
+}
+
 void
 delete_efileinfo(efileinfo *info) {
   if (info->parts) {
-    for (int32_t i = 0; i < info->partsCount; i ++) {
+    for (size_t i = 0; i < info->partsCount; i ++) {
       mimepart *p = info->parts[i];
       if (p) {
         if (p->charset != NULL) {
@@ -471,9 +2221,24 @@ delete_efileinfo(efileinfo *info) {
         if (p->cid != NULL) {
           free(p->cid);
         }
-        if (p->content != NULL) {
+        if (p->location != NULL) {
+          free(p->location);
+        }
+        if (p->transferEncoding != NULL) {
+          free(p->transferEncoding);
+        }
+        if (p->content != NULL &&
+            p->contentStorage == CONTENT_STORAGE_OWNED) {
           free(p->content);
         }
+        if (p->content != NULL &&
+            p->contentStorage == CONTENT_STORAGE_MAPPED) {
+          /* NUL の分も含めてマップしている */
+          releaseSpill(p->content, p->contentSize + 1);
+        }
+        if (p->references != NULL) {
+          free(p->references);
+        }
 
         free(p);
       }
@@ -42,6 +42,19 @@
 extern "C" {
 #endif
 
+/**
+ * ボディの領域の管理方法
+ */
+typedef enum {
+  CONTENT_STORAGE_OWNED = 0, /* パートが所有する */
+  CONTENT_STORAGE_SHARED,    /* 内容が同じ他のパートと共有する */
+  CONTENT_STORAGE_PRUNED,    /* 開始パートから参照されないので展開していない
+                              * content は NULL
+                              * 必要ならば元のファイル中の位置からデコードする */
+  CONTENT_STORAGE_MAPPED     /* 長いので削除済みの一時ファイルに書き出して
+                              * マップした領域をパートが所有する */
+} contentstorage;
+
 /**
  * MIME の各パート
  */
@@ -49,9 +62,22 @@ typedef struct {
   char *charset;      /* Content-Type フィールドの charset */
   char *mimetype;     /* Content-Type フィールドの MIME-Type */
   char *cid;          /* Content-ID フィールド */
+  char *location;     /* 解決済みの Content-Location フィールド */
 
   char *content;      /* ボディ */
   size_t contentSize; /* ボディの長さ */
+  contentstorage contentStorage; /* ボディの領域の管理方法 */
+
+  char *transferEncoding; /* Content-Transfer-Encoding フィールド */
+  int64_t headerOffset;   /* 元のファイル中のヘッダの位置
+                           * 不明ならば -1 */
+  size_t headerSize;      /* ヘッダの長さ (空行を含む) */
+  int64_t bodyOffset;     /* 元のファイル中のエンコードされたボディの位置
+                           * 不明ならば -1 */
+  size_t bodySize;        /* エンコードされたボディの長さ */
+
+  size_t *references;     /* ボディ中の参照の起点となる URI の位置 */
+  size_t referencesCount; /* 参照の数 */
 } mimepart;
 
 /**
@@ -64,23 +90,163 @@ typedef struct {
   mimepart *startPart; /* 開始パート */
 
   mimepart **parts;    /* パート */
-  uint32_t partsCount; /* パートの数 */
+  size_t partsCount;   /* パートの数 */
+
+  size_t dedupSavedSize; /* 重複したボディを共有して節約したバイト数 */
+
+  int32_t cidMode;       /* 参照に cid を使用しているか */
+  int32_t rebasable;     /* 参照の位置を記録していて
+                          * rebase_efileinfo で参照の形式を切り替えられるか */
+  int32_t nativeMismatch; /* JavaScript に渡さなかったボディとパートの
+                           * 対応が取れず、ボディを渡して展開し直したか */
 } efileinfo;
 
+/**
+ * 展開の指定
+ * extract 系の関数の mode に論理和で指定する
+ */
+enum {
+  EXTRACT_CID = 1,  /* 参照に cid を使用する
+                     * 指定しなければ参照にダミーの URL を使用する */
+  EXTRACT_PRUNE = 2, /* 開始パートから参照を辿れるパートのみ展開する
+                      * HTML の属性と CSS の url(), @import で参照される
+                      * パートを辿り、辿れなかったパートはデコードも
+                      * 参照の変換もせずに contentStorage を
+                      * CONTENT_STORAGE_PRUNED にする */
+  EXTRACT_REBASABLE = 4 /* 参照の位置を記録して rebasable にする
+                         * rebase_efileinfo で参照の形式を切り替える場合に
+                         * 指定する
+                         * 指定しなければ参照の置き換えと位置の記録を省く */
+};
+
 /**
  * MHT ファイルを展開する
  *
+ * extract 系の関数は複数のスレッドから同時に呼び出せる
+ * JavaScript の実行環境はスレッド毎に作成し、以降の呼び出しで使い回す
+ * 実行環境はスレッドの終了時か release_thread_runtime で開放する
+ *
  * @param   text
  *          MHT ファイルの文字列
  * @param   script
  *          ql_unmht.js の内容
- * @param   cidMode
- *          true ならば参照に cid を使用するか
- *          false ならば参照にダミーの URL を使用する
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
  * @returns MHT ファイルの展開情報
  */
 efileinfo *
-extract(const char *text, const char *script, int32_t cidMode);
+extract(const char *text, const char *script, int32_t mode);
+
+/**
+ * メモリ上の MHT ファイルを展開する
+ * NUL で終端している必要は無い
+ * 長いボディは JavaScript に渡さずに直接デコードする
+ *
+ * @param   data
+ *          MHT ファイルの内容
+ * @param   size
+ *          MHT ファイルの長さ
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @returns MHT ファイルの展開情報
+ *          失敗したら NULL
+ */
+efileinfo *
+extract_buffer(const char *data, size_t size,
+               const char *script, int32_t mode);
+
+/**
+ * MHT ファイルをマップして展開する
+ * gzip 形式か zlib 形式で圧縮されていれば、分割して入力する MHT ファイルと
+ * 同様に長くなったら一時ファイルに書き出しながら展開してから展開する
+ * その場合はパートの元のファイル中の位置は不明 (-1) になる
+ *
+ * @param   path
+ *          MHT ファイルのパス
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @returns MHT ファイルの展開情報
+ *          失敗したら NULL
+ */
+efileinfo *
+extract_file(const char *path, const char *script, int32_t mode);
+
+/**
+ * 分割して入力する MHT ファイル
+ */
+typedef struct extractstream extractstream;
+
+/**
+ * 分割して入力する MHT ファイルを作成する
+ * 入力が長くなったら一時ファイルに書き出す
+ *
+ * @returns 分割して入力する MHT ファイル
+ *          失敗したら NULL
+ */
+extractstream *
+create_extractstream(void);
+
+/**
+ * MHT ファイルの続きを入力する
+ *
+ * @param   stream
+ *          分割して入力する MHT ファイル
+ * @param   data
+ *          MHT ファイルの続きの内容
+ * @param   size
+ *          MHT ファイルの続きの長さ
+ * @returns 成功したか
+ */
+int32_t
+feed_extractstream(extractstream *stream, const char *data, size_t size);
+
+/**
+ * 入力した MHT ファイルを展開する
+ *
+ * @param   stream
+ *          分割して入力する MHT ファイル
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   mode
+ *          展開の指定 (EXTRACT_CID 等の論理和)
+ * @returns MHT ファイルの展開情報
+ *          失敗したら NULL
+ */
+efileinfo *
+finish_extractstream(extractstream *stream,
+                     const char *script, int32_t mode);
+
+/**
+ * 分割して入力する MHT ファイルを開放する
+ *
+ * @param   stream
+ *          分割して入力する MHT ファイル
+ */
+void
+delete_extractstream(extractstream *stream);
+
+/**
+ * 展開済みの MHT ファイルの参照の形式を切り替える
+ * 展開時に記録した位置で参照の起点となる URI を置き換えるので、
+ * ql_unmht.js は実行しない
+ * baseURI と各パートのボディ、参照の位置を更新する
+ * パートを指さない相対パスは展開時の形式を基準に解決したまま変わらない
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ * @param   cidMode
+ *          true ならば参照に cid を使用する
+ *          false ならば参照にダミーの URL を使用する
+ * @returns 成功したか
+ *          参照の位置を記録していない (EXTRACT_REBASABLE を指定せずに
+ *          展開して rebasable が false の) 場合は同じ形式でなければ失敗する
+ */
+int32_t
+rebase_efileinfo(efileinfo *info, int32_t cidMode);
 
 /**
  * MHT ファイルの展開情報を開放する
@@ -91,6 +257,60 @@ extract(const char *text, const char *script, int32_t cidMode);
 void
 delete_efileinfo(efileinfo *info);
 
+/**
+ * パートのデコードに使用するスレッド数を設定する
+ *
+ * @param   count
+ *          スレッド数
+ *          0 ならば CPU の数 (既定値), 1 ならばスレッドを使用しない
+ */
+void
+set_decode_thread_count(uint32_t count);
+
+/**
+ * JavaScript に渡さずに直接デコードするボディの長さを設定する
+ * HTML, CSS, テキストのボディは長さに関わらず JavaScript に渡す
+ *
+ * @param   size
+ *          ボディの長さの閾値 (既定値は 1MB)
+ *          0 ならば全て JavaScript に渡す
+ */
+void
+set_native_body_size(size_t size);
+
+/**
+ * 一時ファイルに移すボディの長さを設定する
+ * これより長いボディは削除済みの一時ファイルをマップした領域に置き、
+ * contentStorage を CONTENT_STORAGE_MAPPED にする
+ * 直接デコードするボディは一時ファイルに直接デコードする
+ *
+ * @param   size
+ *          ボディの長さの閾値 (既定値は 64MB)
+ *          0 ならば全てメモリ上に置く
+ */
+void
+set_spill_size(size_t size);
+
+/**
+ * ql_unmht.js の関数毎の実行時間を計測してファイルに追記する
+ * path には flamegraph.pl に渡せる折り畳んだ呼び出し列 (マイクロ秒) を、
+ * path.functions には関数毎の呼び出し回数と自身の時間と合計時間を書き出す
+ * 計測中は関数の呼び出しが遅くなる
+ *
+ * @param   path
+ *          計測結果を書き出すファイルのパス
+ *          NULL ならば計測しない (既定値)
+ */
+void
+set_profile_path(const char *path);
+
+/**
+ * 呼び出したスレッドの JavaScript の実行環境を開放する
+ * 次に展開する時は作り直す
+ */
+void
+release_thread_runtime(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,600 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#include "utf8.h"
+
+#include <stdlib.h>
+#include <strings.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSSE3__) || defined(__aarch64__)
+#define UTF8_SIMD 1
+#endif
+
+/**
+ * 先頭から続く ASCII の文字の数を数える
+ * SSE2 か NEON があれば 16 バイト単位で調べる
+ *
+ * @param   p
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @returns ASCII の文字の数
+ */
+static size_t
+asciiPrefix(const unsigned char *p, size_t length) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 32 <= length; i += 32) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + 16));
+    if (_mm_movemask_epi8(_mm_or_si128(a, b))) {
+      break;
+    }
+  }
+  for (; i + 16 <= length; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    if (_mm_movemask_epi8(a)) {
+      break;
+    }
+  }
+#elif defined(__aarch64__)
+  for (; i + 32 <= length; i += 32) {
+    uint8x16_t a = vld1q_u8(p + i);
+    uint8x16_t b = vld1q_u8(p + i + 16);
+    if (vmaxvq_u8(vorrq_u8(a, b)) & 0x80) {
+      break;
+    }
+  }
+  for (; i + 16 <= length; i += 16) {
+    if (vmaxvq_u8(vld1q_u8(p + i)) & 0x80) {
+      break;
+    }
+  }
+#endif
+
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, 8);
+    if (word & 0x8080808080808080ULL) {
+      break;
+    }
+  }
+  while (i < length && p[i] < 0x80) {
+    i ++;
+  }
+
+  return i;
+}
+
+#if defined(UTF8_SIMD)
+
+/*
+ * 16 バイト単位の UTF-8 の検証
+ * 各バイトとその直前のバイトの上位 4 ビットと下位 4 ビットから、
+ * 3 つの表を引いて誤りの種類のビットの論理積を取る
+ * (Keiser, Lemire: "Validating UTF-8 In Less Than One Instruction Per Byte")
+ * 3 バイト目と 4 バイト目が後続バイトであることは別に調べる
+ */
+
+/* 誤りの種類 */
+#define UTF8_TOO_SHORT      (1 << 0) /* 先頭バイトの後に後続バイトが無い */
+#define UTF8_TOO_LONG       (1 << 1) /* ASCII の後に後続バイトがある */
+#define UTF8_OVERLONG_3     (1 << 2) /* 3 バイトの冗長な表現 */
+#define UTF8_TOO_LARGE      (1 << 3) /* U+10FFFF より大きい */
+#define UTF8_SURROGATE      (1 << 4) /* サロゲート */
+#define UTF8_OVERLONG_2     (1 << 5) /* 2 バイトの冗長な表現 */
+#define UTF8_TOO_LARGE_1000 (1 << 6) /* U+10FFFF より大きい (F4 90 以上) */
+#define UTF8_OVERLONG_4     (1 << 6) /* 4 バイトの冗長な表現 */
+#define UTF8_TWO_CONTS      (1 << 7) /* 後続バイトが 2 つ続く */
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/* 直前のバイトの上位 4 ビットから引く表 */
+static const uint8_t utf8Byte1High[16] = {
+  /* 0_______ ASCII */
+  UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+  UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+  /* 10______ 後続バイト */
+  UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+  /* 1100____ 2 バイトの先頭 */
+  UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+  /* 1101____ 2 バイトの先頭 */
+  UTF8_TOO_SHORT,
+  /* 1110____ 3 バイトの先頭 */
+  UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+  /* 1111____ 4 バイトの先頭 */
+  UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
+
+/* 直前のバイトの下位 4 ビットから引く表 */
+static const uint8_t utf8Byte1Low[16] = {
+  /* ____0000 */
+  UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+  /* ____0001 */
+  UTF8_CARRY | UTF8_OVERLONG_2,
+  /* ____001_ */
+  UTF8_CARRY,
+  UTF8_CARRY,
+  /* ____0100 */
+  UTF8_CARRY | UTF8_TOO_LARGE,
+  /* ____0101 以降 */
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  /* ____1101 */
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+  UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+/* そのバイトの上位 4 ビットから引く表 */
+static const uint8_t utf8Byte2High[16] = {
+  /* 0_______ ASCII */
+  UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+  UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+  /* 1000____ */
+  UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+  UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+  /* 1001____ */
+  UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+  UTF8_TOO_LARGE,
+  /* 101_____ */
+  UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+  UTF8_TOO_LARGE,
+  UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+  UTF8_TOO_LARGE,
+  /* 11______ 先頭バイト */
+  UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+/* 末尾で文字が終わっていないかを調べるための、各位置で許す最大のバイト */
+static const uint8_t utf8MaxTail[16] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+};
+
+#if defined(__SSSE3__)
+
+typedef __m128i utf8vec;
+
+static inline utf8vec
+vecLoad(const uint8_t *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+static inline utf8vec
+vecZero(void) {
+  return _mm_setzero_si128();
+}
+
+static inline utf8vec
+vecOr(utf8vec a, utf8vec b) {
+  return _mm_or_si128(a, b);
+}
+
+static inline bool
+vecIsASCII(utf8vec a) {
+  return _mm_movemask_epi8(a) == 0;
+}
+
+static inline bool
+vecIsZero(utf8vec a) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) == 0xffff;
+}
+
+static inline utf8vec
+vecSubSaturated(utf8vec a, utf8vec b) {
+  return _mm_subs_epu8(a, b);
+}
+
+/**
+ * 16 バイトの検証の誤りを返す
+ *
+ * @param   input
+ *          対象の 16 バイト
+ * @param   prev
+ *          直前の 16 バイト
+ * @returns 誤りがあれば 0 以外のバイトを含む
+ */
+static inline utf8vec
+vecCheckBlock(utf8vec input, utf8vec prev) {
+  const utf8vec low = _mm_set1_epi8(0x0f);
+  utf8vec prev1 = _mm_alignr_epi8(input, prev, 15);
+  utf8vec prev2 = _mm_alignr_epi8(input, prev, 14);
+  utf8vec prev3 = _mm_alignr_epi8(input, prev, 13);
+
+  utf8vec byte1High = _mm_shuffle_epi8(
+    vecLoad(utf8Byte1High), _mm_and_si128(_mm_srli_epi16(prev1, 4), low));
+  utf8vec byte1Low = _mm_shuffle_epi8(
+    vecLoad(utf8Byte1Low), _mm_and_si128(prev1, low));
+  utf8vec byte2High = _mm_shuffle_epi8(
+    vecLoad(utf8Byte2High), _mm_and_si128(_mm_srli_epi16(input, 4), low));
+  utf8vec special = _mm_and_si128(_mm_and_si128(byte1High, byte1Low),
+                                  byte2High);
+
+  /* 2 つ前か 3 つ前が 3 バイトか 4 バイトの先頭ならば後続バイトが必要 */
+  utf8vec third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80));
+  utf8vec fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80));
+  utf8vec must23 = _mm_and_si128(_mm_or_si128(third, fourth),
+                                 _mm_set1_epi8(static_cast<char>(0x80)));
+
+  return _mm_xor_si128(must23, special);
+}
+
+#elif defined(__aarch64__)
+
+typedef uint8x16_t utf8vec;
+
+static inline utf8vec
+vecLoad(const uint8_t *p) {
+  return vld1q_u8(p);
+}
+
+static inline utf8vec
+vecZero(void) {
+  return vdupq_n_u8(0);
+}
+
+static inline utf8vec
+vecOr(utf8vec a, utf8vec b) {
+  return vorrq_u8(a, b);
+}
+
+static inline bool
+vecIsASCII(utf8vec a) {
+  return vmaxvq_u8(a) < 0x80;
+}
+
+static inline bool
+vecIsZero(utf8vec a) {
+  return vmaxvq_u8(a) == 0;
+}
+
+static inline utf8vec
+vecSubSaturated(utf8vec a, utf8vec b) {
+  return vqsubq_u8(a, b);
+}
+
+/**
+ * 16 バイトの検証の誤りを返す
+ *
+ * @param   input
+ *          対象の 16 バイト
+ * @param   prev
+ *          直前の 16 バイト
+ * @returns 誤りがあれば 0 以外のバイトを含む
+ */
+static inline utf8vec
+vecCheckBlock(utf8vec input, utf8vec prev) {
+  utf8vec prev1 = vextq_u8(prev, input, 15);
+  utf8vec prev2 = vextq_u8(prev, input, 14);
+  utf8vec prev3 = vextq_u8(prev, input, 13);
+
+  utf8vec byte1High = vqtbl1q_u8(vld1q_u8(utf8Byte1High),
+                                 vshrq_n_u8(prev1, 4));
+  utf8vec byte1Low = vqtbl1q_u8(vld1q_u8(utf8Byte1Low),
+                                vandq_u8(prev1, vdupq_n_u8(0x0f)));
+  utf8vec byte2High = vqtbl1q_u8(vld1q_u8(utf8Byte2High),
+                                 vshrq_n_u8(input, 4));
+  utf8vec special = vandq_u8(vandq_u8(byte1High, byte1Low), byte2High);
+
+  /* 2 つ前か 3 つ前が 3 バイトか 4 バイトの先頭ならば後続バイトが必要 */
+  utf8vec third = vqsubq_u8(prev2, vdupq_n_u8(0xe0 - 0x80));
+  utf8vec fourth = vqsubq_u8(prev3, vdupq_n_u8(0xf0 - 0x80));
+  utf8vec must23 = vandq_u8(vorrq_u8(third, fourth), vdupq_n_u8(0x80));
+
+  return veorq_u8(must23, special);
+}
+
+#endif
+
+/**
+ * ASCII でないバイトから始まる UTF-8 の文字列を 16 バイト単位で検証する
+ * 直前は ASCII なので、直前の 16 バイトを 0 として始める
+ *
+ * @param   p
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @returns 正しい UTF-8 か
+ */
+static bool
+validateUTF8Blocks(const unsigned char *p, size_t length) {
+  const utf8vec maxTail = vecLoad(utf8MaxTail);
+  utf8vec prev = vecZero();
+  utf8vec incomplete = vecZero();
+  utf8vec error = vecZero();
+
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    utf8vec input = vecLoad(p + i);
+    if (vecIsASCII(input)) {
+      /* 直前の 16 バイトの末尾で文字が終わっていなければ誤り */
+      error = vecOr(error, incomplete);
+      incomplete = vecZero();
+    } else {
+      error = vecOr(error, vecCheckBlock(input, prev));
+      incomplete = vecSubSaturated(input, maxTail);
+    }
+    prev = input;
+
+    /* 誤りがあれば早めに打ち切る */
+    if ((i & 0x3ff) == 0x3f0 && !vecIsZero(error)) {
+      return false;
+    }
+  }
+
+  /* 末尾の端数は 0 で埋めて調べる
+   * 0 は ASCII なので、文字が途中で終わっていれば誤りになる */
+  uint8_t last[16];
+  memset(last, 0, sizeof(last));
+  memcpy(last, p + i, length - i);
+  utf8vec input = vecLoad(last);
+  error = vecOr(error, vecCheckBlock(input, prev));
+  error = vecOr(error, vecSubSaturated(input, maxTail));
+
+  return vecIsZero(error);
+}
+
+#endif
+
+/**
+ * UTF-8 の文字列を検証する
+ *
+ * @param   text
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @param   ascii
+ *          (出力) ASCII のみか
+ * @returns 正しい UTF-8 か
+ */
+static bool
+validateUTF8(const char *text, size_t length, bool *ascii) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(text);
+  size_t i = asciiPrefix(p, length);
+  *ascii = i == length;
+
+#if defined(UTF8_SIMD)
+  if (i < length) {
+    return validateUTF8Blocks(p + i, length - i);
+  }
+#endif
+
+  while (i < length) {
+    unsigned char c = p[i];
+    if (c < 0x80) {
+      i += asciiPrefix(p + i, length - i);
+      continue;
+    }
+
+    if (c < 0xc2) {
+      /* 後続バイトか、2 バイトの冗長な表現 */
+      return false;
+    } else if (c < 0xe0) {
+      if (i + 1 >= length || (p[i + 1] & 0xc0) != 0x80) {
+        return false;
+      }
+      i += 2;
+    } else if (c < 0xf0) {
+      if (i + 2 >= length ||
+          (p[i + 1] & 0xc0) != 0x80 || (p[i + 2] & 0xc0) != 0x80) {
+        return false;
+      }
+      if ((c == 0xe0 && p[i + 1] < 0xa0) ||
+          (c == 0xed && p[i + 1] >= 0xa0)) {
+        /* 冗長な表現かサロゲート */
+        return false;
+      }
+      i += 3;
+    } else if (c < 0xf5) {
+      if (i + 3 >= length ||
+          (p[i + 1] & 0xc0) != 0x80 || (p[i + 2] & 0xc0) != 0x80 ||
+          (p[i + 3] & 0xc0) != 0x80) {
+        return false;
+      }
+      if ((c == 0xf0 && p[i + 1] < 0x90) ||
+          (c == 0xf4 && p[i + 1] >= 0x90)) {
+        /* 冗長な表現か U+10FFFF より大きい */
+        return false;
+      }
+      i += 4;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+extern "C" {
+
+int32_t
+isASCII(const char *text, size_t length) {
+  return asciiPrefix(reinterpret_cast<const unsigned char *>(text), length)
+    == length;
+}
+
+int32_t
+isASCIIUTF16(const unsigned short *text, size_t length) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i mask = _mm_set1_epi16(static_cast<short>(0xff80));
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= length; i += 8) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+    a = _mm_and_si128(a, mask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(a, zero)) != 0xffff) {
+      return false;
+    }
+  }
+#elif defined(__aarch64__)
+  for (; i + 8 <= length; i += 8) {
+    if (vmaxvq_u16(vld1q_u16(text + i)) >= 0x80) {
+      return false;
+    }
+  }
+#endif
+
+  for (; i < length; i ++) {
+    if (text[i] >= 0x80) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int32_t
+isValidUTF8(const char *text, size_t length) {
+  bool ascii;
+  return validateUTF8(text, length, &ascii);
+}
+
+int32_t
+isUTF8Charset(const char *charset) {
+  if (charset == NULL) {
+    return false;
+  }
+  return strcasecmp(charset, "utf-8") == 0 || strcasecmp(charset, "utf8") == 0;
+}
+
+int32_t
+isASCIICompatibleCharset(const char *charset) {
+  static const char *incompatibles[] = {
+    "utf-16", "utf-32", "ucs-2", "ucs-4", "utf-7", "hz-gb-2312", NULL
+  };
+  if (charset == NULL) {
+    return false;
+  }
+  for (int i = 0; incompatibles[i]; i ++) {
+    if (strncasecmp(charset, incompatibles[i], strlen(incompatibles[i])) == 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+textkind
+checkText(const char *text, size_t length, const char *charset) {
+  if (isUTF8Charset(charset)) {
+    bool ascii;
+    if (!validateUTF8(text, length, &ascii)) {
+      return TEXT_KIND_OTHER;
+    }
+    return ascii ? TEXT_KIND_ASCII : TEXT_KIND_UTF8;
+  }
+
+  if (isASCIICompatibleCharset(charset) &&
+      isASCII(text, length) &&
+      memchr(text, 0x1b, length) == NULL) {
+    return TEXT_KIND_ASCII;
+  }
+
+  return TEXT_KIND_OTHER;
+}
+
+int32_t
+decodeUTF8(const char *text, size_t length,
+           unsigned short **result, size_t *resultLength) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(text);
+  unsigned short *out = reinterpret_cast<unsigned short *>
+    (malloc(sizeof(unsigned short) * (length + 1)));
+  if (out == NULL) {
+    return false;
+  }
+
+  size_t i = 0, j = 0;
+  while (i < length) {
+    /* ASCII はそのまま広げる */
+    size_t n = asciiPrefix(p + i, length - i);
+    for (size_t k = 0; k < n; k ++) {
+      out[j + k] = p[i + k];
+    }
+    i += n;
+    j += n;
+    if (i >= length) {
+      break;
+    }
+
+    unsigned char c = p[i];
+    uint32_t code;
+    if (c < 0xe0 && i + 1 < length) {
+      code = ((c & 0x1f) << 6) | (p[i + 1] & 0x3f);
+      i += 2;
+    } else if (c < 0xf0 && i + 2 < length) {
+      code = ((c & 0x0f) << 12) | ((p[i + 1] & 0x3f) << 6) | (p[i + 2] & 0x3f);
+      i += 3;
+    } else if (i + 3 < length) {
+      code = ((c & 0x07) << 18) | ((p[i + 1] & 0x3f) << 12)
+        | ((p[i + 2] & 0x3f) << 6) | (p[i + 3] & 0x3f);
+      i += 4;
+    } else {
+      free(out);
+      return false;
+    }
+
+    if (code >= 0x10000) {
+      code -= 0x10000;
+      out[j ++] = 0xd800 + (code >> 10);
+      out[j ++] = 0xdc00 + (code & 0x3ff);
+    } else {
+      out[j ++] = code;
+    }
+  }
+  out[j] = 0;
+
+  *result = out;
+  *resultLength = j;
+
+  return true;
+}
+
+}
@@ -0,0 +1,153 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef __utf8_h_included__
+#define __utf8_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 変換せずに扱える文字列の種類
+ */
+typedef enum {
+  TEXT_KIND_OTHER = 0, /* 変換が必要 */
+  TEXT_KIND_ASCII,     /* ASCII のみ */
+  TEXT_KIND_UTF8       /* 正しい UTF-8 */
+} textkind;
+
+/**
+ * ASCII のみの文字列か
+ *
+ * @param   text
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @returns ASCII のみか
+ */
+int32_t
+isASCII(const char *text, size_t length);
+
+/**
+ * ASCII のみの UTF16 の文字列か
+ *
+ * @param   text
+ *          UTF16 の文字列
+ * @param   length
+ *          UTF16 の文字列の長さ
+ * @returns ASCII のみか
+ */
+int32_t
+isASCIIUTF16(const unsigned short *text, size_t length);
+
+/**
+ * 正しい UTF-8 の文字列か
+ * 冗長な表現、サロゲート、U+10FFFF より大きい文字は不正とする
+ *
+ * @param   text
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @returns 正しい UTF-8 か
+ */
+int32_t
+isValidUTF8(const char *text, size_t length);
+
+/**
+ * UTF-8 の charset 名か
+ *
+ * @param   charset
+ *          charset 名
+ *          NULL ならば偽を返す
+ * @returns UTF-8 か
+ */
+int32_t
+isUTF8Charset(const char *charset);
+
+/**
+ * ASCII の範囲の文字を ASCII と同じバイトで表すエンコーディングか
+ *
+ * @param   charset
+ *          charset 名
+ *          NULL ならば偽を返す
+ * @returns ASCII 互換か
+ */
+int32_t
+isASCIICompatibleCharset(const char *charset);
+
+/**
+ * 指定したエンコーディングの文字列を変換せずに UTF-8 として扱えるかを調べる
+ * ASCII 互換のエンコーディングで ASCII のみの場合と、
+ * UTF-8 で正しい UTF-8 の場合は変換が不要
+ * ISO-2022 系のエスケープシーケンスを含む場合は ASCII とみなさない
+ *
+ * @param   text
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @param   charset
+ *          対象の文字列のエンコーディング
+ *          NULL ならば不明として変換が必要とする
+ * @returns 文字列の種類
+ */
+textkind
+checkText(const char *text, size_t length, const char *charset);
+
+/**
+ * 正しい UTF-8 の文字列を UTF16 に変換する
+ *
+ * @param   text
+ *          正しい UTF-8 の文字列
+ * @param   length
+ *          UTF-8 の文字列の長さ
+ * @param   result
+ *          (出力) 変換した文字列
+ * @param   resultLength
+ *          (出力) 変換した文字列の長さ
+ * @returns 成功したか
+ */
+int32_t
+decodeUTF8(const char *text, size_t length,
+           unsigned short **result, size_t *resultLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __utf8_h_included__ */
@@ -35,7 +35,10 @@
 #import <CoreFoundation/CoreFoundation.h>
 #import <CoreServices/CoreServices.h>
 #import <Foundation/Foundation.h>
+#import <conv.h>
+#import <htmltext.h>
 #import <unmht.h>
+#import <utf8.h>
 
 /**
  * 文字列を NSString に変換する
@@ -50,8 +53,15 @@
  *            失敗したら nil
  */
 NSString *
-convertToNSString(const char *text, uint32_t length,
+convertToNSString(const char *text, size_t length,
                   const char *charset) {
+  if (checkText(text, length, charset) != TEXT_KIND_OTHER) {
+    /* UTF-8 として読めるので charset を調べずに変換する */
+    return [[NSString alloc] initWithBytes: text
+                                    length: length
+                                  encoding: NSUTF8StringEncoding];
+  }
+
   NSString *charsetString= [[NSString alloc]
                              initWithCString: charset
                                     encoding: NSASCIIStringEncoding];
@@ -67,6 +77,54 @@ convertToNSString(const char *text, uint32_t length,
                                 encoding: encoding];
 }
 
+/**
+ * HTML のパートか
+ *
+ * @param   part
+ *          パート
+ * @returns HTML のパートか
+ */
+static BOOL
+isHTMLPart(const mimepart *part) {
+  return part->mimetype &&
+    (strcasecmp(part->mimetype, "text/html") == 0 ||
+     strcasecmp(part->mimetype, "application/xhtml+xml") == 0);
+}
+
+/**
+ * HTML のパートからテキストを取り出して NSString に変換する
+ * タグ、コメント、script 要素、style 要素を取り除く
+ *
+ * @param   part
+ *          HTML のパート
+ * @returns 変換した NSString
+ *            失敗したら nil
+ */
+static NSString *
+convertHTMLToNSString(const mimepart *part) {
+  char *utf8 = NULL;
+  size_t utf8Size = 0;
+  if (!convertToUTF8(part->content, part->contentSize, part->charset,
+                     &utf8, &utf8Size)) {
+    return nil;
+  }
+
+  char *text = NULL;
+  size_t textSize = 0;
+  int32_t result = html_to_text(utf8, utf8Size, &text, &textSize);
+  free(utf8);
+  if (!result) {
+    return nil;
+  }
+
+  NSString *textString = [[NSString alloc] initWithBytes: text
+                                                  length: textSize
+                                                encoding: NSUTF8StringEncoding];
+  free(text);
+
+  return textString;
+}
+
 /**
  * ファイルのメタデータを取得する
  *
@@ -89,22 +147,16 @@ GetMetadataForFile(void* thisInterface,
   NSURL *scriptURL = [bundle URLForResource: @"ql_unmht"
                               withExtension: @"js"];
 
-  NSString *fileData = [[NSString alloc]
-                         initWithContentsOfFile: (NSString *)pathToFile
-                                       encoding: NSUTF8StringEncoding
-                                          error: (NSError **)NULL];
-
   NSString *scriptData = [[NSString alloc]
                            initWithContentsOfURL: scriptURL
                                         encoding: NSUTF8StringEncoding
                                            error: (NSError **)NULL];
 
-  efileinfo *eFileInfo = extract([fileData
-                                   cStringUsingEncoding: NSUTF8StringEncoding],
-                                 [scriptData
-                                   cStringUsingEncoding: NSUTF8StringEncoding],
-                                 TRUE);
-  [fileData release];
+  efileinfo *eFileInfo = extract_file([(NSString *)pathToFile
+                                        fileSystemRepresentation],
+                                      [scriptData
+                                        cStringUsingEncoding: NSUTF8StringEncoding],
+                                      TRUE);
   [scriptData release];
   if (!eFileInfo) {
     return FALSE;
@@ -112,13 +164,26 @@ GetMetadataForFile(void* thisInterface,
 
   NSMutableString *content = [NSMutableString string];
 
-  for (int i = 0; i < eFileInfo->partsCount; i ++) {
+  for (size_t i = 0; i < eFileInfo->partsCount; i ++) {
     mimepart *part = eFileInfo->parts[i];
+    if (part->contentStorage == CONTENT_STORAGE_SHARED) {
+      /* 同じ内容のパートは追加済み */
+      continue;
+    }
 
-    NSString *partContent = convertToNSString(part->content,
-                                              part->contentSize,
-                                              part->charset);
+    NSString *partContent = nil;
+    if (isHTMLPart(part)) {
+      partContent = convertHTMLToNSString(part);
+    }
+    if (partContent == nil) {
+      partContent = convertToNSString(part->content,
+                                      part->contentSize,
+                                      part->charset);
+    }
     if (partContent != nil) {
+      if ([content length] > 0) {
+        [content appendString: @" "];
+      }
       [content appendString: partContent];
       [partContent release];
     }
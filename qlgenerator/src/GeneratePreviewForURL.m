@@ -69,23 +69,18 @@ GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview,
                                                CFSTR("ql_unmht"), CFSTR("js"),
                                                NULL);
 
-  NSString *fileData = [[[NSString alloc]
-                          initWithContentsOfURL: (NSURL *)url
-                                       encoding: NSUTF8StringEncoding
-                                          error: (NSError **)NULL]
-                         autorelease];
-
   NSString *scriptData = [[[NSString alloc]
                             initWithContentsOfURL: (NSURL *)scriptURL
                                          encoding: NSUTF8StringEncoding
                                             error: (NSError **)NULL]
                            autorelease];
 
-  efileinfo *eFileInfo = extract([fileData
-                                   cStringUsingEncoding: NSUTF8StringEncoding],
-                                 [scriptData
-                                   cStringUsingEncoding: NSUTF8StringEncoding],
-                                 TRUE);
+  /* プレビューに表示されないパートは展開しない */
+  efileinfo *eFileInfo = extract_file([[(NSURL *)url path]
+                                        fileSystemRepresentation],
+                                      [scriptData
+                                        cStringUsingEncoding: NSUTF8StringEncoding],
+                                      EXTRACT_CID | EXTRACT_PRUNE);
   if (!eFileInfo) {
     [pool release];
     return noErr;
@@ -123,8 +118,11 @@ GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview,
   /* 添付ファイルの設定 */
   NSMutableDictionary *attachment = [[[NSMutableDictionary alloc] init]
                                       autorelease];
-  for (int i = 0; i < eFileInfo->partsCount; i ++) {
+  for (size_t i = 0; i < eFileInfo->partsCount; i ++) {
     mimepart *part = eFileInfo->parts[i];
+    if (part->contentStorage == CONTENT_STORAGE_PRUNED) {
+      continue;
+    }
 
     NSMutableDictionary *attachmentProperties = [[[NSMutableDictionary alloc]
                                                    init]
@@ -96,23 +96,18 @@ GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thumbnail,
                                                NULL);
 
   /* mht の展開 */
-  NSString *fileData = [[[NSString alloc]
-                          initWithContentsOfURL: (NSURL *)url
-                                       encoding: NSUTF8StringEncoding
-                                          error: (NSError **)NULL]
-                         autorelease];
-
   NSString *scriptData= [[[NSString alloc]
                            initWithContentsOfURL: (NSURL *)scriptURL
                                         encoding: NSUTF8StringEncoding
                                            error: (NSError **)NULL]
                           autorelease];
 
-  efileinfo *eFileInfo = extract([fileData
-                                   cStringUsingEncoding: NSUTF8StringEncoding],
-                                 [scriptData
-                                   cStringUsingEncoding: NSUTF8StringEncoding],
-                                 FALSE);
+  /* サムネイルに表示されないパートは展開しない */
+  efileinfo *eFileInfo = extract_file([[(NSURL *)url path]
+                                        fileSystemRepresentation],
+                                      [scriptData
+                                        cStringUsingEncoding: NSUTF8StringEncoding],
+                                      EXTRACT_PRUNE);
   if (!eFileInfo) {
     /* 対応していない mht ファイル
      * もしくは異常な mht ファイル */
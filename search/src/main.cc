@@ -0,0 +1,262 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+/*
+ * MHT ファイルの全文検索
+ *
+ *   ql_unmht_search update INDEX SCRIPT PATH...
+ *     PATH の MHT ファイルを索引 INDEX に加える
+ *     ディレクトリは再帰的に辿り、拡張子が .mht, .mhtml, .eml のファイルを加える
+ *     SCRIPT は ql_unmht.js のパス
+ *
+ *   ql_unmht_search query INDEX WORD...
+ *     全ての WORD を含むファイルのパスを出力する
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <searchindex.h>
+
+/**
+ * 索引に加えるファイルの拡張子か
+ *
+ * @param   name
+ *          ファイル名
+ * @returns 拡張子が .mht, .mhtml, .eml か
+ */
+static bool
+hasArchiveExtension(const char *name) {
+  static const char *extensions[] = { ".mht", ".mhtml", ".eml", NULL };
+  size_t length = strlen(name);
+  for (int i = 0; extensions[i]; i ++) {
+    size_t extLength = strlen(extensions[i]);
+    if (length > extLength &&
+        strcasecmp(name + length - extLength, extensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * ディレクトリを再帰的に辿ってファイルを集める
+ *
+ * @param   path
+ *          ファイルかディレクトリのパス
+ * @param   explicitPath
+ *          コマンドラインで指定したパスか
+ *          指定したファイルは拡張子に関わらず加える
+ * @param   paths
+ *          (出力) ファイルのパス
+ */
+static void
+gatherPaths(const std::string &path, bool explicitPath,
+            std::vector<std::string> *paths) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) {
+    fprintf(stderr, "ql_unmht_search: %s: not found\n", path.c_str());
+    return;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    if (explicitPath || hasArchiveExtension(path.c_str())) {
+      paths->push_back(path);
+    }
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return;
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    gatherPaths(path + "/" + entry->d_name, false, paths);
+  }
+  closedir(dir);
+}
+
+/**
+ * ファイルを全て読み込む
+ *
+ * @param   path
+ *          ファイルのパス
+ * @param   content
+ *          (出力) ファイルの内容
+ * @returns 成功したか
+ */
+static bool
+readFile(const char *path, std::string *content) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    content->append(buffer, n);
+  }
+  bool result = !ferror(f);
+  fclose(f);
+  return result;
+}
+
+/**
+ * 索引を更新する
+ *
+ * @param   argc
+ *          引数の数
+ * @param   argv
+ *          INDEX SCRIPT PATH...
+ * @returns 終了コード
+ */
+static int
+updateCommand(int argc, char **argv) {
+  std::string script;
+  if (!readFile(argv[1], &script)) {
+    fprintf(stderr, "ql_unmht_search: %s: cannot read\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<std::string> paths;
+  for (int i = 2; i < argc; i ++) {
+    gatherPaths(argv[i], true, &paths);
+  }
+  std::vector<const char *> pathList;
+  for (size_t i = 0; i < paths.size(); i ++) {
+    pathList.push_back(paths[i].c_str());
+  }
+
+  size_t extracted = 0;
+  if (!update_searchindex(argv[0], pathList.data(), pathList.size(),
+                          script.c_str(), &extracted)) {
+    fprintf(stderr, "ql_unmht_search: %s: cannot update\n", argv[0]);
+    return 1;
+  }
+
+  searchindex *index = open_searchindex(argv[0]);
+  if (index) {
+    fprintf(stderr, "ql_unmht_search: %zu files, %zu extracted\n",
+            count_searchindex(index), extracted);
+    close_searchindex(index);
+  }
+
+  return 0;
+}
+
+/**
+ * 索引を検索する
+ *
+ * @param   argc
+ *          引数の数
+ * @param   argv
+ *          INDEX WORD...
+ * @returns 終了コード (見つからなければ 1)
+ */
+static int
+queryCommand(int argc, char **argv) {
+  searchindex *index = open_searchindex(argv[0]);
+  if (index == NULL) {
+    fprintf(stderr, "ql_unmht_search: %s: cannot open\n", argv[0]);
+    return 2;
+  }
+
+  std::string query;
+  for (int i = 1; i < argc; i ++) {
+    if (i > 1) {
+      query += " ";
+    }
+    query += argv[i];
+  }
+
+  uint32_t *docs = NULL;
+  size_t docsCount = 0;
+  if (!query_searchindex(index, query.c_str(), &docs, &docsCount)) {
+    fprintf(stderr, "ql_unmht_search: %s: broken index\n", argv[0]);
+    close_searchindex(index);
+    return 2;
+  }
+
+  for (size_t i = 0; i < docsCount; i ++) {
+    printf("%s\n", lookup_searchindex(index, docs[i]));
+  }
+  free(docs);
+  close_searchindex(index);
+
+  return docsCount > 0 ? 0 : 1;
+}
+
+/**
+ * 使い方を表示する
+ *
+ * @returns 終了コード
+ */
+static int
+usage(void) {
+  fprintf(stderr,
+          "usage: ql_unmht_search update INDEX SCRIPT PATH...\n"
+          "       ql_unmht_search query INDEX WORD...\n");
+  return 2;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 3) {
+    return usage();
+  }
+
+  if (strcmp(argv[1], "update") == 0 && argc >= 5) {
+    return updateCommand(argc - 2, argv + 2);
+  }
+  if (strcmp(argv[1], "query") == 0 && argc >= 4) {
+    return queryCommand(argc - 2, argv + 2);
+  }
+
+  return usage();
+}
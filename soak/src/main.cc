@@ -0,0 +1,415 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+/*
+ * 正常なファイルと壊れたファイルを長時間展開し続けてメモリの増加を調べる
+ *
+ *   ql_unmht_soak SCRIPT ITERATIONS PATH...
+ *     PATH の MHT ファイルと、それを壊したファイルを合わせて
+ *     ITERATIONS 回展開して開放する
+ *     途中で RSS とアロケータが確保している量を記録し、
+ *     慣らしの後から増え続けていれば失敗する
+ *     ディレクトリは再帰的に辿り、拡張子が .mht, .mhtml, .eml のファイルを加える
+ *     SCRIPT は ql_unmht.js のパス
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <unmht.h>
+
+/**
+ * 記録する回数
+ */
+#define SAMPLE_COUNT 50
+
+/**
+ * 慣らしとして記録を比べない回数の割合 (%)
+ */
+#define WARMUP_PERCENT 20
+
+/**
+ * 慣らしの後に許すメモリの増加の割合 (%)
+ */
+#define ALLOWED_GROWTH_PERCENT 10
+
+/**
+ * 慣らしの後に許すメモリの増加の量 (KB)
+ * 割合と合わせて許す
+ */
+#define ALLOWED_GROWTH_KB (8 * 1024)
+
+/**
+ * extractstream に入力する 1 回の長さ
+ */
+#define FEED_SIZE 4096
+
+/**
+ * 展開するファイルの拡張子か
+ *
+ * @param   name
+ *          ファイル名
+ * @returns 拡張子が .mht, .mhtml, .eml か
+ */
+static bool
+hasArchiveExtension(const char *name) {
+  static const char *extensions[] = { ".mht", ".mhtml", ".eml", NULL };
+  size_t length = strlen(name);
+  for (int i = 0; extensions[i]; i ++) {
+    size_t extLength = strlen(extensions[i]);
+    if (length > extLength &&
+        strcasecmp(name + length - extLength, extensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * ディレクトリを再帰的に辿ってファイルを集める
+ *
+ * @param   path
+ *          ファイルかディレクトリのパス
+ * @param   explicitPath
+ *          コマンドラインで指定したパスか
+ *          指定したファイルは拡張子に関わらず加える
+ * @param   paths
+ *          (出力) ファイルのパス
+ */
+static void
+gatherPaths(const std::string &path, bool explicitPath,
+            std::vector<std::string> *paths) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) {
+    fprintf(stderr, "ql_unmht_soak: %s: not found\n", path.c_str());
+    return;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    if (explicitPath || hasArchiveExtension(path.c_str())) {
+      paths->push_back(path);
+    }
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return;
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    gatherPaths(path + "/" + entry->d_name, false, paths);
+  }
+  closedir(dir);
+}
+
+/**
+ * ファイルを全て読み込む
+ *
+ * @param   path
+ *          ファイルのパス
+ * @param   content
+ *          (出力) ファイルの内容
+ * @returns 成功したか
+ */
+static bool
+readFile(const char *path, std::string *content) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    content->append(buffer, n);
+  }
+  bool result = !ferror(f);
+  fclose(f);
+  return result;
+}
+
+/**
+ * 正常なファイルから壊れたファイルを作成する
+ * 途中で切れたもの、バイトを書き換えたもの、バウンダリを壊したもの、
+ * 先頭にバイナリを置いたものを加える
+ *
+ * @param   content
+ *          正常なファイルの内容
+ * @param   inputs
+ *          (出力) 展開する内容
+ */
+static void
+addCorruptInputs(const std::string &content,
+                 std::vector<std::string> *inputs) {
+  inputs->push_back(content.substr(0, content.size() / 2));
+  inputs->push_back(content.substr(0, content.size() / 7));
+
+  /* 結果が毎回同じになるように線形合同法で書き換える位置を決める */
+  std::string flipped = content;
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < flipped.size() / 97 + 1 && !flipped.empty(); i ++) {
+    seed = seed * 1103515245 + 12345;
+    flipped[seed % flipped.size()] ^= 0x20;
+  }
+  inputs->push_back(flipped);
+
+  std::string broken = content;
+  size_t pos = 0;
+  while ((pos = broken.find("--", pos)) != std::string::npos) {
+    broken[pos] = '-';
+    broken[pos + 1] = '+';
+    pos += 2;
+  }
+  inputs->push_back(broken);
+
+  std::string binary(16, '\0');
+  inputs->push_back(binary + content);
+}
+
+/**
+ * メモリの使用量
+ */
+struct MemoryUsage {
+  size_t rssKB;  /* RSS (KB) */
+  size_t heapKB; /* アロケータが確保している量 (KB) */
+};
+
+/**
+ * 現在のメモリの使用量を取得する
+ *
+ * @returns メモリの使用量
+ *          取得できなかった値は 0
+ */
+static MemoryUsage
+getMemoryUsage(void) {
+  MemoryUsage usage = { 0, 0 };
+#ifdef __APPLE__
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                reinterpret_cast<task_info_t>(&info), &count)
+      == KERN_SUCCESS) {
+    usage.rssKB = info.resident_size / 1024;
+  }
+
+  malloc_statistics_t stats;
+  malloc_zone_statistics(NULL, &stats);
+  usage.heapKB = stats.size_in_use / 1024;
+#else
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    unsigned long size, resident;
+    if (fscanf(f, "%lu %lu", &size, &resident) == 2) {
+      usage.rssKB = resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+    fclose(f);
+  }
+
+#if defined(__GLIBC__) && \
+  (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+  usage.heapKB = (mi.uordblks + mi.hblkhd) / 1024;
+#elif defined(__GLIBC__)
+  struct mallinfo mi = mallinfo();
+  usage.heapKB = (static_cast<size_t>(mi.uordblks) + mi.hblkhd) / 1024;
+#endif
+#endif
+  return usage;
+}
+
+/**
+ * 1 回展開して開放する
+ * 回数に応じて extract_buffer か extractstream を使い、
+ * 参照の形式も切り替える
+ *
+ * @param   input
+ *          展開する内容
+ * @param   script
+ *          ql_unmht.js の内容
+ * @param   iteration
+ *          何回目か
+ * @returns 展開できたか
+ */
+static bool
+extractOnce(const std::string &input, const std::string &script,
+            size_t iteration) {
+  int32_t cidMode = iteration % 2 == 0;
+  int32_t mode = (cidMode ? EXTRACT_CID : 0) | EXTRACT_REBASABLE;
+  efileinfo *info = NULL;
+
+  if (iteration % 8 == 3) {
+    extractstream *stream = create_extractstream();
+    if (stream == NULL) {
+      return false;
+    }
+    bool fed = true;
+    for (size_t pos = 0; fed && pos < input.size(); pos += FEED_SIZE) {
+      fed = feed_extractstream(stream, input.data() + pos,
+                               std::min(input.size() - pos,
+                                        static_cast<size_t>(FEED_SIZE)));
+    }
+    if (fed && iteration % 16 == 3) {
+      info = finish_extractstream(stream, script.c_str(), mode);
+    }
+    /* 半分は展開せずに捨てて、入力の途中で開放する経路も通す */
+    delete_extractstream(stream);
+  } else {
+    info = extract_buffer(input.data(), input.size(), script.c_str(),
+                          mode);
+  }
+
+  if (info == NULL) {
+    return false;
+  }
+  rebase_efileinfo(info, !cidMode);
+  delete_efileinfo(info);
+  return true;
+}
+
+/**
+ * 使い方を表示する
+ *
+ * @returns 終了コード
+ */
+static int
+usage(void) {
+  fprintf(stderr, "usage: ql_unmht_soak SCRIPT ITERATIONS PATH...\n");
+  return 2;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 4) {
+    return usage();
+  }
+
+  long iterations = atol(argv[2]);
+  if (iterations < SAMPLE_COUNT) {
+    return usage();
+  }
+
+  std::string script;
+  if (!readFile(argv[1], &script)) {
+    fprintf(stderr, "ql_unmht_soak: %s: cannot read\n", argv[1]);
+    return 2;
+  }
+
+  std::vector<std::string> paths;
+  for (int i = 3; i < argc; i ++) {
+    gatherPaths(argv[i], true, &paths);
+  }
+  std::vector<std::string> inputs;
+  for (size_t i = 0; i < paths.size(); i ++) {
+    std::string content;
+    if (!readFile(paths[i].c_str(), &content)) {
+      fprintf(stderr, "ql_unmht_soak: %s: cannot read\n", paths[i].c_str());
+      continue;
+    }
+    inputs.push_back(content);
+    addCorruptInputs(content, &inputs);
+  }
+  if (inputs.empty()) {
+    fprintf(stderr, "ql_unmht_soak: no files\n");
+    return 2;
+  }
+  inputs.push_back("");
+
+  size_t interval = iterations / SAMPLE_COUNT;
+  size_t extracted = 0;
+  std::vector<MemoryUsage> samples;
+  for (size_t i = 0; i < static_cast<size_t>(iterations); i ++) {
+    if (extractOnce(inputs[i % inputs.size()], script, i)) {
+      extracted ++;
+    }
+
+    if ((i + 1) % interval == 0) {
+      MemoryUsage usage = getMemoryUsage();
+      samples.push_back(usage);
+      printf("iteration=%zu rss_kb=%zu heap_kb=%zu extracted=%zu\n",
+             i + 1, usage.rssKB, usage.heapKB, extracted);
+      fflush(stdout);
+    }
+  }
+
+  /* 慣らしの直後と最後の数回の最小値を比べて、一時的な増加は無視する */
+  size_t warmup = samples.size() * WARMUP_PERCENT / 100;
+  MemoryUsage base = samples[warmup];
+  MemoryUsage last = samples.back();
+  for (size_t i = samples.size() - 3; i < samples.size(); i ++) {
+    last.rssKB = std::min(last.rssKB, samples[i].rssKB);
+    last.heapKB = std::min(last.heapKB, samples[i].heapKB);
+  }
+
+  int status = 0;
+  const std::pair<const char *, std::pair<size_t, size_t> > checks[] = {
+    std::make_pair("rss", std::make_pair(base.rssKB, last.rssKB)),
+    std::make_pair("heap", std::make_pair(base.heapKB, last.heapKB))
+  };
+  for (size_t i = 0; i < 2; i ++) {
+    size_t before = checks[i].second.first;
+    size_t after = checks[i].second.second;
+    size_t allowed
+      = before + before * ALLOWED_GROWTH_PERCENT / 100 + ALLOWED_GROWTH_KB;
+    printf("%s_kb: %zu -> %zu (allowed %zu)\n",
+           checks[i].first, before, after, allowed);
+    if (before != 0 && after > allowed) {
+      fprintf(stderr, "ql_unmht_soak: %s keeps growing\n", checks[i].first);
+      status = 1;
+    }
+  }
+
+  return status;
+}
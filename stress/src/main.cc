@@ -0,0 +1,419 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+
+/*
+ * 複数のスレッドから同時に展開した結果と速度を調べる
+ *
+ *   ql_unmht_stress SCRIPT THREADS ROUNDS PATH...
+ *     PATH の MHT ファイルを 1 スレッドで展開した結果を基準として、
+ *     1 スレッドと THREADS スレッドでそれぞれ全てのファイルを ROUNDS 回展開し、
+ *     結果が基準と一致するかと、スレッド数に応じて速くなるかを調べる
+ *     ディレクトリは再帰的に辿り、拡張子が .mht, .mhtml, .eml のファイルを加える
+ *     SCRIPT は ql_unmht.js のパス
+ *
+ *   結果が一致しないか、THREADS スレッドの速度が
+ *   1 スレッドの速度の min(THREADS, CPU の数) / 2 倍に満たなければ失敗する
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hash.h>
+#include <unmht.h>
+
+/**
+ * 展開するファイルの拡張子か
+ *
+ * @param   name
+ *          ファイル名
+ * @returns 拡張子が .mht, .mhtml, .eml か
+ */
+static bool
+hasArchiveExtension(const char *name) {
+  static const char *extensions[] = { ".mht", ".mhtml", ".eml", NULL };
+  size_t length = strlen(name);
+  for (int i = 0; extensions[i]; i ++) {
+    size_t extLength = strlen(extensions[i]);
+    if (length > extLength &&
+        strcasecmp(name + length - extLength, extensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * ディレクトリを再帰的に辿ってファイルを集める
+ *
+ * @param   path
+ *          ファイルかディレクトリのパス
+ * @param   explicitPath
+ *          コマンドラインで指定したパスか
+ *          指定したファイルは拡張子に関わらず加える
+ * @param   paths
+ *          (出力) ファイルのパス
+ */
+static void
+gatherPaths(const std::string &path, bool explicitPath,
+            std::vector<std::string> *paths) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) {
+    fprintf(stderr, "ql_unmht_stress: %s: not found\n", path.c_str());
+    return;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    if (explicitPath || hasArchiveExtension(path.c_str())) {
+      paths->push_back(path);
+    }
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return;
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    gatherPaths(path + "/" + entry->d_name, false, paths);
+  }
+  closedir(dir);
+}
+
+/**
+ * ファイルを全て読み込む
+ *
+ * @param   path
+ *          ファイルのパス
+ * @param   content
+ *          (出力) ファイルの内容
+ * @returns 成功したか
+ */
+static bool
+readFile(const char *path, std::string *content) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    content->append(buffer, n);
+  }
+  bool result = !ferror(f);
+  fclose(f);
+  return result;
+}
+
+/**
+ * 文字列をハッシュ値に加える
+ *
+ * @param   s
+ *          文字列
+ *          NULL は空文字列と区別する
+ * @param   seed
+ *          これまでのハッシュ値
+ * @returns ハッシュ値
+ */
+static uint64_t
+hashString(const char *s, uint64_t seed) {
+  if (s == NULL) {
+    return hashBytes("", 0, seed + 1);
+  }
+  return hashBytes(s, strlen(s), seed);
+}
+
+/**
+ * パートの cid を番号に置き換えた内容を作成する
+ * ダミーの cid は展開毎に変わるので、参照の中の cid も比較しない
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ * @param   part
+ *          パート
+ * @returns 置き換えた内容
+ */
+static std::string
+normalizeContent(const efileinfo *info, const mimepart *part) {
+  std::string content(part->content, part->contentSize);
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    const char *cid = info->parts[i]->cid;
+    if (cid == NULL || cid[0] == '\0') {
+      continue;
+    }
+    std::string name(cid);
+    std::string replacement = "#" + std::to_string(i);
+    size_t pos = 0;
+    while ((pos = content.find(name, pos)) != std::string::npos) {
+      content.replace(pos, name.size(), replacement);
+      pos += replacement.size();
+    }
+  }
+  return content;
+}
+
+/**
+ * 展開結果のハッシュ値を計算する
+ * パートの cid は展開毎に変わるので含めない
+ *
+ * @param   info
+ *          MHT ファイルの展開情報
+ *          NULL ならば失敗を表す値
+ * @returns ハッシュ値
+ */
+static uint64_t
+hashResult(const efileinfo *info) {
+  if (info == NULL) {
+    return 0;
+  }
+
+  uint64_t h = hashString(info->baseURI, 1);
+  h = hashString(info->subject, h);
+  h = hashBytes(reinterpret_cast<const char *>(&info->partsCount),
+                sizeof(info->partsCount), h);
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    const mimepart *p = info->parts[i];
+    h = hashString(p->mimetype, h);
+    h = hashString(p->charset, h);
+    if (p->content) {
+      std::string content = normalizeContent(info, p);
+      h = hashBytes(content.data(), content.size(), h);
+    } else {
+      h = hashBytes("pruned", 6, h);
+    }
+    if (p == info->startPart) {
+      h = hashBytes("start", 5, h);
+    }
+  }
+  return h;
+}
+
+/**
+ * 展開の対象
+ */
+struct Corpus {
+  std::vector<std::string> paths;    /* ファイルのパス */
+  std::vector<std::string> contents; /* ファイルの内容 */
+  std::vector<uint64_t> expected;    /* 1 スレッドで展開した結果のハッシュ値 */
+  std::string script;                /* ql_unmht.js の内容 */
+};
+
+/**
+ * 1 回の計測結果
+ */
+struct RunResult {
+  double seconds;    /* 掛かった時間 */
+  size_t extracted;  /* 展開した回数 */
+  size_t mismatched; /* 基準と一致しなかった回数 */
+};
+
+/**
+ * 複数のスレッドで全てのファイルを繰り返し展開する
+ * 各スレッドは次に展開するファイルを共有のカウンタから取る
+ *
+ * @param   corpus
+ *          展開の対象
+ * @param   threads
+ *          スレッド数
+ * @param   rounds
+ *          全てのファイルを展開する回数
+ * @returns 計測結果
+ */
+static RunResult
+runThreads(const Corpus &corpus, unsigned threads, size_t rounds) {
+  size_t jobs = corpus.contents.size() * rounds;
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> mismatched(0);
+
+  auto worker = [&]() {
+    for (;;) {
+      size_t job = next ++;
+      if (job >= jobs) {
+        break;
+      }
+      size_t i = job % corpus.contents.size();
+      const std::string &content = corpus.contents[i];
+      efileinfo *info = extract_buffer(content.data(), content.size(),
+                                       corpus.script.c_str(), true);
+      if (hashResult(info) != corpus.expected[i]) {
+        fprintf(stderr, "ql_unmht_stress: %s: result differs\n",
+                corpus.paths[i].c_str());
+        mismatched ++;
+      }
+      if (info) {
+        delete_efileinfo(info);
+      }
+    }
+    release_thread_runtime();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t ++) {
+    workers.push_back(std::thread(worker));
+  }
+  for (size_t t = 0; t < workers.size(); t ++) {
+    workers[t].join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  RunResult result;
+  result.seconds = std::chrono::duration<double>(end - start).count();
+  result.extracted = jobs;
+  result.mismatched = mismatched;
+  return result;
+}
+
+/**
+ * 計測結果を表示する
+ *
+ * @param   threads
+ *          スレッド数
+ * @param   result
+ *          計測結果
+ * @returns 1 秒あたりの展開回数
+ */
+static double
+report(unsigned threads, const RunResult &result) {
+  double rate = result.seconds > 0 ? result.extracted / result.seconds : 0;
+  printf("threads=%u extracted=%zu seconds=%.3f rate=%.1f/s mismatched=%zu\n",
+         threads, result.extracted, result.seconds, rate, result.mismatched);
+  return rate;
+}
+
+/**
+ * 使い方を表示する
+ *
+ * @returns 終了コード
+ */
+static int
+usage(void) {
+  fprintf(stderr,
+          "usage: ql_unmht_stress SCRIPT THREADS ROUNDS PATH...\n");
+  return 2;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 5) {
+    return usage();
+  }
+
+  int threads = atoi(argv[2]);
+  long rounds = atol(argv[3]);
+  if (threads < 1 || rounds < 1) {
+    return usage();
+  }
+
+  Corpus corpus;
+  if (!readFile(argv[1], &corpus.script)) {
+    fprintf(stderr, "ql_unmht_stress: %s: cannot read\n", argv[1]);
+    return 2;
+  }
+
+  std::vector<std::string> paths;
+  for (int i = 4; i < argc; i ++) {
+    gatherPaths(argv[i], true, &paths);
+  }
+  for (size_t i = 0; i < paths.size(); i ++) {
+    std::string content;
+    if (!readFile(paths[i].c_str(), &content)) {
+      fprintf(stderr, "ql_unmht_stress: %s: cannot read\n", paths[i].c_str());
+      continue;
+    }
+    corpus.paths.push_back(paths[i]);
+    corpus.contents.push_back(content);
+  }
+  if (corpus.contents.empty()) {
+    fprintf(stderr, "ql_unmht_stress: no files\n");
+    return 2;
+  }
+
+  /* 基準の結果は計測と別のスレッドで作り、その実行環境も使い回さない */
+  std::thread([&corpus]() {
+      for (size_t i = 0; i < corpus.contents.size(); i ++) {
+        const std::string &content = corpus.contents[i];
+        efileinfo *info = extract_buffer(content.data(), content.size(),
+                                         corpus.script.c_str(), true);
+        corpus.expected.push_back(hashResult(info));
+        if (info) {
+          delete_efileinfo(info);
+        }
+      }
+    }).join();
+
+  RunResult single = runThreads(corpus, 1, rounds);
+  double singleRate = report(1, single);
+  RunResult multi = runThreads(corpus, threads, rounds);
+  double multiRate = report(threads, multi);
+
+  int status = 0;
+  if (single.mismatched || multi.mismatched) {
+    fprintf(stderr, "ql_unmht_stress: results differ between runs\n");
+    status = 1;
+  }
+
+  unsigned cpus = std::thread::hardware_concurrency();
+  if (cpus == 0) {
+    cpus = threads;
+  }
+  double required
+    = std::min(static_cast<unsigned>(threads), cpus) / 2.0;
+  double speedup = singleRate > 0 ? multiRate / singleRate : 0;
+  printf("speedup=%.2f required=%.2f\n", speedup, required);
+  if (speedup < required) {
+    fprintf(stderr, "ql_unmht_stress: throughput does not scale\n");
+    status = 1;
+  }
+
+  return status;
+}
@@ -0,0 +1,808 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is UnMHT for QuickLook.
+ *
+ * The Initial Developer of the Original Code is arai.
+ * Portions created by the Initial Developer are Copyright (C) 2012
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s): arai <arai_a@mac.com>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * ネイティブの処理が正しく動くかを調べる
+ *
+ *   ql_unmht_test [SCRIPT]
+ *     各処理を生成した入力で実行し、単純な実装の結果や
+ *     入力の区切り方を変えた結果と一致するかを調べる
+ *     SCRIPT は ql_unmht.js のパス
+ *     指定しなければ ql_unmht.js を実行する検査は省く
+ *
+ *   一致しない結果があれば、その内容を表示して失敗する
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <decode.h>
+#include <htmltext.h>
+#include <partindex.h>
+#include <scan.h>
+#include <spill.h>
+#include <unmht.h>
+#include <utf8.h>
+
+/**
+ * 失敗した検査の数
+ */
+static size_t failures = 0;
+
+/**
+ * 検査の失敗を表示する
+ *
+ * @param   name
+ *          検査の名前
+ * @param   format
+ *          printf の書式
+ */
+static void
+fail(const char *name, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "ql_unmht_test: %s: ", name);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  failures ++;
+}
+
+/**
+ * 再現できる擬似乱数を返す (xorshift64)
+ *
+ * @param   state
+ *          (入出力) 乱数の状態
+ *          0 以外で初期化する
+ * @returns 擬似乱数
+ */
+static uint64_t
+nextRandom(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+/**
+ * 乱数のバイト列を作成する
+ *
+ * @param   state
+ *          (入出力) 乱数の状態
+ * @param   size
+ *          長さ
+ * @returns バイト列
+ */
+static std::string
+randomBytes(uint64_t *state, size_t size) {
+  std::string bytes(size, '\0');
+  for (size_t i = 0; i < size; i ++) {
+    bytes[i] = static_cast<char>(nextRandom(state));
+  }
+  return bytes;
+}
+
+/**
+ * BASE64 にエンコードして 76 文字ごとに CRLF で折り返す
+ *
+ * @param   data
+ *          エンコードするバイト列
+ * @returns エンコードした文字列
+ */
+static std::string
+encodeBase64Lines(const std::string &data) {
+  std::string encoded(BASE64_ENCODED_SIZE(data.size()), '\0');
+  encoded.resize(encodeBase64(data.data(), data.size(), &encoded[0]));
+
+  std::string lines;
+  for (size_t pos = 0; pos < encoded.size(); pos += 76) {
+    lines.append(encoded, pos, 76);
+    lines.append("\r\n");
+  }
+  return lines;
+}
+
+/**
+ * quoted-printable にエンコードして 76 文字以内で折り返す
+ * 改行と空白、表示できない文字と = は =XX にする
+ *
+ * @param   data
+ *          エンコードするバイト列
+ * @returns エンコードした文字列
+ */
+static std::string
+encodeQuotedPrintable(const std::string &data) {
+  static const char hex[] = "0123456789ABCDEF";
+  std::string encoded;
+  size_t column = 0;
+  for (size_t i = 0; i < data.size(); i ++) {
+    unsigned char c = data[i];
+    if (column >= 72) {
+      encoded += "=\r\n";
+      column = 0;
+    }
+    if (c > ' ' && c < 0x7f && c != '=') {
+      encoded += static_cast<char>(c);
+      column ++;
+    } else {
+      encoded += '=';
+      encoded += hex[c >> 4];
+      encoded += hex[c & 0x0f];
+      column += 3;
+    }
+  }
+  return encoded;
+}
+
+/**
+ * decodeParts の結果を開放する
+ *
+ * @param   results
+ *          decodeParts の結果
+ */
+static void
+releaseResults(std::vector<decodedpart> *results) {
+  for (size_t i = 0; i < results->size(); i ++) {
+    decodedpart &r = (*results)[i];
+    if (r.content == NULL) {
+      continue;
+    }
+    if (r.spilled) {
+      releaseSpill(r.content, r.contentSize + 1);
+    } else {
+      free(r.content);
+    }
+    r.content = NULL;
+  }
+}
+
+/**
+ * decodeParts の結果の内容を返す
+ * sameAs を辿って共有元の内容を返す
+ *
+ * @param   results
+ *          decodeParts の結果
+ * @param   index
+ *          パートのインデックス
+ * @returns 内容
+ */
+static std::string
+resultContent(const std::vector<decodedpart> &results, size_t index) {
+  const decodedpart &r = results[index];
+  if (r.sameAs >= 0) {
+    return resultContent(results, static_cast<size_t>(r.sameAs));
+  }
+  return std::string(r.content, r.contentSize);
+}
+
+/**
+ * decodeParts がスレッド数に関わらず 1 つずつデコードした結果と一致し、
+ * 入力かデコードした結果が同じパートを共有するかを調べる
+ *
+ * @param   script
+ *          ql_unmht.js の内容 (使用しない)
+ */
+static void
+checkDecode(const std::string &script) {
+  (void)script;
+
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  std::vector<std::string> expected, sources;
+  std::vector<transferencoding> encodings;
+  for (size_t i = 0; i < 64; i ++) {
+    std::string data = randomBytes(&state, nextRandom(&state) % 200000);
+    switch (i % 4) {
+      case 0:
+        sources.push_back(encodeBase64Lines(data));
+        encodings.push_back(TRANSFER_ENCODING_BASE64);
+        break;
+      case 1:
+        sources.push_back(encodeQuotedPrintable(data));
+        encodings.push_back(TRANSFER_ENCODING_QUOTED_PRINTABLE);
+        break;
+      case 2:
+        sources.push_back(data);
+        encodings.push_back(TRANSFER_ENCODING_NONE);
+        break;
+      case 3:
+        /* 直前のパートとデコードした結果のみが同じ */
+        data = expected.back();
+        sources.push_back(encodeBase64Lines(data));
+        encodings.push_back(TRANSFER_ENCODING_BASE64);
+        break;
+    }
+    expected.push_back(data);
+  }
+  /* 入力が同じパート */
+  sources.push_back(sources[0]);
+  encodings.push_back(encodings[0]);
+  expected.push_back(expected[0]);
+
+  std::vector<decodejob> jobs(sources.size());
+  for (size_t i = 0; i < jobs.size(); i ++) {
+    jobs[i].source = sources[i].data();
+    jobs[i].sourceSize = sources[i].size();
+    jobs[i].encoding = encodings[i];
+    jobs[i].charset = NULL;
+    /* 一部は一時ファイルにデコードする */
+    jobs[i].spillSize = i % 5 == 0 ? 4096 : 0;
+  }
+
+  static const uint32_t threadCounts[] = { 1, 4, 0 };
+  for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]);
+       t ++) {
+    set_decode_thread_count(threadCounts[t]);
+
+    std::vector<decodedpart> results(jobs.size());
+    if (!decodeParts(jobs.data(), jobs.size(), results.data())) {
+      fail("decode", "decodeParts failed (threads=%u)", threadCounts[t]);
+      continue;
+    }
+    for (size_t i = 0; i < results.size(); i ++) {
+      if (!results[i].succeeded) {
+        fail("decode", "part %zu failed (threads=%u)", i, threadCounts[t]);
+      } else if (resultContent(results, i) != expected[i]) {
+        fail("decode", "part %zu differs (threads=%u)", i, threadCounts[t]);
+      }
+    }
+    for (size_t i = 3; i < 64; i += 4) {
+      if (results[i].sameAs != static_cast<int64_t>(i - 1)) {
+        fail("decode", "part %zu does not share the decoded part %zu",
+             i, i - 1);
+      }
+    }
+    if (results.back().sameAs != 0) {
+      fail("decode", "the duplicated source is not shared");
+    }
+    releaseResults(&results);
+  }
+  set_decode_thread_count(0);
+}
+
+/**
+ * スキャンしたパートをファイルとメモリのそれぞれからデコードした結果が、
+ * エンコードする前の内容と一致するかを調べる
+ * ボディはデコードの単位 (1MB) を超える長さにして、区切りを跨がせる
+ * パートの索引を保存して読み込んだ結果が元と一致するかも調べる
+ *
+ * @param   script
+ *          ql_unmht.js の内容 (使用しない)
+ */
+static void
+checkRangeDecode(const std::string &script) {
+  (void)script;
+
+  uint64_t state = 0x2545f4914f6cdd1dULL;
+  std::vector<std::string> expected;
+  std::string mht = "MIME-Version: 1.0\r\n"
+    "Content-Type: multipart/related; boundary=\"b\"\r\n\r\n";
+  for (size_t i = 0; i < 6; i ++) {
+    /* 区切りの位置がずれるように長さを変える */
+    std::string data = randomBytes(&state, 3 * 1024 * 1024 + i * 7 + 1);
+    std::string body;
+    mht += "--b\r\nContent-Type: application/octet-stream\r\n";
+    if (i % 2 == 0) {
+      mht += "Content-Transfer-Encoding: base64\r\n\r\n";
+      body = encodeBase64Lines(data);
+    } else {
+      mht += "Content-Transfer-Encoding: quoted-printable\r\n\r\n";
+      body = encodeQuotedPrintable(data);
+    }
+    mht += body + "\r\n";
+    expected.push_back(data);
+  }
+  mht += "--b--\r\n";
+
+  sfileinfo *info = scan_parts(mht.data(), mht.size());
+  if (info == NULL) {
+    fail("range", "scan_parts failed");
+    return;
+  }
+
+  int fd = createTemporaryFile();
+  if (fd == -1 || !writeFully(fd, mht.data(), mht.size())) {
+    fail("range", "cannot write a temporary file");
+    if (fd != -1) {
+      close(fd);
+    }
+    delete_sfileinfo(info);
+    return;
+  }
+
+  size_t index = 0;
+  for (size_t i = 0; i < info->partsCount; i ++) {
+    const scanpart *part = &info->parts[i];
+    if (part->isMultipart) {
+      continue;
+    }
+    if (index >= expected.size()) {
+      fail("range", "too many parts");
+      break;
+    }
+
+    char *content;
+    size_t contentSize;
+    if (!decode_part_fd(fd, part, &content, &contentSize)) {
+      fail("range", "decode_part_fd failed for part %zu", index);
+    } else {
+      if (std::string(content, contentSize) != expected[index]) {
+        fail("range", "decode_part_fd differs for part %zu", index);
+      }
+      free(content);
+    }
+    if (!decode_part_mem(mht.data(), mht.size(), part,
+                         &content, &contentSize)) {
+      fail("range", "decode_part_mem failed for part %zu", index);
+    } else {
+      if (std::string(content, contentSize) != expected[index]) {
+        fail("range", "decode_part_mem differs for part %zu", index);
+      }
+      free(content);
+    }
+    index ++;
+  }
+  if (index != expected.size()) {
+    fail("range", "%zu parts found, %zu expected", index, expected.size());
+  }
+  close(fd);
+
+  const char *dir = getenv("TMPDIR");
+  if (dir == NULL || dir[0] == '\0') {
+    dir = "/tmp";
+  }
+  std::string path = std::string(dir) + "/ql_unmht_test.XXXXXX";
+  std::vector<char> tmpl(path.begin(), path.end());
+  tmpl.push_back('\0');
+  int indexFd = mkstemp(tmpl.data());
+  if (indexFd == -1) {
+    fail("range", "cannot create an index file");
+    delete_sfileinfo(info);
+    return;
+  }
+  close(indexFd);
+
+  if (!save_part_index(info, tmpl.data(), 1234)) {
+    fail("range", "save_part_index failed");
+  } else {
+    sfileinfo *loaded = load_part_index(tmpl.data(), mht.size(), 1234);
+    if (loaded == NULL) {
+      fail("range", "load_part_index failed");
+    } else {
+      if (loaded->partsCount != info->partsCount) {
+        fail("range", "the loaded index has %zu parts, %zu expected",
+             loaded->partsCount, info->partsCount);
+      } else {
+        for (size_t i = 0; i < info->partsCount; i ++) {
+          if (loaded->parts[i].bodyOffset != info->parts[i].bodyOffset ||
+              loaded->parts[i].bodySize != info->parts[i].bodySize) {
+            fail("range", "the loaded index differs for part %zu", i);
+          }
+        }
+      }
+      delete_sfileinfo(loaded);
+    }
+    if (load_part_index(tmpl.data(), mht.size() + 1, 1234) != NULL) {
+      fail("range", "a stale index is loaded");
+    }
+  }
+  unlink(tmpl.data());
+
+  delete_sfileinfo(info);
+}
+
+/**
+ * 1 文字ずつ調べる単純な UTF-8 の検証
+ * 冗長な表現、サロゲート、U+10FFFF より大きい文字は不正とする
+ *
+ * @param   text
+ *          対象の文字列
+ * @param   length
+ *          対象の文字列の長さ
+ * @returns 正しい UTF-8 か
+ */
+static bool
+referenceValidUTF8(const char *text, size_t length) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(text);
+  size_t i = 0;
+  while (i < length) {
+    unsigned char c = p[i];
+    size_t count;
+    uint32_t code, min;
+    if (c < 0x80) {
+      i ++;
+      continue;
+    } else if ((c & 0xe0) == 0xc0) {
+      count = 1;
+      code = c & 0x1f;
+      min = 0x80;
+    } else if ((c & 0xf0) == 0xe0) {
+      count = 2;
+      code = c & 0x0f;
+      min = 0x800;
+    } else if ((c & 0xf8) == 0xf0) {
+      count = 3;
+      code = c & 0x07;
+      min = 0x10000;
+    } else {
+      return false;
+    }
+    if (length - i <= count) {
+      return false;
+    }
+    for (size_t j = 1; j <= count; j ++) {
+      if ((p[i + j] & 0xc0) != 0x80) {
+        return false;
+      }
+      code = (code << 6) | (p[i + j] & 0x3f);
+    }
+    if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) {
+      return false;
+    }
+    i += count + 1;
+  }
+  return true;
+}
+
+/**
+ * isValidUTF8 と checkText が単純な実装と一致するかを調べる
+ * ASCII の連続の中に正しい文字や不正な並びを置き、
+ * ベクトル化したブロックの境界を跨ぐ位置も通す
+ *
+ * @param   script
+ *          ql_unmht.js の内容 (使用しない)
+ */
+static void
+checkUTF8(const std::string &script) {
+  (void)script;
+
+  static const char *pieces[] = {
+    "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xef\xbf\xbf",
+    "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf", "\xe3\x81\x82",
+    /* 不正な並び */
+    "\xc0\x80", "\xc1\xbf", "\xe0\x80\x80", "\xed\xa0\x80",
+    "\xed\xbf\xbf", "\xf0\x80\x80\x80", "\xf4\x90\x80\x80",
+    "\xf5\x80\x80\x80", "\xff", "\x80", "\xe3\x81", "\xf0\x90\x80",
+    "\xc2\x41",
+  };
+  const size_t piecesCount = sizeof(pieces) / sizeof(pieces[0]);
+
+  uint64_t state = 0xd1b54a32d192ed03ULL;
+  for (size_t round = 0; round < 200000; round ++) {
+    std::string text;
+    size_t length = nextRandom(&state) % 160;
+    while (text.size() < length) {
+      uint64_t r = nextRandom(&state);
+      if (r % 8 == 0) {
+        /* 不正な並びは少なめにする */
+        size_t index = (r >> 8) % piecesCount;
+        if (index >= 7 && (r >> 16) % 4 != 0) {
+          index %= 7;
+        }
+        text += pieces[index];
+      } else if (r % 8 == 1) {
+        text += static_cast<char>(r >> 8);
+      } else {
+        text += static_cast<char>(' ' + (r >> 8) % 95);
+      }
+    }
+
+    bool expected = referenceValidUTF8(text.data(), text.size());
+    if (isValidUTF8(text.data(), text.size()) != expected) {
+      std::string hex;
+      for (size_t i = 0; i < text.size(); i ++) {
+        char buf[4];
+        snprintf(buf, sizeof(buf), "%02x",
+                 static_cast<unsigned char>(text[i]));
+        hex += buf;
+      }
+      fail("utf8", "isValidUTF8 returns %d for %s", !expected, hex.c_str());
+      break;
+    }
+  }
+
+  static const struct {
+    const char *text;
+    const char *charset;
+    textkind kind;
+  } cases[] = {
+    { "plain", "utf-8", TEXT_KIND_ASCII },
+    { "plain", "Shift_JIS", TEXT_KIND_ASCII },
+    { "plain", NULL, TEXT_KIND_OTHER },
+    { "\xe3\x81\x82", "UTF-8", TEXT_KIND_UTF8 },
+    { "\xe3\x81\x82", "euc-jp", TEXT_KIND_OTHER },
+    { "\xe3\x81", "utf-8", TEXT_KIND_OTHER },
+    { "\x1b$B$\"\x1b(B", "iso-2022-jp", TEXT_KIND_OTHER },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i ++) {
+    textkind kind = checkText(cases[i].text, strlen(cases[i].text),
+                              cases[i].charset);
+    if (kind != cases[i].kind) {
+      fail("utf8", "checkText returns %d for case %zu, %d expected",
+           kind, i, cases[i].kind);
+    }
+  }
+}
+
+/**
+ * HTML を分割して入力した結果を返す
+ *
+ * @param   html
+ *          HTML
+ * @param   sizes
+ *          分割する長さ
+ *          足りなければ最後の長さを繰り返す
+ * @param   text
+ *          (出力) 抽出したテキスト
+ * @returns 成功したか
+ */
+static bool
+streamHTMLText(const std::string &html, const std::vector<size_t> &sizes,
+               std::string *text) {
+  htmltextstream *stream = create_htmltextstream();
+  if (stream == NULL) {
+    return false;
+  }
+
+  std::vector<char> buffer;
+  size_t pos = 0;
+  for (size_t i = 0; pos < html.size(); i ++) {
+    size_t size = sizes[i < sizes.size() ? i : sizes.size() - 1];
+    if (size > html.size() - pos) {
+      size = html.size() - pos;
+    }
+    buffer.resize(size + HTMLTEXT_MARGIN);
+    size_t n = feed_htmltextstream(stream, html.data() + pos, size,
+                                   buffer.data());
+    if (n > size + HTMLTEXT_MARGIN) {
+      delete_htmltextstream(stream);
+      return false;
+    }
+    text->append(buffer.data(), n);
+    pos += size;
+  }
+  buffer.resize(HTMLTEXT_MARGIN);
+  text->append(buffer.data(), finish_htmltextstream(stream, buffer.data()));
+
+  delete_htmltextstream(stream);
+  return true;
+}
+
+/**
+ * html_to_text が期待するテキストを返し、
+ * 分割して入力した結果が区切り方に関わらず一致するかを調べる
+ *
+ * @param   script
+ *          ql_unmht.js の内容 (使用しない)
+ */
+static void
+checkHTMLText(const std::string &script) {
+  (void)script;
+
+  static const struct {
+    const char *html;
+    const char *text;
+  } cases[] = {
+    { "<!DOCTYPE html><html><head><title>T</title>"
+      "<style>p { color: red }</style>"
+      "<script>if (a < b) { x(\"</p>\"); }</script></head>"
+      "<body><!-- <p>comment</p> --><p>Hello&nbsp;&amp; <b>wo</b>rld</p>"
+      "<div>next&lt;</div>  tail  </body></html>",
+      "T Hello\xc2\xa0& world next< tail" },
+    { "a<br>b<SCRIPT type=x>var s = '</p>';</SCRIPT>c",
+      "a bc" },
+    { "x&quot;y&gt;z&unknown;", "x\"y>z&unknown;" },
+    { "<p>\xe3\x81\x82 \t\r\n \xe3\x81\x84</p>", "\xe3\x81\x82 \xe3\x81\x84" },
+    { "", "" },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i ++) {
+    std::string html = cases[i].html;
+    char *text;
+    size_t textSize;
+    if (!html_to_text(html.data(), html.size(), &text, &textSize)) {
+      fail("htmltext", "html_to_text failed for case %zu", i);
+      continue;
+    }
+    std::string whole(text, textSize);
+    free(text);
+    if (whole != cases[i].text) {
+      fail("htmltext", "case %zu returns \"%s\"", i, whole.c_str());
+    }
+
+    /* 全ての位置で 2 つに分けた場合と、一定の長さに分けた場合 */
+    for (size_t split = 1; split < html.size(); split ++) {
+      std::vector<size_t> sizes(1, split);
+      sizes.push_back(html.size());
+      std::string streamed;
+      if (!streamHTMLText(html, sizes, &streamed) || streamed != whole) {
+        fail("htmltext", "case %zu differs when split at %zu", i, split);
+      }
+    }
+    for (size_t size = 1; size <= 8; size ++) {
+      std::vector<size_t> sizes(1, size);
+      std::string streamed;
+      if (!streamHTMLText(html, sizes, &streamed) || streamed != whole) {
+        fail("htmltext", "case %zu differs when fed by %zu bytes", i, size);
+      }
+    }
+  }
+}
+
+/**
+ * ql_unmht.js が失敗した場合や不正な展開情報を返した場合に NULL を返し、
+ * その後も同じスレッドで正しく展開できるかを調べる
+ * 失敗した展開情報の開放の漏れは soak で調べる
+ *
+ * @param   script
+ *          ql_unmht.js の内容
+ */
+static void
+checkExtractErrors(const std::string &script) {
+  static const char *brokenScripts[] = {
+    "throw new Error(\"broken\");",
+    "undefined;",
+    "({ baseURI: 1 });",
+    /* 1 つ目のパートを読み込んだ後で失敗する */
+    "({ baseURI: \"b\", subject: \"s\", parts: [ { charset: \"utf-8\","
+    " mimetype: \"text/html\", contentTransferEncoding: \"\","
+    " eParam: { cid: \"a\", location: \"l\", content: \"x\","
+    " isStartPart: true } }, null ] });",
+  };
+  static const char mht[] =
+    "MIME-Version: 1.0\r\n"
+    "Content-Type: multipart/related; boundary=\"b\"\r\n"
+    "\r\n"
+    "--b\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n"
+    "Content-Location: http://example.com/\r\n"
+    "\r\n"
+    "<html><body><img src=\"a.png\"></body></html>\r\n"
+    "--b\r\n"
+    "Content-Type: image/png\r\n"
+    "Content-Transfer-Encoding: base64\r\n"
+    "Content-Location: http://example.com/a.png\r\n"
+    "\r\n"
+    "iVBORw0KGgo=\r\n"
+    "--b--\r\n";
+
+  for (size_t round = 0; round < 100; round ++) {
+    for (size_t i = 0; i < sizeof(brokenScripts) / sizeof(brokenScripts[0]);
+         i ++) {
+      efileinfo *info = extract_buffer(mht, sizeof(mht) - 1,
+                                       brokenScripts[i], EXTRACT_CID);
+      if (info != NULL) {
+        fail("extract", "broken script %zu returns a result", i);
+        delete_efileinfo(info);
+        return;
+      }
+    }
+
+    /* 壊れた実行環境を使い回さずに展開できる */
+    efileinfo *info = extract_buffer(mht, sizeof(mht) - 1, script.c_str(),
+                                     EXTRACT_CID);
+    if (info == NULL) {
+      fail("extract", "extraction fails after broken scripts");
+      return;
+    }
+    bool valid = info->startPart != NULL && info->partsCount >= 2;
+    delete_efileinfo(info);
+    if (!valid) {
+      fail("extract", "the result lacks parts after broken scripts");
+      return;
+    }
+  }
+}
+
+/**
+ * 検査
+ */
+static const struct {
+  const char *name;                          /* 名前 */
+  bool scripted;                             /* ql_unmht.js を実行するか */
+  void (*check)(const std::string &script);  /* 検査する関数 */
+} checks[] = {
+  { "decode", false, checkDecode },
+  { "range", false, checkRangeDecode },
+  { "utf8", false, checkUTF8 },
+  { "htmltext", false, checkHTMLText },
+  { "extract", true, checkExtractErrors },
+};
+
+/**
+ * ファイルを全て読み込む
+ *
+ * @param   path
+ *          ファイルのパス
+ * @param   content
+ *          (出力) ファイルの内容
+ * @returns 成功したか
+ */
+static bool
+readFile(const char *path, std::string *content) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    content->append(buffer, n);
+  }
+  bool result = !ferror(f);
+  fclose(f);
+  return result;
+}
+
+/**
+ * 使い方を表示する
+ *
+ * @returns 終了コード
+ */
+static int
+usage(void) {
+  fprintf(stderr, "usage: ql_unmht_test [SCRIPT]\n");
+  return 2;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc > 2) {
+    return usage();
+  }
+
+  std::string script;
+  if (argc == 2 && !readFile(argv[1], &script)) {
+    fprintf(stderr, "ql_unmht_test: %s: cannot read\n", argv[1]);
+    return 2;
+  }
+
+  for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i ++) {
+    if (checks[i].scripted && script.empty()) {
+      printf("%s: skipped\n", checks[i].name);
+      continue;
+    }
+    size_t before = failures;
+    checks[i].check(script);
+    printf("%s: %s\n", checks[i].name, failures == before ? "ok" : "FAILED");
+  }
+
+  return failures == 0 ? 0 : 1;
+}